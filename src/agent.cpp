@@ -0,0 +1,430 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <expected>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "crypto.h"
+#include "fileio.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+
+    using agent::Op;
+    using agent::Status;
+
+    constexpr size_t SIZE_LEN = 4;
+    // id and op or status.
+    constexpr size_t FRAME_HEADER = 5;
+
+    // Stop reading from a client that is not draining its responses.
+    constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+    constexpr size_t READ_CHUNK = 16 * 1024;
+
+    using agent::Buffer;
+
+    template <std::unsigned_integral T, typename Out>
+    void put(Out& out, T value)
+    {
+        auto at = out.size();
+        out.resize(at + sizeof(T));
+        store<std::endian::little>(std::span(out).subspan(at).template first<sizeof(T)>(), value);
+    }
+
+    template <typename Out>
+    void put(Out& out, std::span<const std::byte> data)
+    {
+        out.insert(out.end(), data.begin(), data.end());
+    }
+
+    uint32_t get_u32(std::span<const std::byte> in, size_t offset)
+    {
+        return load<std::endian::little>(in.subspan(offset).first<4>());
+    }
+
+    // Open a response frame; finish_frame() fills in its size.
+    size_t begin_frame(Buffer& out, uint32_t id, Status status)
+    {
+        auto at = out.size();
+        put<uint32_t>(out, 0);
+        put(out, id);
+        put(out, static_cast<uint8_t>(status));
+        return at;
+    }
+
+    void finish_frame(Buffer& out, size_t at)
+    {
+        auto size = static_cast<uint32_t>(out.size() - at - SIZE_LEN);
+        store<std::endian::little>(std::span(out).subspan(at).first<4>(), size);
+    }
+
+    std::string_view text(std::span<const std::byte> data)
+    {
+        return { reinterpret_cast<const char*>(data.data()), data.size() };
+    }
+
+    // Clear a buffer that held plaintext, keeping its capacity.
+    void wipe(Buffer& buf)
+    {
+        ::explicit_bzero(buf.data(), buf.size());
+        buf.clear();
+    }
+
+} // namespace
+
+// Protocol helpers
+
+void agent::encode_request(std::vector<std::byte>& out, uint32_t id, Op op, std::span<const std::byte> payload)
+{
+    put(out, static_cast<uint32_t>(FRAME_HEADER + payload.size()));
+    put(out, id);
+    put(out, static_cast<uint8_t>(op));
+    put(out, payload);
+}
+
+std::expected<std::optional<agent::Response>, std::error_code>
+agent::decode_response(std::span<const std::byte>& in)
+{
+    if (in.size() < SIZE_LEN)
+        return std::nullopt;
+    auto size = get_u32(in, 0);
+    if (size < FRAME_HEADER)
+        return std::unexpected(std::make_error_code(std::errc::bad_message));
+    if (in.size() - SIZE_LEN < size)
+        return std::nullopt;
+    Response response {
+        .id = get_u32(in, SIZE_LEN),
+        .status = static_cast<Status>(in[SIZE_LEN + 4]),
+        .payload = in.subspan(SIZE_LEN + FRAME_HEADER, size - FRAME_HEADER),
+    };
+    in = in.subspan(SIZE_LEN + size);
+    return response;
+}
+
+// Agent
+
+struct Agent::Unlocked {
+    Safe safe;
+    // Built here when the safe was loaded without one.
+    std::optional<GroupTree> own_groups;
+
+    const GroupTree& groups() const { return safe.groups() ? *safe.groups() : *own_groups; }
+};
+
+Agent::Agent() = default;
+Agent::~Agent() = default;
+Agent::Agent(Agent&&) noexcept = default;
+Agent& Agent::operator=(Agent&&) noexcept = default;
+
+void Agent::add(Safe&& safe)
+{
+    auto unlocked = std::make_unique<Unlocked>(std::move(safe), std::nullopt);
+    if (!unlocked->safe.groups())
+        unlocked->own_groups = GroupTree::build(unlocked->safe.database(), unlocked->safe.header());
+
+    auto safe_index = static_cast<uint32_t>(safes_.size());
+    auto records = unlocked->safe.database();
+    by_uuid_.reserve(by_uuid_.size() + records.size());
+    by_title_.reserve(by_title_.size() + records.size());
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        Location location { safe_index, i };
+        if (auto uuid = record_uuid(records[i]))
+            by_uuid_.try_emplace(*uuid, location);
+        if (const auto* title = find_field(records[i], RecordFieldType::TITLE))
+            by_title_.emplace(text(title->data), location);
+    }
+    safes_.push_back(std::move(unlocked));
+}
+
+void Agent::lock()
+{
+    by_uuid_.clear();
+    by_title_.clear();
+    safes_.clear();
+    drop_cached_handles();
+}
+
+std::expected<size_t, std::error_code> Agent::process(std::span<const std::byte> in, Buffer& out)
+{
+    size_t consumed = 0;
+    while (in.size() - consumed >= SIZE_LEN) {
+        auto size = get_u32(in, consumed);
+        if (size < FRAME_HEADER || size > agent::MAX_REQUEST)
+            return std::unexpected(std::make_error_code(std::errc::bad_message));
+        if (in.size() - consumed - SIZE_LEN < size)
+            break;
+        auto frame = in.subspan(consumed + SIZE_LEN, size);
+        consumed += SIZE_LEN + size;
+
+        auto start = std::chrono::steady_clock::now();
+        handle(get_u32(frame, 0), static_cast<Op>(frame[4]), frame.subspan(FRAME_HEADER), out);
+        auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+
+        ++stats_.requests;
+        stats_.total_ns += ns;
+        stats_.max_ns = std::max(stats_.max_ns, ns);
+        auto bucket = ns == 0 ? 0 : static_cast<size_t>(std::bit_width(ns)) - 1;
+        ++stats_.histogram[std::min(bucket, agent::LATENCY_BUCKETS - 1)];
+    }
+    return consumed;
+}
+
+void Agent::handle(uint32_t id, Op op, std::span<const std::byte> payload, Buffer& out)
+{
+    auto reply = [&](Status status) { finish_frame(out, begin_frame(out, id, status)); };
+
+    switch (op) {
+    case Op::STATS: {
+        auto at = begin_frame(out, id, Status::OK);
+        put(out, stats_.requests);
+        put(out, stats_.total_ns);
+        put(out, stats_.max_ns);
+        for (auto count : stats_.histogram)
+            put(out, count);
+        finish_frame(out, at);
+        return;
+    }
+    case Op::LOCK:
+        lock();
+        reply(Status::OK);
+        return;
+    case Op::LOOKUP_UUID:
+    case Op::LOOKUP_TITLE:
+    case Op::LOOKUP_GROUP:
+        ++lookups_;
+        break;
+    default:
+        reply(Status::BAD_REQUEST);
+        return;
+    }
+
+    if (locked()) {
+        reply(Status::LOCKED);
+        return;
+    }
+
+    std::vector<Location> found;
+    if (op == Op::LOOKUP_UUID) {
+        Uuid uuid;
+        if (payload.size() != uuid.size()) {
+            reply(Status::BAD_REQUEST);
+            return;
+        }
+        std::memcpy(uuid.data(), payload.data(), uuid.size());
+        if (auto it = by_uuid_.find(uuid); it != by_uuid_.end())
+            found.push_back(it->second);
+    } else if (op == Op::LOOKUP_TITLE) {
+        auto [first, last] = by_title_.equal_range(text(payload));
+        for (auto it = first; it != last; ++it)
+            found.push_back(it->second);
+        std::ranges::sort(found, {}, [](const Location& l) { return std::pair(l.safe, l.record); });
+    } else {
+        for (uint32_t s = 0; s < safes_.size(); ++s) {
+            const auto& groups = safes_[s]->groups();
+            if (auto node = groups.find(text(payload))) {
+                for (auto record : groups.records(*node))
+                    found.push_back({ s, record });
+            }
+        }
+    }
+
+    if (found.empty()) {
+        reply(Status::NOT_FOUND);
+        return;
+    }
+    write_records(found, id, out);
+}
+
+void Agent::write_records(std::span<const Location> found, uint32_t id, Buffer& out) const
+{
+    auto at = begin_frame(out, id, Status::OK);
+    put(out, static_cast<uint32_t>(found.size()));
+    for (auto [s, r] : found) {
+        const auto& record = safes_[s]->safe.database()[r];
+        put(out, s);
+        put(out, r);
+        put(out, static_cast<uint32_t>(record.fields.size()));
+        for (const auto& field : record.fields) {
+            put(out, static_cast<uint8_t>(field.type));
+            put(out, static_cast<uint32_t>(field.data.size()));
+            put(out, field.data);
+        }
+    }
+    finish_frame(out, at);
+}
+
+// Server
+
+namespace {
+
+    struct Client {
+        FileDescriptor fd;
+        Buffer in;
+        Buffer out;
+        size_t sent = 0;
+        // The client has shut down its side; answer and then drop it.
+        bool eof = false;
+
+        ~Client()
+        {
+            wipe(in);
+            wipe(out);
+        }
+        Client(FileDescriptor&& f) : fd(std::move(f)) { }
+        Client(Client&&) noexcept = default;
+        Client& operator=(Client&&) noexcept = default;
+    };
+
+    bool same_user(int fd)
+    {
+        ucred cred {};
+        socklen_t len = sizeof(cred);
+        if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+            return false;
+        return cred.uid == ::geteuid();
+    }
+
+    // Read what is available, answer every complete request and send as
+    // much as the socket takes. false when the client should be dropped.
+    bool pump(Agent& agent, Client& client, bool readable)
+    {
+        if (readable && !client.eof) {
+            for (;;) {
+                auto at = client.in.size();
+                client.in.resize(at + READ_CHUNK);
+                auto n = ::recv(client.fd.get(), client.in.data() + at, READ_CHUNK, MSG_DONTWAIT);
+                client.in.resize(at + static_cast<size_t>(std::max<ssize_t>(n, 0)));
+                if (n == 0) {
+                    client.eof = true;
+                    break;
+                }
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+                    return false;
+                }
+                if (static_cast<size_t>(n) < READ_CHUNK)
+                    break;
+            }
+            auto consumed = agent.process(client.in, client.out);
+            if (!consumed)
+                return false;
+            // Shifting the rest down leaves a stale copy at the end.
+            auto left = client.in.size() - *consumed;
+            std::memmove(client.in.data(), client.in.data() + *consumed, left);
+            ::explicit_bzero(client.in.data() + left, *consumed);
+            client.in.resize(left);
+        }
+
+        while (client.sent < client.out.size()) {
+            auto n = ::send(client.fd.get(), client.out.data() + client.sent, client.out.size() - client.sent,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return false;
+            }
+            client.sent += static_cast<size_t>(n);
+        }
+        if (client.sent == client.out.size()) {
+            wipe(client.out);
+            client.sent = 0;
+        }
+        return !client.eof || client.sent < client.out.size();
+    }
+
+} // namespace
+
+std::error_code serve(Agent& agent, int listener, const ServeOptions& options)
+{
+    using clock = std::chrono::steady_clock;
+
+    FileDescriptor wakeup(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (!wakeup)
+        return last_system_error();
+    std::stop_callback on_stop(options.stop_token, [&] {
+        uint64_t one = 1;
+        (void)::write(wakeup.get(), &one, sizeof(one));
+    });
+
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    auto last_request = clock::now();
+
+    while (!options.stop_token.stop_requested()) {
+        fds.clear();
+        fds.push_back({ .fd = listener, .events = POLLIN, .revents = 0 });
+        fds.push_back({ .fd = wakeup.get(), .events = POLLIN, .revents = 0 });
+        for (const auto& client : clients) {
+            short events = !client.eof && client.out.size() < MAX_PENDING_OUTPUT ? POLLIN : 0;
+            if (client.sent < client.out.size())
+                events |= POLLOUT;
+            fds.push_back({ .fd = client.fd.get(), .events = events, .revents = 0 });
+        }
+
+        int timeout = -1;
+        if (options.idle_timeout && !agent.locked()) {
+            auto left = *options.idle_timeout - (clock::now() - last_request);
+            timeout = static_cast<int>(std::max<int64_t>(
+                std::chrono::ceil<std::chrono::milliseconds>(left).count(), 0));
+        }
+        int ready = ::poll(fds.data(), fds.size(), timeout);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            return last_system_error();
+        }
+
+        if (options.idle_timeout && !agent.locked() && clock::now() - last_request >= *options.idle_timeout)
+            agent.lock();
+
+        // Clients first: accepting may grow `clients` past `fds`.
+        for (size_t i = clients.size(); i-- > 0;) {
+            auto revents = fds[i + 2].revents;
+            if (revents == 0)
+                continue;
+            // Only lookups count as activity.
+            auto handled = agent.lookups();
+            bool keep = !(revents & (POLLERR | POLLNVAL))
+                && pump(agent, clients[i], revents & (POLLIN | POLLHUP));
+            if (agent.lookups() != handled)
+                last_request = clock::now();
+            if (!keep)
+                clients.erase(clients.begin() + static_cast<ptrdiff_t>(i));
+        }
+
+        // One connection per wakeup, so that `listener` may be blocking.
+        if (fds[0].revents & POLLIN) {
+            FileDescriptor fd(::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+            if (fd && same_user(fd.get()))
+                clients.emplace_back(std::move(fd));
+            else if (!fd && errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+                return last_system_error();
+        }
+    }
+    return {};
+}
+
+} // namespace psafe3
@@ -0,0 +1,149 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto.h"
+#include "fields.h"
+#include "groups.h"
+#include "safe.h"
+
+// Serving lookups from unlocked safes over a Unix socket, like ssh-agent.
+//
+// Protocol, all integers little endian. Clients may send any number of
+// requests without waiting; responses come back in request order.
+//
+//   request:  u32 size, u32 id, u8 op, payload      (size counts from id)
+//   response: u32 size, u32 id, u8 status, payload
+//
+//   op            request payload     response payload
+//   LOOKUP_UUID   16 byte UUID        records
+//   LOOKUP_TITLE  title               records
+//   LOOKUP_GROUP  dotted group path   records, whole subtree
+//   STATS                             u64 requests, u64 total ns,
+//                                     u64 max ns, LATENCY_BUCKETS x u64
+//   LOCK                              (none)
+//
+//   records: u32 count, then per record u32 safe, u32 record,
+//            u32 field count, then per field u8 type, u32 len, data
+//
+// Latency bucket i counts requests that took [2^i, 2^(i+1)) ns to serve.
+
+namespace psafe3 {
+
+namespace agent {
+
+    enum class Op : uint8_t {
+        LOOKUP_UUID = 1,
+        LOOKUP_TITLE = 2,
+        LOOKUP_GROUP = 3,
+        STATS = 4,
+        LOCK = 5,
+    };
+
+    enum class Status : uint8_t {
+        OK = 0,
+        NOT_FOUND = 1,
+        LOCKED = 2,
+        BAD_REQUEST = 3,
+    };
+
+    constexpr size_t MAX_REQUEST = 64 * 1024;
+
+    // Responses carry passwords, so the buffers they are written to wipe
+    // whatever memory they give up.
+    using Buffer = std::vector<std::byte, WipingAllocator<std::byte>>;
+    constexpr size_t LATENCY_BUCKETS = 32;
+
+    // Append a request frame to `out`.
+    void encode_request(std::vector<std::byte>& out, uint32_t id, Op op, std::span<const std::byte> payload = {});
+
+    struct Response {
+        uint32_t id;
+        Status status;
+        std::span<const std::byte> payload;
+    };
+
+    // Decode the response frame at the front of `in` and advance past it.
+    // std::nullopt if the frame is incomplete.
+    std::expected<std::optional<Response>, std::error_code> decode_response(std::span<const std::byte>& in);
+
+} // namespace agent
+
+// The state of an agent: unlocked safes with their lookup indexes, and
+// latency counters. Not thread safe; serve() drives it from one thread.
+class Agent {
+public:
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        std::array<uint64_t, agent::LATENCY_BUCKETS> histogram {};
+    };
+
+    Agent();
+    ~Agent();
+    Agent(Agent&&) noexcept;
+    Agent& operator=(Agent&&) noexcept;
+
+    // Serve lookups from `safe`, which must have its records loaded.
+    void add(Safe&& safe);
+
+    // Drop every safe, wiping its plaintext and keys, and the idle libgcrypt
+    // handles of every thread, see drop_cached_handles(). Lookups answer
+    // LOCKED from then on.
+    void lock();
+    bool locked() const noexcept { return safes_.empty(); }
+
+    // Handle every complete request at the front of `in`, appending the
+    // responses to `out`. Returns the number of bytes consumed; an error
+    // means the stream is unusable and the connection should be dropped.
+    std::expected<size_t, std::error_code> process(std::span<const std::byte> in, agent::Buffer& out);
+
+    const Stats& stats() const noexcept { return stats_; }
+
+    // Lookup requests handled so far, LOCKED answers included.
+    uint64_t lookups() const noexcept { return lookups_; }
+
+private:
+    struct Location {
+        uint32_t safe;
+        uint32_t record;
+    };
+    struct Unlocked;
+
+    std::vector<std::unique_ptr<Unlocked>> safes_;
+    std::unordered_map<Uuid, Location, UuidHash> by_uuid_;
+    std::unordered_multimap<std::string_view, Location> by_title_;
+    Stats stats_;
+    uint64_t lookups_ = 0;
+
+    void handle(uint32_t id, agent::Op op, std::span<const std::byte> payload, agent::Buffer& out);
+    void write_records(std::span<const Location> found, uint32_t id, agent::Buffer& out) const;
+};
+
+struct ServeOptions {
+    // Lock the agent after this long without a lookup. STATS and other
+    // requests do not count, so monitoring does not keep it unlocked.
+    std::optional<std::chrono::milliseconds> idle_timeout;
+    std::stop_token stop_token;
+};
+
+// Accept connections on the listening Unix socket `listener` and serve
+// them until stopped. Peers whose SO_PEERCRED uid differs from ours are
+// disconnected straight away.
+std::error_code serve(Agent& agent, int listener, const ServeOptions& options = {});
+
+} // namespace psafe3
@@ -0,0 +1,97 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstring>
+#include <expected>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include <gcrypt.h>
+
+#include "audit.h"
+#include "crypto.h"
+#include "fields.h"
+
+namespace psafe3 {
+
+size_t ReuseAuditor::DigestHash::operator()(const Digest& digest) const noexcept
+{
+    // The digests are uniformly distributed already.
+    size_t h;
+    std::memcpy(&h, digest.data(), sizeof(h));
+    return h;
+}
+
+ReuseAuditor::ReuseAuditor(SHA256HMA&& hmac)
+    : hmac_(std::move(hmac))
+{
+}
+
+std::expected<ReuseAuditor, std::error_code> ReuseAuditor::create()
+{
+    SecureBytes key(SHA256_SIZE);
+    gcry_randomize(key.data(), key.size(), GCRY_STRONG_RANDOM);
+    auto hmac = SHA256HMA::create(key.as_span());
+    if (!hmac)
+        return std::unexpected(hmac.error());
+    return ReuseAuditor(std::move(hmac.value()));
+}
+
+std::error_code ReuseAuditor::add(std::span<const std::byte> password, Occurrence occurrence)
+{
+    if (password.empty())
+        return {};
+    hmac_.reset();
+    hmac_.write(password);
+    auto digest = hmac_.finish();
+    if (!digest)
+        return digest.error();
+    auto [it, added] = groups_.try_emplace(*digest, static_cast<uint32_t>(occurrences_.size()));
+    if (added)
+        occurrences_.emplace_back();
+    // Records are added in turn, so a repeat within one is the last entry.
+    auto& group = occurrences_[it->second];
+    if (!group.empty() && group.back().safe == occurrence.safe && group.back().record == occurrence.record)
+        return {};
+    group.push_back(occurrence);
+    return {};
+}
+
+std::error_code ReuseAuditor::add(std::span<const Record> records)
+{
+    auto safe = safes_++;
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto record = static_cast<uint32_t>(i);
+        if (const auto* password = find_field(records[i], RecordFieldType::PASSWORD); password) {
+            if (auto err = add(password->data, { safe, record, false }); err)
+                return err;
+        }
+
+        const auto* field = find_field(records[i], RecordFieldType::PASSWORD_HISTORY);
+        if (!field)
+            continue;
+        auto history = PasswordHistory::parse(field->data);
+        if (!history)
+            continue;
+        for (auto entry : *history) {
+            if (!entry)
+                break;
+            std::span password(reinterpret_cast<const std::byte*>(entry->password.data()), entry->password.size());
+            if (auto err = add(password, { safe, record, true }); err)
+                return err;
+        }
+    }
+    return {};
+}
+
+std::vector<std::vector<ReuseAuditor::Occurrence>> ReuseAuditor::reused() const
+{
+    std::vector<std::vector<Occurrence>> result;
+    for (const auto& group : occurrences_) {
+        if (group.size() > 1)
+            result.push_back(group);
+    }
+    return result;
+}
+
+} // namespace psafe3
@@ -0,0 +1,64 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// Finds passwords used more than once, within a safe or across safes.
+//
+// Each PASSWORD field and each PASSWORD_HISTORY entry is fed straight from
+// the decrypted record data into an HMAC under a random key that only
+// lives in secure memory, and records are grouped by digest. Plaintext is
+// never copied, and the digests are of no use once the auditor is gone.
+// Empty passwords are ignored.
+class ReuseAuditor {
+public:
+    struct Occurrence {
+        // Order in which the safe was added, and record index within it.
+        uint32_t safe;
+        uint32_t record;
+        // Whether the password is from the record's PASSWORD_HISTORY.
+        bool history;
+    };
+
+    static std::expected<ReuseAuditor, std::error_code> create();
+
+    // Add the passwords of a safe, which becomes the next safe index.
+    // Malformed password history is skipped.
+    std::error_code add(std::span<const Record> records);
+    std::error_code add(const Safe& safe) { return add(safe.database()); }
+
+    // Every password used by more than one record, as groups of
+    // occurrences in the order they were added. A record appears once in a
+    // group, by its first occurrence, so one that repeats a password in its
+    // own history is not reuse.
+    std::vector<std::vector<Occurrence>> reused() const;
+
+private:
+    using Digest = std::array<std::byte, SHA256_SIZE>;
+
+    struct DigestHash {
+        size_t operator()(const Digest& digest) const noexcept;
+    };
+
+    SHA256HMA hmac_;
+    uint32_t safes_ = 0;
+    std::unordered_map<Digest, uint32_t, DigestHash> groups_;
+    std::vector<std::vector<Occurrence>> occurrences_;
+
+    explicit ReuseAuditor(SHA256HMA&& hmac);
+
+    std::error_code add(std::span<const std::byte> password, Occurrence occurrence);
+};
+
+} // namespace psafe3
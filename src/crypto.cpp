@@ -1,9 +1,16 @@
 // https://github.com/marcbutler/libpsafe3/LICENSE
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <mutex>
 #include <new>
 #include <system_error>
+#include <vector>
+
+#include <sys/mman.h>
 
 #include "crypto.h"
 #include "error.h"
@@ -46,6 +53,12 @@ namespace {
         return {};
     }
 
+    // Every entry point calls this before touching libgcrypt. The first call
+    // may come from several threads at once: initialization of the
+    // function-local static is serialized by the compiler, so do_init() runs
+    // exactly once, the other threads block until it has finished, and all
+    // of them see its result. gcry_check_version() thereby also runs before
+    // any other libgcrypt call, as libgcrypt requires of threaded programs.
     std::error_code ensure_init()
     {
         static const std::error_code result = do_init();
@@ -54,6 +67,202 @@ namespace {
 
 } // namespace
 
+// Handle pool
+//
+// Opening a secure libgcrypt handle allocates its context from secure
+// memory, which is slow next to the work done with a handle while
+// unlocking a small safe. Handles are therefore not closed but reset and
+// kept on a per-thread free list, and the next user on the same thread
+// re-keys them. Idle handles hold on to their last key schedule in secure
+// memory until they are reused, the thread exits or drop_cached_handles()
+// is called. Every thread's pools are listed in a process-wide registry so
+// that drop_cached_handles() can reach them all; each pool has its own
+// mutex, which only its thread takes in the normal course of things.
+
+namespace {
+
+    constexpr size_t POOL_DEPTH = 4;
+
+    template <typename H, void (*Close)(H)>
+    class Pool {
+    public:
+        ~Pool() { clear(); }
+
+        H take()
+        {
+            std::lock_guard lock(mutex_);
+            if (idle_.empty())
+                return nullptr;
+            H hd = idle_.back();
+            idle_.pop_back();
+            return hd;
+        }
+
+        void put(H hd)
+        {
+            std::unique_lock lock(mutex_);
+            if (idle_.size() < POOL_DEPTH) {
+                idle_.push_back(hd);
+                return;
+            }
+            lock.unlock();
+            Close(hd);
+        }
+
+        void clear()
+        {
+            std::lock_guard lock(mutex_);
+            for (H hd : idle_)
+                Close(hd);
+            idle_.clear();
+        }
+
+        size_t size()
+        {
+            std::lock_guard lock(mutex_);
+            return idle_.size();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<H> idle_;
+    };
+
+    // Handles may be released while the thread's pools are being destroyed,
+    // e.g. by other thread_local objects; they are closed directly then.
+    enum class PoolState : uint8_t { unused, alive, gone };
+    thread_local PoolState pool_state = PoolState::unused;
+
+    struct Pools;
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Pools*> pools;
+    };
+
+    // Never destroyed, as threads may exit after static destructors ran.
+    Registry& registry()
+    {
+        static auto* registry = new Registry;
+        return *registry;
+    }
+
+    struct Pools {
+        Pool<gcry_md_hd_t, gcry_md_close> sha256;
+        Pool<gcry_md_hd_t, gcry_md_close> hmac;
+        Pool<gcry_cipher_hd_t, gcry_cipher_close> ecb;
+        Pool<gcry_cipher_hd_t, gcry_cipher_close> cbc;
+
+        Pools()
+        {
+            std::lock_guard lock(registry().mutex);
+            registry().pools.push_back(this);
+            pool_state = PoolState::alive;
+        }
+
+        ~Pools()
+        {
+            std::lock_guard lock(registry().mutex);
+            std::erase(registry().pools, this);
+            pool_state = PoolState::gone;
+        }
+
+        void clear()
+        {
+            sha256.clear();
+            hmac.clear();
+            ecb.clear();
+            cbc.clear();
+        }
+
+        size_t size() { return sha256.size() + hmac.size() + ecb.size() + cbc.size(); }
+    };
+
+    Pools* thread_pools()
+    {
+        if (pool_state == PoolState::gone)
+            return nullptr;
+        thread_local Pools pools;
+        return &pools;
+    }
+
+    std::expected<gcry_md_hd_t, std::error_code> open_md(bool hmac)
+    {
+        if (auto err = ensure_init(); err)
+            return std::unexpected(err);
+        if (auto* pools = thread_pools(); pools) {
+            if (auto hd = (hmac ? pools->hmac : pools->sha256).take(); hd)
+                return hd;
+        }
+        gcry_md_hd_t hd;
+        gcry_error_t err = gcry_md_open(&hd, GCRY_MD_SHA256,
+            GCRY_MD_FLAG_SECURE | (hmac ? GCRY_MD_FLAG_HMAC : 0));
+        if (err)
+            return std::unexpected(make_error_code(err));
+        return hd;
+    }
+
+    void recycle_md(gcry_md_hd_t hd, bool hmac)
+    {
+        if (!hd)
+            return;
+        gcry_md_reset(hd);
+        if (auto* pools = thread_pools(); pools)
+            (hmac ? pools->hmac : pools->sha256).put(hd);
+        else
+            gcry_md_close(hd);
+    }
+
+    void recycle_sha256(gcry_md_hd_t hd) { recycle_md(hd, false); }
+    void recycle_hmac(gcry_md_hd_t hd) { recycle_md(hd, true); }
+
+    std::expected<gcry_cipher_hd_t, std::error_code> open_twofish(int mode)
+    {
+        if (auto err = ensure_init(); err)
+            return std::unexpected(err);
+        if (auto* pools = thread_pools(); pools) {
+            if (auto hd = (mode == GCRY_CIPHER_MODE_CBC ? pools->cbc : pools->ecb).take(); hd)
+                return hd;
+        }
+        gcry_cipher_hd_t hd;
+        gcry_error_t err = gcry_cipher_open(&hd, GCRY_CIPHER_TWOFISH, mode, GCRY_CIPHER_SECURE);
+        if (err)
+            return std::unexpected(make_error_code(err));
+        return hd;
+    }
+
+    void recycle_twofish(gcry_cipher_hd_t hd, int mode)
+    {
+        if (!hd)
+            return;
+        gcry_cipher_reset(hd);
+        if (auto* pools = thread_pools(); pools)
+            (mode == GCRY_CIPHER_MODE_CBC ? pools->cbc : pools->ecb).put(hd);
+        else
+            gcry_cipher_close(hd);
+    }
+
+    void recycle_ecb(gcry_cipher_hd_t hd) { recycle_twofish(hd, GCRY_CIPHER_MODE_ECB); }
+    void recycle_cbc(gcry_cipher_hd_t hd) { recycle_twofish(hd, GCRY_CIPHER_MODE_CBC); }
+
+} // namespace
+
+void drop_cached_handles()
+{
+    std::lock_guard lock(registry().mutex);
+    for (auto* pools : registry().pools)
+        pools->clear();
+}
+
+size_t cached_handle_count()
+{
+    std::lock_guard lock(registry().mutex);
+    size_t count = 0;
+    for (auto* pools : registry().pools)
+        count += pools->size();
+    return count;
+}
+
 // SecureBytes
 
 SecureBytes::SecureBytes(size_t size)
@@ -69,15 +278,50 @@ SecureBytes::SecureBytes(size_t size)
         throw std::bad_alloc();
 }
 
-SecureBytes::~SecureBytes()
+SecureBytes::SecureBytes(void* data, size_t size, bool mapped) noexcept
+    : data_(data)
+    , size_(size)
+    , mapped_(mapped)
+{
+}
+
+SecureBytes SecureBytes::mapped(size_t size)
+{
+    assert(size > 0);
+    void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        throw std::bad_alloc();
+    SecureBytes bytes(data, size, true);
+    // Best effort, like libgcrypt's own secure heap: an unprivileged
+    // process may not be allowed to lock this much.
+    (void)::madvise(data, size, MADV_DONTDUMP);
+    (void)::mlock(data, size);
+    return bytes;
+}
+
+void SecureBytes::release() noexcept
 {
-    if (data_)
+    if (!data_)
+        return;
+    if (mapped_) {
+        explicit_bzero(data_, size_);
+        ::munmap(data_, size_);
+    } else {
         gcry_free(data_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+SecureBytes::~SecureBytes()
+{
+    release();
 }
 
 SecureBytes::SecureBytes(SecureBytes&& other) noexcept
     : data_(other.data_)
     , size_(other.size_)
+    , mapped_(other.mapped_)
 {
     other.data_ = nullptr;
     other.size_ = 0;
@@ -86,11 +330,12 @@ SecureBytes::SecureBytes(SecureBytes&& other) noexcept
 SecureBytes& SecureBytes::operator=(SecureBytes&& other) noexcept
 {
     if (this != &other) [[likely]] {
-        gcry_free(data_);
+        release();
         data_ = other.data_;
         other.data_ = nullptr;
         size_ = other.size_;
         other.size_ = 0;
+        mapped_ = other.mapped_;
     }
     return *this;
 }
@@ -108,17 +353,27 @@ std::span<const std::byte> SecureBytes::span(size_t offset, size_t len) const no
 
 // stretch_key / sha256
 
+std::error_code StretchOptions::interrupted() const
+{
+    if (stop_token.stop_requested())
+        return Error::cancelled;
+    if (deadline && std::chrono::steady_clock::now() >= *deadline)
+        return Error::deadline_exceeded;
+    return {};
+}
+
 std::expected<SecureBytes, std::error_code>
 stretch_key(std::span<const std::byte> pass,
-    std::span<const std::byte, SHA256_SIZE> salt, uint32_t iterations)
+    std::span<const std::byte, SHA256_SIZE> salt, uint32_t iterations,
+    const StretchOptions& options)
 {
-    if (auto err = ensure_init(); err)
-        return std::unexpected(err);
+    if (iterations > options.max_iterations)
+        return std::unexpected(Error::too_many_iterations);
 
-    psafe3::Handle<gcry_md_hd_t, gcry_md_close> hd;
-    gcry_error_t err = gcry_md_open(&hd.actual, GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE);
-    if (err)
-        return std::unexpected(make_error_code(err));
+    auto opened = open_md(false);
+    if (!opened)
+        return std::unexpected(opened.error());
+    psafe3::Handle<gcry_md_hd_t, recycle_sha256> hd { .actual = *opened };
 
     gcry_md_write(hd(), pass.data(), pass.size());
     gcry_md_write(hd(), salt.data(), salt.size());
@@ -126,11 +381,25 @@ stretch_key(std::span<const std::byte> pass,
     SecureBytes tmp(SHA256_SIZE);
     std::memcpy(tmp.data(), gcry_md_read(hd(), 0), SHA256_SIZE);
 
-    for (uint32_t i = 0; i < iterations; ++i) {
-        gcry_md_reset(hd());
-        gcry_md_write(hd(), tmp.data(), SHA256_SIZE);
-        std::memcpy(tmp.data(), gcry_md_read(hd(), 0), SHA256_SIZE);
+    uint32_t done = 0;
+    uint32_t next_report = std::max<uint32_t>(options.progress_interval, 1);
+    while (done < iterations) {
+        if (auto err = options.interrupted(); err)
+            return std::unexpected(err);
+        auto n = std::min(iterations - done, StretchOptions::CHECK_INTERVAL);
+        for (uint32_t i = 0; i < n; ++i) {
+            gcry_md_reset(hd());
+            gcry_md_write(hd(), tmp.data(), SHA256_SIZE);
+            std::memcpy(tmp.data(), gcry_md_read(hd(), 0), SHA256_SIZE);
+        }
+        done += n;
+        if (options.progress && done >= next_report && done < iterations) {
+            options.progress(done, iterations);
+            next_report = done + std::max<uint32_t>(options.progress_interval, 1);
+        }
     }
+    if (options.progress)
+        options.progress(iterations, iterations);
 
     return tmp;
 }
@@ -138,16 +407,13 @@ stretch_key(std::span<const std::byte> pass,
 std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code>
 sha256(std::span<const std::byte> data)
 {
-    if (auto err = ensure_init(); err)
-        return std::unexpected(err);
-
-    psafe3::Handle<gcry_md_hd_t, gcry_md_close> hd;
-    gcry_error_t err = gcry_md_open(&hd.actual, GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE);
-    if (err)
-        return std::unexpected(make_error_code(err));
+    auto opened = open_md(false);
+    if (!opened)
+        return std::unexpected(opened.error());
+    psafe3::Handle<gcry_md_hd_t, recycle_sha256> hd { .actual = *opened };
 
     gcry_md_write(hd(), data.data(), data.size());
-    err = gcry_md_final(hd());
+    gcry_error_t err = gcry_md_final(hd());
     if (err)
         return std::unexpected(make_error_code(err));
 
@@ -160,12 +426,60 @@ sha256(std::span<const std::byte> data)
     return result;
 }
 
+// extract_random_key / wrap_random_key
+
+std::expected<SecureBytes, std::error_code>
+extract_random_key(const SecureBytes& pass, std::span<const std::byte, TWOFISH_SIZE> block1, std::span<const std::byte, TWOFISH_SIZE> block2)
+{
+    auto opened = open_twofish(GCRY_CIPHER_MODE_ECB);
+    if (!opened)
+        return std::unexpected(opened.error());
+    psafe3::Handle<gcry_cipher_hd_t, recycle_ecb> cipher { .actual = *opened };
+    gcry_error_t err;
+
+    assert(pass.size() == SHA256_SIZE);
+    err = gcry_cipher_setkey(cipher(), pass.data(), SHA256_SIZE);
+    if (err) {
+        return std::unexpected(make_error_code(err));
+    }
+
+    SecureBytes random_key(2 * TWOFISH_SIZE);
+    gcry_cipher_decrypt(cipher(), random_key.data(), TWOFISH_SIZE, block1.data(), TWOFISH_SIZE);
+    gcry_cipher_reset(cipher());
+    gcry_cipher_decrypt(cipher(), random_key.data(TWOFISH_SIZE), TWOFISH_SIZE, block2.data(),
+        TWOFISH_SIZE);
+    return random_key;
+}
+
+std::expected<std::array<std::byte, 2 * TWOFISH_SIZE>, std::error_code>
+wrap_random_key(const SecureBytes& pass, const SecureBytes& random_key)
+{
+    auto opened = open_twofish(GCRY_CIPHER_MODE_ECB);
+    if (!opened)
+        return std::unexpected(opened.error());
+    psafe3::Handle<gcry_cipher_hd_t, recycle_ecb> cipher { .actual = *opened };
+    gcry_error_t err;
+
+    assert(pass.size() == SHA256_SIZE);
+    assert(random_key.size() == 2 * TWOFISH_SIZE);
+    err = gcry_cipher_setkey(cipher(), pass.data(), SHA256_SIZE);
+    if (err) {
+        return std::unexpected(make_error_code(err));
+    }
+
+    std::array<std::byte, 2 * TWOFISH_SIZE> blocks;
+    err = gcry_cipher_encrypt(cipher(), blocks.data(), blocks.size(), random_key.data(), random_key.size());
+    if (err) {
+        return std::unexpected(make_error_code(err));
+    }
+    return blocks;
+}
+
 // SHA256HMA
 
 SHA256HMA::~SHA256HMA()
 {
-    if (hd_)
-        gcry_md_close(hd_);
+    recycle_hmac(hd_);
 }
 
 SHA256HMA::SHA256HMA(SHA256HMA&& o) noexcept
@@ -177,8 +491,7 @@ SHA256HMA::SHA256HMA(SHA256HMA&& o) noexcept
 SHA256HMA& SHA256HMA::operator=(SHA256HMA&& o) noexcept
 {
     if (this != &o) {
-        if (hd_)
-            gcry_md_close(hd_);
+        recycle_hmac(hd_);
         hd_ = o.hd_;
         o.hd_ = nullptr;
     }
@@ -187,20 +500,23 @@ SHA256HMA& SHA256HMA::operator=(SHA256HMA&& o) noexcept
 
 std::expected<SHA256HMA, std::error_code> SHA256HMA::create(std::span<const std::byte> key)
 {
-    if (auto err = ensure_init(); err)
-        return std::unexpected(err);
+    auto hd = open_md(true);
+    if (!hd)
+        return std::unexpected(hd.error());
 
-    gcry_md_hd_t hd;
-    gcry_error_t err = gcry_md_open(&hd, GCRY_MD_SHA256,
-        GCRY_MD_FLAG_SECURE | GCRY_MD_FLAG_HMAC);
+    SHA256HMA hmac(*hd);
+    gcry_error_t err = gcry_md_setkey(*hd, key.data(), key.size());
     if (err)
         return std::unexpected(make_error_code(err));
+    return hmac;
+}
 
-    err = gcry_md_setkey(hd, key.data(), key.size());
-    if (err) {
-        gcry_md_close(hd);
+std::expected<SHA256HMA, std::error_code> SHA256HMA::clone() const
+{
+    gcry_md_hd_t hd;
+    gcry_error_t err = gcry_md_copy(&hd, hd_);
+    if (err)
         return std::unexpected(make_error_code(err));
-    }
     return SHA256HMA(hd);
 }
 
@@ -209,6 +525,11 @@ void SHA256HMA::write(std::span<const std::byte> data)
     gcry_md_write(hd_, data.data(), data.size());
 }
 
+void SHA256HMA::reset()
+{
+    gcry_md_reset(hd_);
+}
+
 std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code> SHA256HMA::finish()
 {
     gcry_md_final(hd_);
@@ -220,4 +541,76 @@ std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code> SHA256HMA::fi
     return result;
 }
 
+// TwofishCBC
+
+TwofishCBC::~TwofishCBC()
+{
+    recycle_cbc(hd_);
+}
+
+TwofishCBC::TwofishCBC(TwofishCBC&& o) noexcept
+    : hd_(o.hd_)
+{
+    o.hd_ = nullptr;
+}
+
+TwofishCBC& TwofishCBC::operator=(TwofishCBC&& o) noexcept
+{
+    if (this != &o) {
+        recycle_cbc(hd_);
+        hd_ = o.hd_;
+        o.hd_ = nullptr;
+    }
+    return *this;
+}
+
+void TwofishCBC::close() noexcept
+{
+    if (hd_)
+        gcry_cipher_close(hd_);
+    hd_ = nullptr;
+}
+
+std::expected<TwofishCBC, std::error_code>
+TwofishCBC::create(std::span<const std::byte> key, std::span<const std::byte, TWOFISH_SIZE> iv)
+{
+    auto opened = open_twofish(GCRY_CIPHER_MODE_CBC);
+    if (!opened)
+        return std::unexpected(opened.error());
+
+    gcry_cipher_hd_t hd = *opened;
+    TwofishCBC cipher(hd);
+    gcry_error_t err = gcry_cipher_setkey(hd, key.data(), key.size());
+    if (err)
+        return std::unexpected(make_error_code(err));
+    err = gcry_cipher_setiv(hd, iv.data(), iv.size());
+    if (err)
+        return std::unexpected(make_error_code(err));
+    return cipher;
+}
+
+std::error_code TwofishCBC::encrypt(std::span<std::byte> data)
+{
+    assert(data.size() % TWOFISH_SIZE == 0);
+    if (gcry_error_t err = gcry_cipher_encrypt(hd_, data.data(), data.size(), nullptr, 0); err)
+        return make_error_code(err);
+    return {};
+}
+
+std::error_code TwofishCBC::decrypt(std::span<std::byte> data)
+{
+    assert(data.size() % TWOFISH_SIZE == 0);
+    if (gcry_error_t err = gcry_cipher_decrypt(hd_, data.data(), data.size(), nullptr, 0); err)
+        return make_error_code(err);
+    return {};
+}
+
+std::error_code TwofishCBC::decrypt(std::span<std::byte> out, std::span<const std::byte> in)
+{
+    assert(out.size() >= in.size() && in.size() % TWOFISH_SIZE == 0);
+    if (gcry_error_t err = gcry_cipher_decrypt(hd_, out.data(), out.size(), in.data(), in.size()); err)
+        return make_error_code(err);
+    return {};
+}
+
 } // namespace psafe3
@@ -2,20 +2,35 @@
 // https://github.com/marcbutler/libpsafe3/LICENSE
 
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <expected>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <span>
+#include <stop_token>
 #include <system_error>
 
 #include <gcrypt.h>
 
+#include "utility.h"
+
 namespace psafe3 {
 
 class SecureBytes {
 public:
     explicit SecureBytes(size_t size);
+
+    // Backed by its own anonymous mapping rather than libgcrypt's secure
+    // heap, for buffers too large for the latter. The pages are locked into
+    // RAM as far as RLIMIT_MEMLOCK allows, excluded from core dumps and
+    // wiped before they are unmapped.
+    static SecureBytes mapped(size_t size);
     ~SecureBytes();
 
     SecureBytes(SecureBytes&&) noexcept;
@@ -49,18 +64,90 @@ public:
 private:
     void* data_;
     size_t size_;
+    bool mapped_ = false;
+
+    SecureBytes(void* data, size_t size, bool mapped) noexcept;
+    void release() noexcept;
+};
+
+// Allocator that wipes memory before freeing it, for containers that hold
+// plaintext and grow: every buffer a reallocation leaves behind is cleared,
+// not just the last one.
+template <typename T>
+struct WipingAllocator {
+    using value_type = T;
+
+    WipingAllocator() noexcept = default;
+    template <typename U>
+    WipingAllocator(const WipingAllocator<U>&) noexcept { }
+
+    T* allocate(size_t n) { return std::allocator<T>().allocate(n); }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        ::explicit_bzero(p, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const WipingAllocator<U>&) const noexcept { return true; }
 };
 
 static constexpr size_t SHA256_SIZE = 32;
 
+// Close the libgcrypt handles kept for reuse by every thread of the
+// process. Idle handles still hold the key schedule they were last used
+// with; call this once done with a safe to wipe them early. Only idle
+// handles are reached: a handle still owned by a live SHA256HMA or
+// TwofishCBC, on any thread, goes back to its thread's pool when that
+// object is destroyed, so destroy those first.
+void drop_cached_handles();
+
+// Number of idle handles kept by all threads.
+size_t cached_handle_count();
+
+// Bounds on the work done to stretch a pass phrase. The iteration count
+// comes from the file, so without them a hostile file can keep the caller
+// busy for minutes.
+struct StretchOptions {
+    static constexpr uint32_t CHECK_INTERVAL = 1024;
+
+    // Checked every CHECK_INTERVAL iterations.
+    std::stop_token stop_token {};
+    std::optional<std::chrono::steady_clock::time_point> deadline {};
+
+    // Refuse files asking for more iterations than this.
+    uint32_t max_iterations = std::numeric_limits<uint32_t>::max();
+
+    // Called with the iterations done and the total about every
+    // `progress_interval` iterations, and once at the end.
+    std::function<void(uint32_t done, uint32_t total)> progress {};
+    uint32_t progress_interval = 64 * CHECK_INTERVAL;
+
+    // Error::cancelled or Error::deadline_exceeded once the caller no
+    // longer wants the result.
+    std::error_code interrupted() const;
+};
+
 std::expected<SecureBytes, std::error_code>
 stretch_key(std::span<const std::byte> pass,
     std::span<const std::byte, SHA256_SIZE> salt,
-    uint32_t iterations);
+    uint32_t iterations,
+    const StretchOptions& options = {});
 
 std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code>
 sha256(std::span<const std::byte> data);
 
+// Decrypt a random key wrapped in two Twofish-ECB blocks under P'.
+std::expected<SecureBytes, std::error_code>
+extract_random_key(const SecureBytes& pass,
+    std::span<const std::byte, TWOFISH_SIZE> block1,
+    std::span<const std::byte, TWOFISH_SIZE> block2);
+
+// Inverse of extract_random_key.
+std::expected<std::array<std::byte, 2 * TWOFISH_SIZE>, std::error_code>
+wrap_random_key(const SecureBytes& pass, const SecureBytes& random_key);
+
 // SHA256 Hashed Message Authentication Code Generator
 class SHA256HMA {
 public:
@@ -71,12 +158,43 @@ public:
     SHA256HMA& operator=(const SHA256HMA&) = delete;
 
     static std::expected<SHA256HMA, std::error_code> create(std::span<const std::byte> key);
+    // Copy the running state so both copies can be continued independently.
+    std::expected<SHA256HMA, std::error_code> clone() const;
     void write(std::span<const std::byte> data);
     std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code> finish();
+    // Start a new message under the same key.
+    void reset();
 
 private:
     gcry_md_hd_t hd_{};
     explicit SHA256HMA(gcry_md_hd_t hd) : hd_(hd) { }
 };
 
+// Twofish in CBC mode. The chaining value carries over between calls, so a
+// body can be processed in pieces.
+class TwofishCBC {
+public:
+    ~TwofishCBC();
+    TwofishCBC(TwofishCBC&&) noexcept;
+    TwofishCBC& operator=(TwofishCBC&&) noexcept;
+    TwofishCBC(const TwofishCBC&) = delete;
+    TwofishCBC& operator=(const TwofishCBC&) = delete;
+
+    static std::expected<TwofishCBC, std::error_code>
+    create(std::span<const std::byte> key, std::span<const std::byte, TWOFISH_SIZE> iv);
+
+    std::error_code encrypt(std::span<std::byte> data);
+    std::error_code decrypt(std::span<std::byte> data);
+    std::error_code decrypt(std::span<std::byte> out, std::span<const std::byte> in);
+
+    // Close the handle now rather than keep it for reuse on this thread,
+    // e.g. on an executor thread that no one will call
+    // drop_cached_handles() for. The cipher cannot be used afterwards.
+    void close() noexcept;
+
+private:
+    gcry_cipher_hd_t hd_{};
+    explicit TwofishCBC(gcry_cipher_hd_t hd) : hd_(hd) { }
+};
+
 } // namespace psafe3
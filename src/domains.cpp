@@ -0,0 +1,472 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "domains.h"
+#include "fields.h"
+#include "safe.h"
+#include "utf8.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // DNS limit on the length of a label.
+    constexpr size_t MAX_LABEL = 63;
+
+    bool is_alpha(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    char lower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    bool all_chars(std::string_view s, bool (*pred)(char))
+    {
+        return std::ranges::all_of(s, pred);
+    }
+
+    // Decode well-formed UTF-8, which the caller has checked.
+    std::vector<uint32_t> code_points(std::string_view s)
+    {
+        std::vector<uint32_t> result;
+        for (size_t i = 0; i < s.size();) {
+            auto c = static_cast<uint8_t>(s[i]);
+            size_t n = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+            uint32_t cp = n == 1 ? c : c & (0x7F >> n);
+            for (size_t j = 1; j < n; ++j)
+                cp = (cp << 6) | (static_cast<uint8_t>(s[i + j]) & 0x3F);
+            result.push_back(cp);
+            i += n;
+        }
+        return result;
+    }
+
+    // Punycode, RFC 3492 section 6.3. Returns false on overflow.
+    bool punycode(std::span<const uint32_t> input, std::string& out)
+    {
+        constexpr uint32_t BASE = 36, TMIN = 1, TMAX = 26, SKEW = 38, DAMP = 700;
+        auto digit = [](uint32_t d) { return static_cast<char>(d < 26 ? 'a' + d : '0' + d - 26); };
+        auto adapt = [](uint32_t delta, uint32_t points, bool first) {
+            delta = first ? delta / DAMP : delta / 2;
+            delta += delta / points;
+            uint32_t k = 0;
+            for (; delta > ((BASE - TMIN) * TMAX) / 2; k += BASE)
+                delta /= BASE - TMIN;
+            return k + (BASE - TMIN + 1) * delta / (delta + SKEW);
+        };
+
+        uint32_t basic = 0;
+        for (auto c : input) {
+            if (c < 0x80) {
+                out += static_cast<char>(c);
+                ++basic;
+            }
+        }
+        if (basic > 0)
+            out += '-';
+
+        uint32_t n = 0x80, delta = 0, bias = 72;
+        for (uint32_t handled = basic; handled < input.size(); ++delta, ++n) {
+            uint32_t m = UINT32_MAX;
+            for (auto c : input) {
+                if (c >= n)
+                    m = std::min(m, c);
+            }
+            if (m - n > (UINT32_MAX - delta) / (handled + 1))
+                return false;
+            delta += (m - n) * (handled + 1);
+            n = m;
+            for (auto c : input) {
+                if (c < n && ++delta == 0)
+                    return false;
+                if (c != n)
+                    continue;
+                auto q = delta;
+                for (uint32_t k = BASE;; k += BASE) {
+                    uint32_t t = k <= bias ? TMIN : k >= bias + TMAX ? TMAX : k - bias;
+                    if (q < t)
+                        break;
+                    out += digit(t + (q - t) % (BASE - t));
+                    q = (q - t) / (BASE - t);
+                }
+                out += digit(q);
+                bias = adapt(delta, handled + 1, handled == basic);
+                delta = 0;
+                ++handled;
+            }
+        }
+        return true;
+    }
+
+    // Append the normalized form of one label of a host to `out`.
+    bool append_label(std::string_view label, std::string& out)
+    {
+        if (label.empty())
+            return false;
+        auto ascii = [](char c) { return static_cast<uint8_t>(c) < 0x80; };
+        auto valid = [](char c) { return is_alpha(c) || is_digit(c) || c == '-' || c == '_'; };
+        if (std::ranges::all_of(label, ascii)) {
+            if (label.size() > MAX_LABEL || !std::ranges::all_of(label, valid))
+                return false;
+            std::ranges::transform(label, std::back_inserter(out), lower);
+            return true;
+        }
+
+        std::span bytes(reinterpret_cast<const std::byte*>(label.data()), label.size());
+        if (!valid_utf8(bytes))
+            return false;
+        auto points = code_points(label);
+        for (auto& c : points) {
+            if (c < 0x80 && !valid(static_cast<char>(c)))
+                return false;
+            if (c < 0x80)
+                c = static_cast<uint8_t>(lower(static_cast<char>(c)));
+            else if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+                c += 0x20;
+        }
+        auto start = out.size();
+        out += "xn--";
+        return punycode(points, out) && out.size() - start <= MAX_LABEL;
+    }
+
+    bool is_ip(std::string_view host)
+    {
+        if (host.starts_with('['))
+            return true;
+        // No top-level domain is all digits.
+        auto last = host.substr(host.rfind('.') + 1);
+        return !last.empty() && all_chars(last, is_digit);
+    }
+
+    // Number of labels in a normalized host; an IP address is one.
+    size_t label_count(std::string_view host)
+    {
+        return is_ip(host) ? 1 : static_cast<size_t>(std::ranges::count(host, '.')) + 1;
+    }
+
+    // Call `fn(label)` for each label of a normalized host, right to left.
+    template <typename Fn>
+    void for_each_label(std::string_view host, Fn fn)
+    {
+        if (is_ip(host)) {
+            fn(host);
+            return;
+        }
+        for (auto end = host.size();;) {
+            auto dot = host.rfind('.', end - 1);
+            auto start = dot == std::string_view::npos ? 0 : dot + 1;
+            if (!fn(host.substr(start, end - start)) || dot == std::string_view::npos)
+                return;
+            end = dot;
+        }
+    }
+
+    bool common_second_level(std::string_view label)
+    {
+        static constexpr std::string_view LABELS[] = {
+            "ac", "co", "com", "edu", "gob", "gov", "ltd", "mil", "ne", "net", "or", "org", "plc",
+        };
+        return std::ranges::binary_search(LABELS, label);
+    }
+
+    std::optional<std::string> normalize_query(std::string_view host)
+    {
+        auto result = normalize_host(host);
+        if (result && result->starts_with("*."))
+            result->erase(0, 2);
+        return result;
+    }
+
+    // Sort key of a normalized host: its labels right to left, separated
+    // by NULs, which sort before any label character. Sorted keys list the
+    // trie depth first, a host before its subdomains and siblings by label.
+    // A wildcard gets a last label of "*", which sorts before any other.
+    std::string reversed_key(std::string_view host)
+    {
+        bool wildcard = host.starts_with("*.");
+        if (wildcard)
+            host.remove_prefix(2);
+        std::string key;
+        key.reserve(host.size() + 2);
+        for_each_label(host, [&](std::string_view label) {
+            if (!key.empty())
+                key += '\0';
+            key += label;
+            return true;
+        });
+        if (wildcard)
+            key += std::string_view("\0*", 2);
+        return key;
+    }
+
+} // namespace
+
+std::optional<std::string> normalize_host(std::string_view url)
+{
+    auto space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+    while (!url.empty() && space(url.front()))
+        url.remove_prefix(1);
+    while (!url.empty() && space(url.back()))
+        url.remove_suffix(1);
+
+    // Autotype prefixes such as "[alt]" and "{alt}".
+    if (url.starts_with('[') || url.starts_with('{')) {
+        auto close = url.find(url[0] == '[' ? ']' : '}');
+        if (close != std::string_view::npos && close > 1 && all_chars(url.substr(1, close - 1), is_alpha))
+            url.remove_prefix(close + 1);
+    }
+
+    auto scheme = url.find("://");
+    auto scheme_char = [](char c) { return is_alpha(c) || is_digit(c) || c == '+' || c == '-' || c == '.'; };
+    if (scheme != std::string_view::npos && scheme > 0 && is_alpha(url[0])
+        && std::ranges::all_of(url.substr(0, scheme), scheme_char))
+        url.remove_prefix(scheme + 3);
+    else if (url.starts_with("//"))
+        url.remove_prefix(2);
+
+    auto authority = url.substr(0, url.find_first_of("/?#\\"));
+    if (auto at = authority.rfind('@'); at != std::string_view::npos)
+        authority.remove_prefix(at + 1);
+
+    std::string result;
+    if (authority.starts_with('[')) {
+        auto close = authority.find(']');
+        if (close == std::string_view::npos || close == 1)
+            return std::nullopt;
+        auto rest = authority.substr(close + 1);
+        if (!rest.empty() && (rest[0] != ':' || !all_chars(rest.substr(1), is_digit)))
+            return std::nullopt;
+        auto valid = [](char c) { return is_digit(c) || (lower(c) >= 'a' && lower(c) <= 'f') || c == ':' || c == '.'; };
+        auto address = authority.substr(1, close - 1);
+        if (!std::ranges::all_of(address, valid))
+            return std::nullopt;
+        result += '[';
+        std::ranges::transform(address, std::back_inserter(result), lower);
+        result += ']';
+        return result;
+    }
+
+    if (auto colon = authority.find(':'); colon != std::string_view::npos) {
+        if (!all_chars(authority.substr(colon + 1), is_digit))
+            return std::nullopt;
+        authority = authority.substr(0, colon);
+    }
+    if (authority.ends_with('.'))
+        authority.remove_suffix(1);
+    if (authority.empty())
+        return std::nullopt;
+
+    if (authority.starts_with("*.")) {
+        result += "*.";
+        authority.remove_prefix(2);
+    }
+    for (size_t start = 0;;) {
+        auto dot = authority.find('.', start);
+        if (start > 0)
+            result += '.';
+        if (!append_label(authority.substr(start, dot - start), result))
+            return std::nullopt;
+        if (dot == std::string_view::npos)
+            return result;
+        start = dot + 1;
+    }
+}
+
+std::string_view registrable_domain(std::string_view host) noexcept
+{
+    if (host.empty() || is_ip(host))
+        return host;
+    auto last = host.rfind('.');
+    if (last == std::string_view::npos || last == 0)
+        return host;
+    auto suffix = last + 1;
+    if (host.size() - suffix == 2) {
+        auto dot = host.rfind('.', last - 1);
+        auto start = dot == std::string_view::npos ? 0 : dot + 1;
+        if (common_second_level(host.substr(start, last - start))) {
+            if (dot == std::string_view::npos || dot == 0)
+                return host;
+            suffix = start;
+        }
+    }
+    auto dot = host.rfind('.', suffix - 2);
+    return dot == std::string_view::npos ? host : host.substr(dot + 1);
+}
+
+DomainIndex DomainIndex::build(std::span<const Record> records)
+{
+    DomainIndex index;
+
+    // Keys are wiped once their labels have been copied.
+    struct Host {
+        uint32_t record;
+        // Start of the next label of key.
+        uint32_t next;
+        std::string key;
+    };
+    std::vector<Host> hosts;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto* url = find_field(records[i], RecordFieldType::URL);
+        if (!url)
+            continue;
+        if (auto host = normalize_host(as_string_view(url->data))) {
+            hosts.push_back({ static_cast<uint32_t>(i), 0, reversed_key(*host) });
+            explicit_bzero(host->data(), host->size());
+        }
+    }
+    std::ranges::sort(hosts, {}, [](const Host& host) { return std::string_view(host.key); });
+
+    // Label of `host` at its current depth; empty once all are consumed.
+    auto label = [](const Host& host) {
+        if (host.next > host.key.size())
+            return std::string_view();
+        auto key = std::string_view(host.key).substr(host.next);
+        return key.substr(0, key.find('\0'));
+    };
+
+    // Split the sorted hosts level by level. Every node covers a range of
+    // them: first those that end there, then its wildcards, then one run
+    // per child. Children are numbered as their parent is split, so
+    // siblings are adjacent and already sorted.
+    std::vector<std::string_view> labels(1);
+    index.nodes_.push_back({ 0, ROOT, 0, 0, 0, 0, 0, static_cast<uint32_t>(hosts.size()) });
+    for (uint32_t id = 0; id < index.nodes_.size(); ++id) {
+        auto i = index.nodes_[id].begin;
+        auto end = index.nodes_[id].end;
+        while (i < end && label(hosts[i]).empty())
+            ++i;
+        index.nodes_[id].own_end = i;
+        while (i < end && label(hosts[i]) == "*")
+            ++i;
+        index.nodes_[id].wildcard_end = i;
+        index.nodes_[id].first_child = static_cast<uint32_t>(index.nodes_.size());
+        while (i < end) {
+            auto name = label(hosts[i]);
+            auto first = i;
+            for (; i < end && label(hosts[i]) == name; ++i)
+                hosts[i].next += static_cast<uint32_t>(name.size()) + 1;
+            index.nodes_.push_back({ static_cast<uint32_t>(labels.size()), id, 0, 0, first, 0, 0, i });
+            labels.push_back(name);
+        }
+        index.nodes_[id].child_count = static_cast<uint32_t>(index.nodes_.size()) - index.nodes_[id].first_child;
+    }
+
+    index.order_.reserve(hosts.size());
+    for (const auto& host : hosts)
+        index.order_.push_back(host.record);
+
+    // Copy the labels out of the keys.
+    size_t total = 0;
+    for (auto name : labels)
+        total += name.size();
+    if (total > 0)
+        index.label_data_ = total > 16 * 1024 ? SecureBytes::mapped(total) : SecureBytes(total);
+    auto* data = reinterpret_cast<char*>(index.label_data_.data());
+    index.labels_.reserve(labels.size());
+    for (auto name : labels) {
+        if (!name.empty())
+            std::memcpy(data, name.data(), name.size());
+        index.labels_.emplace_back(data, name.size());
+        data += name.size();
+    }
+    for (auto& host : hosts)
+        explicit_bzero(host.key.data(), host.key.size());
+    return index;
+}
+
+std::optional<uint32_t> DomainIndex::child(uint32_t id, std::string_view label) const
+{
+    const auto& n = nodes_[id];
+    auto first = nodes_.begin() + n.first_child;
+    auto last = first + n.child_count;
+    auto it = std::ranges::lower_bound(first, last, label, {}, [&](const Node& c) { return labels_[c.label]; });
+    if (it == last || labels_[it->label] != label)
+        return std::nullopt;
+    return static_cast<uint32_t>(it - nodes_.begin());
+}
+
+std::vector<uint32_t> DomainIndex::walk(std::string_view host) const
+{
+    std::vector<uint32_t> path { ROOT };
+    for_each_label(host, [&](std::string_view label) {
+        auto next = child(path.back(), label);
+        if (next)
+            path.push_back(*next);
+        return next.has_value();
+    });
+    return path;
+}
+
+std::optional<uint32_t> DomainIndex::find(std::string_view host) const
+{
+    auto normalized = normalize_query(host);
+    if (!normalized)
+        return std::nullopt;
+    auto path = walk(*normalized);
+    if (path.size() != label_count(*normalized) + 1)
+        return std::nullopt;
+    return path.back();
+}
+
+std::span<const uint32_t> DomainIndex::exact(std::string_view host) const
+{
+    auto id = find(host);
+    return id ? range(nodes_[*id].begin, nodes_[*id].own_end) : std::span<const uint32_t>();
+}
+
+std::span<const uint32_t> DomainIndex::suffix(std::string_view host) const
+{
+    auto id = find(host);
+    return id ? range(nodes_[*id].begin, nodes_[*id].end) : std::span<const uint32_t>();
+}
+
+std::span<const uint32_t> DomainIndex::registrable(std::string_view host) const
+{
+    auto normalized = normalize_query(host);
+    if (!normalized)
+        return {};
+    return suffix(registrable_domain(*normalized));
+}
+
+std::vector<uint32_t> DomainIndex::matches(std::string_view host) const
+{
+    std::vector<uint32_t> result;
+    auto normalized = normalize_query(host);
+    if (!normalized)
+        return result;
+    auto path = walk(*normalized);
+    auto labels = label_count(*normalized);
+    auto floor = label_count(registrable_domain(*normalized));
+
+    auto depth = path.size() - 1;
+    if (depth == labels) {
+        auto own = range(nodes_[path[depth]].begin, nodes_[path[depth]].own_end);
+        result.insert(result.end(), own.begin(), own.end());
+    }
+    for (depth = std::min(depth, labels - 1); depth >= floor && depth > 0; --depth) {
+        const auto& node = nodes_[path[depth]];
+        auto parent = range(node.begin, node.wildcard_end);
+        result.insert(result.end(), parent.begin(), parent.end());
+    }
+    return result;
+}
+
+} // namespace psafe3
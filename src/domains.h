@@ -0,0 +1,111 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "crypto.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// The host of `url`, normalized: scheme, user info, port, path, query and
+// fragment are dropped, ASCII letters are lowercased along with Latin-1
+// capitals, a trailing dot is removed and labels that are not ASCII are
+// Punycode encoded ("bücher.de" becomes "xn--bcher-kva.de"). A bare host
+// is accepted, as is a leading autotype tag such as "[alt]". A leading
+// "*." is kept. Returns std::nullopt if there is no well-formed host.
+std::optional<std::string> normalize_host(std::string_view url);
+
+// The registrable domain of a normalized host: its public suffix and one
+// more label. The public suffix is the last label, or the last two for a
+// two-letter country code under a common second level such as "co" or
+// "com" ("example.co.uk"); there is no public suffix list. Hosts that are
+// IP addresses or no longer than their public suffix are returned whole.
+std::string_view registrable_domain(std::string_view host) noexcept;
+
+// Index of the URL hosts of a safe, for autofill.
+//
+// The URL of each record is normalized once, see normalize_host(), and
+// stored in a trie keyed by label from the right: "www.example.com" is
+// com, example, www. A host of the form "*.example.com" is a wildcard for
+// the subdomains of example.com. IP addresses are kept as single labels
+// and only ever match exactly. Labels are copied into secure memory.
+//
+// As in GroupTree, record indices are laid out depth first so that every
+// node owns a contiguous range: first the records for exactly that host,
+// then its wildcard records, then those of each subdomain in turn.
+// Children are sorted by label and found by binary search, so a lookup
+// costs a few comparisons per label of the host it is given, whatever the
+// size of the safe.
+//
+// Lookups take a host or a URL and normalize it the same way.
+class DomainIndex {
+public:
+    static constexpr uint32_t ROOT = 0;
+
+    struct Node {
+        uint32_t label;
+        uint32_t parent;
+        uint32_t first_child;
+        uint32_t child_count;
+        // Ranges of records(), see above.
+        uint32_t begin;
+        uint32_t own_end;
+        uint32_t wildcard_end;
+        uint32_t end;
+    };
+
+    static DomainIndex build(std::span<const Record> records);
+
+    std::span<const Node> nodes() const noexcept { return nodes_; }
+    const Node& node(uint32_t id) const noexcept { return nodes_[id]; }
+
+    // Label of `id`; empty for the root.
+    std::string_view label(uint32_t id) const noexcept { return labels_[nodes_[id].label]; }
+
+    // Child of `id` labelled `label`, by binary search.
+    std::optional<uint32_t> child(uint32_t id, std::string_view label) const;
+
+    // Node for `host`, walking down from the root.
+    std::optional<uint32_t> find(std::string_view host) const;
+
+    // Records whose URL host is `host`.
+    std::span<const uint32_t> exact(std::string_view host) const;
+
+    // Records whose URL host is `host` or below it, wildcards included.
+    std::span<const uint32_t> suffix(std::string_view host) const;
+
+    // Records whose URL host is under the registrable domain of `host`.
+    std::span<const uint32_t> registrable(std::string_view host) const;
+
+    // Records to offer on a page at `host`, most specific first: those for
+    // the host itself, then for each parent domain up to the registrable
+    // domain, nearest first, with each parent's wildcards after its own
+    // records. A record appears once.
+    std::vector<uint32_t> matches(std::string_view host) const;
+
+    // Indices of the records with a host, in layout order.
+    std::span<const uint32_t> records() const noexcept { return order_; }
+
+private:
+    SecureBytes label_data_ { 1 };
+    std::vector<std::string_view> labels_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> order_;
+
+    std::span<const uint32_t> range(uint32_t begin, uint32_t end) const noexcept
+    {
+        return std::span(order_).subspan(begin, end - begin);
+    }
+
+    // Walk down from the root along the labels of a normalized host, right
+    // to left. Returns the nodes visited, the root first.
+    std::vector<uint32_t> walk(std::string_view host) const;
+};
+
+} // namespace psafe3
@@ -0,0 +1,340 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "crypto.h"
+#include "edit.h"
+#include "error.h"
+#include "fields.h"
+#include "utf8.h"
+#include "writer.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Make `node` ours alone, copying it if another version shares it.
+    // Versions are only copied by the editing thread, so a use count of one
+    // cannot go up behind our back; the fence orders our writes after the
+    // last reads of whoever dropped the other references.
+    template <typename Node>
+    Node& own(std::shared_ptr<void>& node)
+    {
+        if (!node)
+            node = std::make_shared<Node>();
+        else if (node.use_count() > 1)
+            node = std::make_shared<Node>(*static_cast<const Node*>(node.get()));
+        else
+            std::atomic_thread_fence(std::memory_order_acquire);
+        return *static_cast<Node*>(node.get());
+    }
+
+    struct EditedRecord {
+        std::shared_ptr<const SecureBytes> storage;
+        Record record;
+    };
+
+} // namespace
+
+// RecordList
+
+struct RecordList::Leaf {
+    std::array<std::shared_ptr<const Record>, WIDTH> records;
+};
+
+struct RecordList::Branch {
+    std::array<std::shared_ptr<void>, WIDTH> children;
+};
+
+const Record* RecordList::get(size_t index) const noexcept
+{
+    if (index >= size_)
+        return nullptr;
+    const void* node = root_.get();
+    for (unsigned shift = shift_; shift > 0; shift -= BITS)
+        node = static_cast<const Branch*>(node)->children[(index >> shift) % WIDTH].get();
+    return static_cast<const Leaf*>(node)->records[index % WIDTH].get();
+}
+
+std::shared_ptr<const Record>& RecordList::slot(size_t index)
+{
+    auto* node = &root_;
+    for (unsigned shift = shift_; shift > 0; shift -= BITS)
+        node = &own<Branch>(*node).children[(index >> shift) % WIDTH];
+    return own<Leaf>(*node).records[index % WIDTH];
+}
+
+void RecordList::set(size_t index, std::shared_ptr<const Record> record)
+{
+    assert(index < size_);
+    slot(index) = std::move(record);
+}
+
+void RecordList::push_back(std::shared_ptr<const Record> record)
+{
+    if (root_ && size_ == WIDTH << shift_) {
+        auto root = std::make_shared<Branch>();
+        root->children[0] = std::move(root_);
+        root_ = std::move(root);
+        shift_ += BITS;
+    }
+    slot(size_++) = std::move(record);
+}
+
+// SafeSnapshot
+
+struct SafeSnapshot::Header {
+    std::vector<HeaderField> fields;
+    // Arena chunks holding edited fields.
+    std::vector<std::shared_ptr<const SecureBytes>> storage;
+};
+
+std::span<const HeaderField> SafeSnapshot::header() const noexcept
+{
+    return header_->fields;
+}
+
+void SafeSnapshot::for_each(const std::function<void(size_t slot, const Record& record)>& fn) const
+{
+    for (size_t slot = 0; slot < records_.size(); ++slot) {
+        if (const auto* record = records_.get(slot))
+            fn(slot, *record);
+    }
+}
+
+std::expected<void, std::error_code>
+SafeSnapshot::save(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, uint32_t iterations) const
+{
+    auto writer = SafeWriter::create(path, pass_phrase, iterations, header(), true);
+    if (!writer)
+        return std::unexpected(writer.error());
+    for (size_t slot = 0; slot < records_.size(); ++slot) {
+        const auto* record = records_.get(slot);
+        if (!record)
+            continue;
+        if (auto err = writer->write_record(*record); err)
+            return std::unexpected(err);
+    }
+    return writer->commit();
+}
+
+// MutableSafe
+
+// Bump allocation from large mapped chunks. A chunk is unmapped, and
+// wiped, once no version refers to anything in it.
+class MutableSafe::Arena {
+public:
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+
+    std::pair<std::shared_ptr<const SecureBytes>, std::byte*> allocate(size_t size)
+    {
+        if (size > CHUNK_SIZE / 4) {
+            auto dedicated = std::make_shared<SecureBytes>(SecureBytes::mapped(size));
+            return { dedicated, dedicated->data() };
+        }
+        if (!chunk_ || chunk_->size() - used_ < size) {
+            chunk_ = std::make_shared<SecureBytes>(SecureBytes::mapped(CHUNK_SIZE));
+            used_ = 0;
+        }
+        auto* data = chunk_->data(used_);
+        used_ += size;
+        return { chunk_, data };
+    }
+
+private:
+    std::shared_ptr<SecureBytes> chunk_;
+    size_t used_ = 0;
+};
+
+MutableSafe::MutableSafe(SafeSnapshot&& current, std::unique_ptr<Arena>&& arena)
+    : current_(std::move(current))
+    , arena_(std::move(arena))
+{
+}
+
+MutableSafe::MutableSafe(MutableSafe&&) noexcept = default;
+MutableSafe& MutableSafe::operator=(MutableSafe&&) noexcept = default;
+MutableSafe::~MutableSafe() = default;
+
+std::expected<MutableSafe, std::error_code> MutableSafe::create(Safe&& safe)
+{
+    if (safe.record_count() != safe.database().size() || safe.projected())
+        return std::unexpected(Error::unsupported_options);
+
+    SafeSnapshot current;
+    current.base_ = std::make_shared<const Safe>(std::move(safe));
+    auto header = std::make_shared<SafeSnapshot::Header>();
+    header->fields.assign(current.base_->header().begin(), current.base_->header().end());
+    current.header_ = std::move(header);
+    for (const auto& record : current.base_->database())
+        current.records_.push_back(std::shared_ptr<const Record>(current.base_, &record));
+    current.live_ = current.records_.size();
+    return MutableSafe(std::move(current), std::make_unique<Arena>());
+}
+
+// Copy `fields` into the arena as the record in `slot`.
+void MutableSafe::store(size_t slot, std::span<const FieldValue> fields)
+{
+    size_t total = 0;
+    for (const auto& field : fields)
+        total += field.data.size();
+    auto [storage, data] = arena_->allocate(std::max<size_t>(total, 1));
+
+    auto edited = std::make_shared<EditedRecord>();
+    edited->storage = std::move(storage);
+    edited->record.fields.reserve(fields.size());
+    for (const auto& field : fields) {
+        if (!field.data.empty())
+            std::memcpy(data, field.data.data(), field.data.size());
+        auto& copy = edited->record.fields.emplace_back(RecordField {
+            .type = field.type,
+            .len = static_cast<uint32_t>(field.data.size()),
+            .data = { data, field.data.size() },
+            .extent = {},
+        });
+        if (is_text(field.type))
+            check_utf8(copy);
+        data += field.data.size();
+    }
+    current_.records_.set(slot, std::shared_ptr<const Record>(edited, &edited->record));
+}
+
+void MutableSafe::index(size_t slot, std::optional<Uuid> before, std::optional<Uuid> after)
+{
+    if (!by_uuid_ || before == after)
+        return;
+    if (before) {
+        if (auto it = by_uuid_->find(*before); it != by_uuid_->end() && it->second == slot)
+            by_uuid_->erase(it);
+    }
+    if (after)
+        (*by_uuid_)[*after] = slot;
+}
+
+std::optional<size_t> MutableSafe::find(const Uuid& uuid)
+{
+    if (!by_uuid_) {
+        by_uuid_.emplace();
+        by_uuid_->reserve(current_.size());
+        current_.for_each([this](size_t slot, const Record& record) {
+            if (auto uuid = record_uuid(record))
+                by_uuid_->try_emplace(*uuid, slot);
+        });
+    }
+    auto it = by_uuid_->find(uuid);
+    if (it == by_uuid_->end())
+        return std::nullopt;
+    return it->second;
+}
+
+size_t MutableSafe::add(std::span<const FieldValue> fields)
+{
+    auto slot = current_.records_.size();
+    current_.records_.push_back(nullptr);
+    store(slot, fields);
+    ++current_.live_;
+    index(slot, std::nullopt, record_uuid(*current_.get(slot)));
+    return slot;
+}
+
+void MutableSafe::replace(size_t slot, std::span<const FieldValue> fields)
+{
+    const auto* record = current_.get(slot);
+    assert(record);
+    auto before = record_uuid(*record);
+    store(slot, fields);
+    index(slot, before, record_uuid(*current_.get(slot)));
+}
+
+void MutableSafe::set_field(size_t slot, RecordFieldType type, std::span<const std::byte> data)
+{
+    const auto* record = current_.get(slot);
+    assert(record);
+    std::vector<FieldValue> fields;
+    fields.reserve(record->fields.size() + 1);
+    bool replaced = false;
+    for (const auto& field : record->fields) {
+        if (field.type == type && !replaced) {
+            fields.push_back({ type, data });
+            replaced = true;
+        } else {
+            fields.push_back({ field.type, field.data });
+        }
+    }
+    if (!replaced)
+        fields.push_back({ type, data });
+    replace(slot, fields);
+}
+
+bool MutableSafe::remove_field(size_t slot, RecordFieldType type)
+{
+    const auto* record = current_.get(slot);
+    assert(record);
+    std::vector<FieldValue> fields;
+    fields.reserve(record->fields.size());
+    for (const auto& field : record->fields) {
+        if (field.type != type)
+            fields.push_back({ field.type, field.data });
+    }
+    if (fields.size() == record->fields.size())
+        return false;
+    replace(slot, fields);
+    return true;
+}
+
+void MutableSafe::erase(size_t slot)
+{
+    const auto* record = current_.get(slot);
+    if (!record)
+        return;
+    index(slot, record_uuid(*record), std::nullopt);
+    current_.records_.set(slot, nullptr);
+    --current_.live_;
+}
+
+void MutableSafe::set_header_field(HeaderFieldType type, std::span<const std::byte> data)
+{
+    auto header = std::make_shared<SafeSnapshot::Header>(*current_.header_);
+    auto [storage, copy] = arena_->allocate(std::max<size_t>(data.size(), 1));
+    if (!data.empty())
+        std::memcpy(copy, data.data(), data.size());
+    header->storage.push_back(std::move(storage));
+
+    HeaderField field {
+        .type = type,
+        .len = static_cast<uint32_t>(data.size()),
+        .data = { copy, data.size() },
+        .extent = {},
+    };
+    if (is_text(type))
+        check_utf8(field);
+    auto it = std::ranges::find(header->fields, type, &HeaderField::type);
+    if (it != header->fields.end())
+        *it = field;
+    else
+        header->fields.push_back(field);
+    current_.header_ = std::move(header);
+}
+
+bool MutableSafe::remove_header_field(HeaderFieldType type)
+{
+    if (std::ranges::find(current_.header(), type, &HeaderField::type) == current_.header().end())
+        return false;
+    auto header = std::make_shared<SafeSnapshot::Header>(*current_.header_);
+    std::erase_if(header->fields, [type](const HeaderField& field) { return field.type == type; });
+    current_.header_ = std::move(header);
+    return true;
+}
+
+} // namespace psafe3
@@ -0,0 +1,148 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto.h"
+#include "fields.h"
+#include "safe.h"
+
+// Editing a loaded safe.
+//
+// MutableSafe takes over a Safe and keeps its records in a persistent
+// vector: a 32-way trie whose nodes are shared between versions and copied
+// only along the path to an edited slot, and only while another version
+// still shares them. An edit costs a handful of node copies at most,
+// whatever the size of the safe, and snapshot() is a pointer copy.
+//
+// Records never edited stay where Safe::load() decrypted them. An edited
+// record is copied whole, fields and data, into a secure arena: large
+// mapped chunks that are wiped when the last record in them goes away.
+// Edited records, like merged ones, carry only fields; their data and
+// extent spans are empty. Text fields written by an edit are checked for
+// UTF-8 (see Field::utf8).
+
+namespace psafe3 {
+
+struct FieldValue {
+    RecordFieldType type;
+    std::span<const std::byte> data;
+};
+
+// Persistent vector of records; slots may be empty.
+class RecordList {
+public:
+    size_t size() const noexcept { return size_; }
+
+    // nullptr past the end or for an empty slot.
+    const Record* get(size_t index) const noexcept;
+
+    // Copy on write: nodes shared with a copy of this list are copied
+    // first, nodes that are not are changed in place.
+    void set(size_t index, std::shared_ptr<const Record> record);
+    void push_back(std::shared_ptr<const Record> record);
+
+private:
+    static constexpr unsigned BITS = 5;
+    static constexpr size_t WIDTH = size_t { 1 } << BITS;
+
+    struct Leaf;
+    struct Branch;
+
+    std::shared_ptr<void> root_;
+    size_t size_ = 0;
+    // Of the index bits selecting a child of the root.
+    unsigned shift_ = 0;
+
+    std::shared_ptr<const Record>& slot(size_t index);
+};
+
+// One version of an edited safe. Cheap to copy and safe to read on another
+// thread, e.g. to save it, while the MutableSafe it came from is edited.
+class SafeSnapshot {
+public:
+    std::span<const HeaderField> header() const noexcept;
+
+    // Records are numbered by slot. Slots are never reused, so a number
+    // keeps naming the same record across versions; erased records leave
+    // an empty slot.
+    size_t slot_count() const noexcept { return records_.size(); }
+    const Record* get(size_t slot) const noexcept { return records_.get(slot); }
+
+    // Records not erased.
+    size_t size() const noexcept { return live_; }
+
+    // Call `fn` for every record not erased, in slot order.
+    void for_each(const std::function<void(size_t slot, const Record& record)>& fn) const;
+
+    // Write this version to a new safe at `path` with fresh keys, see
+    // SafeWriter, replacing any file already there. The header keeps its
+    // UUID.
+    std::expected<void, std::error_code>
+    save(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, uint32_t iterations) const;
+
+private:
+    friend class MutableSafe;
+
+    struct Header;
+
+    std::shared_ptr<const Safe> base_;
+    std::shared_ptr<const Header> header_;
+    RecordList records_;
+    size_t live_ = 0;
+};
+
+class MutableSafe {
+public:
+    // Fails with Error::unsupported_options for a safe loaded on demand or
+    // projected by LoadOptions masks, whose saved versions would silently
+    // lose the fields left out.
+    static std::expected<MutableSafe, std::error_code> create(Safe&& safe);
+
+    MutableSafe(MutableSafe&&) noexcept;
+    MutableSafe& operator=(MutableSafe&&) noexcept;
+    ~MutableSafe();
+
+    const SafeSnapshot& current() const noexcept { return current_; }
+    SafeSnapshot snapshot() const { return current_; }
+
+    // Slot of the record with `uuid`. The index is built on first use.
+    std::optional<size_t> find(const Uuid& uuid);
+
+    // Returns the slot of the new record.
+    size_t add(std::span<const FieldValue> fields);
+    // Replace every field of the record in `slot`.
+    void replace(size_t slot, std::span<const FieldValue> fields);
+    // Replace the first field of `type`, or append one.
+    void set_field(size_t slot, RecordFieldType type, std::span<const std::byte> data);
+    // Remove every field of `type`. Returns false if there was none.
+    bool remove_field(size_t slot, RecordFieldType type);
+    void erase(size_t slot);
+
+    void set_header_field(HeaderFieldType type, std::span<const std::byte> data);
+    bool remove_header_field(HeaderFieldType type);
+
+private:
+    class Arena;
+
+    SafeSnapshot current_;
+    std::unique_ptr<Arena> arena_;
+    std::optional<std::unordered_map<Uuid, size_t, UuidHash>> by_uuid_;
+
+    MutableSafe(SafeSnapshot&& current, std::unique_ptr<Arena>&& arena);
+
+    void store(size_t slot, std::span<const FieldValue> fields);
+    void index(size_t slot, std::optional<Uuid> before, std::optional<Uuid> after);
+};
+
+} // namespace psafe3
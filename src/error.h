@@ -32,6 +32,18 @@ enum class Error : int {
     invalid_pass_phrase,
     corrupt_file,
     hmac_mismatch,
+    malformed_field,
+    invalid_iterations,
+    no_checkpoint,
+    stale_checkpoint,
+    unsupported_options,
+    cancelled,
+    deadline_exceeded,
+    too_many_iterations,
+    invalid_snapshot,
+    invalid_policy,
+    unsupported_policy,
+    malformed_input,
 };
 
 struct ErrorCategory : std::error_category {
@@ -50,6 +62,30 @@ struct ErrorCategory : std::error_category {
             return "corrupt file";
         case Error::hmac_mismatch:
             return "hmac mismatch";
+        case Error::malformed_field:
+            return "malformed field";
+        case Error::invalid_iterations:
+            return "invalid iteration count";
+        case Error::no_checkpoint:
+            return "no checkpoint";
+        case Error::stale_checkpoint:
+            return "file changed since load";
+        case Error::unsupported_options:
+            return "unsupported combination of options";
+        case Error::cancelled:
+            return "cancelled";
+        case Error::deadline_exceeded:
+            return "deadline exceeded";
+        case Error::too_many_iterations:
+            return "iteration count exceeds limit";
+        case Error::invalid_snapshot:
+            return "invalid snapshot";
+        case Error::invalid_policy:
+            return "invalid password policy";
+        case Error::unsupported_policy:
+            return "unsupported password policy";
+        case Error::malformed_input:
+            return "malformed input";
         default:
             return "unknown error";
         }
@@ -0,0 +1,98 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+
+#include "executor.h"
+
+namespace psafe3 {
+
+// Executor
+
+void Executor::bulk(size_t count, const std::function<void(size_t)>& task)
+{
+    size_t helpers = std::min<size_t>(concurrency(), count);
+    if (helpers <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            task(i);
+        return;
+    }
+
+    // Shared with the helpers, which may outlive this call. A helper only
+    // touches `task` after claiming an index, which keeps this call waiting.
+    struct State {
+        const std::function<void(size_t)>* task;
+        size_t count;
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> done = 0;
+
+        void drain()
+        {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                (*task)(i);
+                if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+                    done.notify_all();
+            }
+        }
+    };
+    auto state = std::make_shared<State>();
+    state->task = &task;
+    state->count = count;
+    for (size_t i = 1; i < helpers; ++i)
+        submit([state] { state->drain(); });
+    state->drain();
+    for (size_t done; (done = state->done.load(std::memory_order_acquire)) < count;)
+        state->done.wait(done, std::memory_order_acquire);
+}
+
+// ThreadExecutor
+
+ThreadExecutor::ThreadExecutor(unsigned concurrency)
+    : concurrency_(concurrency != 0 ? concurrency : std::max(std::thread::hardware_concurrency(), 1u))
+{
+    workers_.reserve(concurrency_);
+    for (unsigned i = 0; i < concurrency_; ++i)
+        workers_.emplace_back([this](std::stop_token stop) { work(stop); });
+}
+
+ThreadExecutor::~ThreadExecutor()
+{
+    for (auto& worker : workers_)
+        worker.request_stop();
+    workers_.clear();
+}
+
+void ThreadExecutor::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+}
+
+// Run queued tasks until stopped with the queue empty.
+void ThreadExecutor::work(std::stop_token stop)
+{
+    std::unique_lock lock(mutex_);
+    while (ready_.wait(lock, stop, [this] { return !queue_.empty(); })) {
+        auto task = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+Executor& default_executor()
+{
+    static ThreadExecutor executor;
+    return executor;
+}
+
+} // namespace psafe3
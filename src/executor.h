@@ -0,0 +1,69 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace psafe3 {
+
+// Where the library runs work in parallel: decrypting large bodies,
+// sorting record views and batch calls such as peek_headers(). Implement
+// it over an existing thread pool to keep the library from starting
+// threads of its own; every such API takes an Executor and falls back to
+// default_executor() without one.
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // Run `task` once, on any thread, at some later time.
+    virtual void submit(std::function<void()> task) = 0;
+
+    // How many tasks are worth running at once. Work is split into about
+    // this many parts; 1 keeps it all on the calling thread.
+    virtual unsigned concurrency() const noexcept = 0;
+
+    // Call task(i) for every i in [0, count) and return once all calls
+    // have returned. The calling thread takes part, so this finishes even
+    // if no submitted task ever gets to run, and it may be called from a
+    // task. Submitted tasks that start after the work is done return at
+    // once. `task` must not throw.
+    virtual void bulk(size_t count, const std::function<void(size_t)>& task);
+};
+
+// The default: `concurrency` std::jthreads, started up front, that run
+// submitted tasks from a shared queue in the order they were submitted.
+// The threads live as long as the executor, so per-thread state such as
+// cached libgcrypt handles is reused from one task to the next. The
+// destructor runs the tasks still queued and joins the threads.
+class ThreadExecutor final : public Executor {
+public:
+    // Zero for std::thread::hardware_concurrency().
+    explicit ThreadExecutor(unsigned concurrency = 0);
+    ~ThreadExecutor() override;
+    ThreadExecutor(const ThreadExecutor&) = delete;
+    ThreadExecutor& operator=(const ThreadExecutor&) = delete;
+
+    void submit(std::function<void()> task) override;
+    unsigned concurrency() const noexcept override { return concurrency_; }
+
+private:
+    unsigned concurrency_;
+    std::mutex mutex_;
+    std::condition_variable_any ready_;
+    std::deque<std::function<void()>> queue_;
+    // Last, so that the threads are joined before the queue goes away.
+    std::vector<std::jthread> workers_;
+
+    void work(std::stop_token stop);
+};
+
+// A process-wide ThreadExecutor.
+Executor& default_executor();
+
+} // namespace psafe3
@@ -0,0 +1,256 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "expiry.h"
+#include "fields.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+
+    constexpr std::time_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+    // Times are stored as 32-bit little-endian seconds, some writers use 64.
+    std::optional<std::time_t> time_field(const Record& record, RecordFieldType type)
+    {
+        const auto* field = find_field(record, type);
+        if (!field)
+            return std::nullopt;
+        std::span<const std::byte> data = field->data;
+        if (data.size() == 4)
+            return static_cast<std::time_t>(load<std::endian::little>(data.first<4>()));
+        if (data.size() == 8)
+            return static_cast<std::time_t>(load<std::endian::little>(data.first<8>()));
+        return std::nullopt;
+    }
+
+    uint64_t ticks(std::time_t t)
+    {
+        return t < 0 ? 0 : static_cast<uint64_t>(t);
+    }
+
+} // namespace
+
+std::optional<std::time_t> password_expiry(const Record& record)
+{
+    std::optional<std::time_t> expiry;
+    if (auto at = time_field(record, RecordFieldType::PASSWORD_EXPIRY_TIME); at && *at != 0)
+        expiry = *at;
+
+    const auto* interval = find_field(record, RecordFieldType::PASSWORD_EXPIRY_INTERVAL);
+    auto modified = time_field(record, RecordFieldType::PASSWORD_MODIFICATION_TIME);
+    if (interval && modified) {
+        std::span<const std::byte> data = interval->data;
+        uint32_t days = data.size() >= 4 ? load<std::endian::little>(data.first<4>())
+            : data.size() >= 2            ? load<std::endian::little>(data.first<2>())
+                                          : 0;
+        if (days != 0) {
+            auto due = *modified + static_cast<std::time_t>(days) * SECONDS_PER_DAY;
+            expiry = expiry ? std::min(*expiry, due) : due;
+        }
+    }
+    return expiry;
+}
+
+// ExpiryScheduler
+
+ExpiryScheduler::ExpiryScheduler(std::time_t now)
+    : now_(ticks(now))
+{
+    heads_.fill(NONE);
+}
+
+void ExpiryScheduler::link(uint32_t entry, uint32_t list)
+{
+    auto& e = entries_[entry];
+    e.list = list;
+    e.prev = NONE;
+    if (list == FIRED) {
+        e.next = NONE;
+        return;
+    }
+    e.next = heads_[list];
+    if (e.next != NONE)
+        entries_[e.next].prev = entry;
+    heads_[list] = entry;
+    if (list < OVERDUE)
+        occupied_[list / SLOTS] |= uint64_t { 1 } << (list % SLOTS);
+}
+
+void ExpiryScheduler::unlink(uint32_t entry)
+{
+    auto& e = entries_[entry];
+    if (e.list == FIRED)
+        return;
+    if (e.prev != NONE)
+        entries_[e.prev].next = e.next;
+    else
+        heads_[e.list] = e.next;
+    if (e.next != NONE)
+        entries_[e.next].prev = e.prev;
+    if (e.list < OVERDUE && heads_[e.list] == NONE)
+        occupied_[e.list / SLOTS] &= ~(uint64_t { 1 } << (e.list % SLOTS));
+}
+
+// Put `entry` on the level where its deadline first differs from now_.
+void ExpiryScheduler::schedule(uint32_t entry)
+{
+    auto deadline = entries_[entry].deadline;
+    if (deadline <= now_) {
+        link(entry, OVERDUE);
+        return;
+    }
+    auto level = static_cast<unsigned>(std::bit_width(deadline ^ now_) - 1) / LEVEL_BITS;
+    auto slot = static_cast<unsigned>(deadline >> (level * LEVEL_BITS)) % SLOTS;
+    link(entry, level * SLOTS + slot);
+}
+
+void ExpiryScheduler::release(uint32_t entry)
+{
+    if (entries_[entry].list != FIRED)
+        --pending_;
+    unlink(entry);
+    free_.push_back(entry);
+}
+
+size_t ExpiryScheduler::update(uint32_t safe, std::span<const Record> records)
+{
+    std::unordered_map<Uuid, uint64_t, UuidHash> wanted;
+    for (const auto& record : records) {
+        auto uuid = record_uuid(record);
+        auto expiry = password_expiry(record);
+        if (uuid && expiry)
+            wanted.try_emplace(*uuid, ticks(*expiry));
+    }
+
+    size_t changed = 0;
+    auto& index = by_safe_[safe];
+    for (auto it = index.begin(); it != index.end();) {
+        if (wanted.contains(it->first)) {
+            ++it;
+            continue;
+        }
+        release(it->second);
+        it = index.erase(it);
+        ++changed;
+    }
+    for (auto [uuid, deadline] : wanted) {
+        auto [it, added] = index.try_emplace(uuid, NONE);
+        if (!added) {
+            auto& e = entries_[it->second];
+            if (e.deadline == deadline)
+                continue;
+            if (e.list == FIRED)
+                ++pending_;
+            unlink(it->second);
+            e.deadline = deadline;
+            schedule(it->second);
+            ++changed;
+            continue;
+        }
+        uint32_t entry;
+        if (!free_.empty()) {
+            entry = free_.back();
+            free_.pop_back();
+        } else {
+            entry = static_cast<uint32_t>(entries_.size());
+            entries_.emplace_back();
+        }
+        entries_[entry] = { .safe = safe, .uuid = uuid, .deadline = deadline, .list = NONE, .prev = NONE, .next = NONE };
+        it->second = entry;
+        schedule(entry);
+        ++pending_;
+        ++changed;
+    }
+    if (index.empty())
+        by_safe_.erase(safe);
+    return changed;
+}
+
+void ExpiryScheduler::remove(uint32_t safe)
+{
+    auto it = by_safe_.find(safe);
+    if (it == by_safe_.end())
+        return;
+    for (auto [uuid, entry] : it->second)
+        release(entry);
+    by_safe_.erase(it);
+}
+
+// The earliest time some occupied slot starts.
+std::optional<uint64_t> ExpiryScheduler::next_event() const noexcept
+{
+    std::optional<uint64_t> next;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        auto shift = level * LEVEL_BITS;
+        auto digit = static_cast<unsigned>(now_ >> shift) % SLOTS;
+        // Slots at or before the current one are empty, see schedule().
+        auto later = digit + 1 < SLOTS ? occupied_[level] & (~uint64_t { 0 } << (digit + 1)) : 0;
+        if (later == 0)
+            continue;
+        auto upper_shift = shift + LEVEL_BITS;
+        uint64_t upper = upper_shift < 64 ? now_ >> upper_shift << upper_shift : 0;
+        auto start = upper | (static_cast<uint64_t>(std::countr_zero(later)) << shift);
+        if (!next || start < *next)
+            next = start;
+    }
+    return next;
+}
+
+void ExpiryScheduler::take_overdue(std::vector<Expiry>& out)
+{
+    auto first = out.size();
+    while (heads_[OVERDUE] != NONE) {
+        auto entry = heads_[OVERDUE];
+        unlink(entry);
+        link(entry, FIRED);
+        --pending_;
+        const auto& e = entries_[entry];
+        out.push_back({ e.safe, e.uuid, static_cast<std::time_t>(e.deadline) });
+    }
+    std::sort(out.begin() + static_cast<ptrdiff_t>(first), out.end(),
+        [](const Expiry& a, const Expiry& b) { return a.deadline < b.deadline; });
+}
+
+void ExpiryScheduler::advance(std::time_t now, const std::function<void(const Expiry&)>& fired)
+{
+    std::vector<Expiry> expired;
+    take_overdue(expired);
+
+    auto target = ticks(now);
+    while (auto event = next_event()) {
+        if (*event > target)
+            break;
+        now_ = *event;
+        // Highest level first, so that entries moving down to a slot
+        // starting now are handled in the same pass.
+        for (unsigned level = LEVELS; level-- > 0;) {
+            auto shift = level * LEVEL_BITS;
+            if (shift > 0 && (now_ & ((uint64_t { 1 } << shift) - 1)) != 0)
+                continue;
+            auto list = level * SLOTS + static_cast<unsigned>(now_ >> shift) % SLOTS;
+            auto entry = heads_[list];
+            while (entry != NONE) {
+                auto next = entries_[entry].next;
+                unlink(entry);
+                schedule(entry);
+                entry = next;
+            }
+        }
+        take_overdue(expired);
+    }
+    now_ = std::max(now_, target);
+
+    for (const auto& expiry : expired)
+        fired(expiry);
+}
+
+} // namespace psafe3
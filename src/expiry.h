@@ -0,0 +1,99 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "fields.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// When the password of `record` expires: at PASSWORD_EXPIRY_TIME, or
+// PASSWORD_EXPIRY_INTERVAL days after PASSWORD_MODIFICATION_TIME, whichever
+// comes first. std::nullopt if neither is set.
+std::optional<std::time_t> password_expiry(const Record& record);
+
+// Password expiry deadlines of the records of several safes, kept in a
+// hierarchical timer wheel with one second resolution.
+//
+// Each level has 64 slots; level L holds deadlines that differ from the
+// current time first in bits [6L, 6L + 6). When time reaches the start of
+// a slot its entries move down a level, so every entry is touched at most
+// once per level, and empty slots are skipped using a bitmap per level.
+// advance() therefore costs time in the number of entries that fire, not
+// in the number scheduled or the time elapsed.
+//
+// Records are keyed by safe, a number chosen by the caller, and UUID;
+// records without a UUID are ignored. Each deadline fires once. Not thread
+// safe.
+class ExpiryScheduler {
+public:
+    struct Expiry {
+        uint32_t safe;
+        Uuid uuid;
+        std::time_t deadline;
+    };
+
+    explicit ExpiryScheduler(std::time_t now);
+
+    // Make the deadlines of `safe` those of `records`, typically after it
+    // was reloaded. Only records that were added, removed or whose deadline
+    // changed are rescheduled; deadlines already in the past fire on the
+    // next advance(). Returns the number of records rescheduled.
+    size_t update(uint32_t safe, std::span<const Record> records);
+    size_t update(uint32_t safe, const Safe& loaded) { return update(safe, loaded.database()); }
+
+    // Forget every deadline of `safe`.
+    void remove(uint32_t safe);
+
+    // Move time forward to `now` and call `fired` for every deadline that
+    // passed, earliest first. `fired` may call update() and remove().
+    void advance(std::time_t now, const std::function<void(const Expiry&)>& fired);
+
+    std::time_t now() const noexcept { return static_cast<std::time_t>(now_); }
+
+    // Deadlines that have not fired yet.
+    size_t pending() const noexcept { return pending_; }
+
+private:
+    static constexpr unsigned LEVEL_BITS = 6;
+    static constexpr unsigned SLOTS = 1u << LEVEL_BITS;
+    static constexpr unsigned LEVELS = (64 + LEVEL_BITS - 1) / LEVEL_BITS;
+    // Lists past the wheel: due, and fired but remembered.
+    static constexpr uint32_t OVERDUE = LEVELS * SLOTS;
+    static constexpr uint32_t FIRED = OVERDUE + 1;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        uint32_t safe;
+        Uuid uuid;
+        uint64_t deadline;
+        uint32_t list;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    uint64_t now_;
+    size_t pending_ = 0;
+    std::vector<Entry> entries_;
+    std::vector<uint32_t> free_;
+    std::array<uint32_t, LEVELS * SLOTS + 1> heads_;
+    std::array<uint64_t, LEVELS> occupied_ {};
+    std::unordered_map<uint32_t, std::unordered_map<Uuid, uint32_t, UuidHash>> by_safe_;
+
+    void link(uint32_t entry, uint32_t list);
+    void unlink(uint32_t entry);
+    void schedule(uint32_t entry);
+    void release(uint32_t entry);
+    std::optional<uint64_t> next_event() const noexcept;
+    void take_overdue(std::vector<Expiry>& out);
+};
+
+} // namespace psafe3
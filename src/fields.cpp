@@ -0,0 +1,189 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <system_error>
+
+#include "error.h"
+#include "fields.h"
+
+namespace psafe3 {
+
+namespace {
+
+    constexpr size_t POLICY_SIZE = 4 + 5 * 3;
+
+    int hex_value(std::byte b) noexcept
+    {
+        auto c = static_cast<unsigned char>(b);
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Consume `digits` hex characters from the front of `rest`.
+    std::expected<uint32_t, std::error_code> take_hex(std::span<const std::byte>& rest, size_t digits)
+    {
+        if (rest.size() < digits)
+            return std::unexpected(Error::malformed_field);
+        uint32_t value = 0;
+        for (size_t i = 0; i < digits; ++i) {
+            int v = hex_value(rest[i]);
+            if (v < 0)
+                return std::unexpected(Error::malformed_field);
+            value = (value << 4) | static_cast<uint32_t>(v);
+        }
+        rest = rest.subspan(digits);
+        return value;
+    }
+
+    std::expected<std::span<const std::byte>, std::error_code> take_bytes(std::span<const std::byte>& rest, size_t n)
+    {
+        if (rest.size() < n)
+            return std::unexpected(Error::malformed_field);
+        auto taken = rest.first(n);
+        rest = rest.subspan(n);
+        return taken;
+    }
+
+    // Consume `count` UTF-8 encoded characters. History lengths count
+    // characters, not bytes.
+    std::expected<std::span<const std::byte>, std::error_code> take_chars(std::span<const std::byte>& rest, size_t count)
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (offset >= rest.size())
+                return std::unexpected(Error::malformed_field);
+            auto lead = static_cast<unsigned char>(rest[offset]);
+            size_t width = lead < 0x80 ? 1 : (lead >> 5) == 0x06 ? 2 : (lead >> 4) == 0x0e ? 3 : (lead >> 3) == 0x1e ? 4 : 0;
+            if (width == 0 || offset + width > rest.size())
+                return std::unexpected(Error::malformed_field);
+            offset += width;
+        }
+        return take_bytes(rest, offset);
+    }
+
+    std::expected<PasswordPolicy, std::error_code> take_policy(std::span<const std::byte>& rest)
+    {
+        if (rest.size() < POLICY_SIZE)
+            return std::unexpected(Error::malformed_field);
+        PasswordPolicy policy {};
+        uint16_t* fields[] = { &policy.length, &policy.min_lowercase, &policy.min_uppercase,
+            &policy.min_digits, &policy.min_symbols };
+        auto flags = take_hex(rest, 4);
+        if (!flags)
+            return std::unexpected(flags.error());
+        policy.flags = static_cast<uint16_t>(*flags);
+        for (auto* field : fields) {
+            auto value = take_hex(rest, 3);
+            if (!value)
+                return std::unexpected(value.error());
+            *field = static_cast<uint16_t>(*value);
+        }
+        return policy;
+    }
+
+} // namespace
+
+std::expected<PasswordPolicy, std::error_code>
+parse_password_policy(std::span<const std::byte> data)
+{
+    if (data.size() != POLICY_SIZE)
+        return std::unexpected(Error::malformed_field);
+    return take_policy(data);
+}
+
+namespace detail {
+
+    std::expected<HistoryEntry, std::error_code> decode_history_entry(std::span<const std::byte>& rest)
+    {
+        auto time = take_hex(rest, 8);
+        if (!time)
+            return std::unexpected(time.error());
+        auto len = take_hex(rest, 4);
+        if (!len)
+            return std::unexpected(len.error());
+        auto password = take_chars(rest, *len);
+        if (!password)
+            return std::unexpected(password.error());
+        return HistoryEntry {
+            .time = static_cast<std::time_t>(*time),
+            .password = as_string_view(*password),
+        };
+    }
+
+    std::expected<NamedPasswordPolicy, std::error_code> decode_named_policy(std::span<const std::byte>& rest)
+    {
+        auto name_len = take_hex(rest, 2);
+        if (!name_len)
+            return std::unexpected(name_len.error());
+        auto name = take_bytes(rest, *name_len);
+        if (!name)
+            return std::unexpected(name.error());
+        auto policy = take_policy(rest);
+        if (!policy)
+            return std::unexpected(policy.error());
+        auto symbols_len = take_hex(rest, 2);
+        if (!symbols_len)
+            return std::unexpected(symbols_len.error());
+        auto symbols = take_bytes(rest, *symbols_len);
+        if (!symbols)
+            return std::unexpected(symbols.error());
+        return NamedPasswordPolicy {
+            .name = as_string_view(*name),
+            .policy = *policy,
+            .symbols = as_string_view(*symbols),
+        };
+    }
+
+    std::expected<Uuid, std::error_code> decode_hex_uuid(std::span<const std::byte>& rest)
+    {
+        Uuid uuid;
+        for (auto& b : uuid) {
+            auto value = take_hex(rest, 2);
+            if (!value)
+                return std::unexpected(value.error());
+            b = static_cast<std::byte>(*value);
+        }
+        return uuid;
+    }
+
+} // namespace detail
+
+std::expected<PasswordHistory, std::error_code> PasswordHistory::parse(std::span<const std::byte> data)
+{
+    auto flag = take_hex(data, 1);
+    if (!flag || *flag > 1)
+        return std::unexpected(Error::malformed_field);
+    auto max_entries = take_hex(data, 2);
+    if (!max_entries)
+        return std::unexpected(max_entries.error());
+    auto count = take_hex(data, 2);
+    if (!count)
+        return std::unexpected(count.error());
+    return PasswordHistory(data, *count, *flag == 1, static_cast<uint8_t>(*max_entries));
+}
+
+std::expected<NamedPasswordPolicies, std::error_code> NamedPasswordPolicies::parse(std::span<const std::byte> data)
+{
+    auto count = take_hex(data, 2);
+    if (!count)
+        return std::unexpected(count.error());
+    return NamedPasswordPolicies(data, *count);
+}
+
+std::expected<RecentlyUsedEntries, std::error_code> RecentlyUsedEntries::parse(std::span<const std::byte> data)
+{
+    auto count = take_hex(data, 2);
+    if (!count)
+        return std::unexpected(count.error());
+    return RecentlyUsedEntries(data, *count);
+}
+
+} // namespace psafe3
@@ -0,0 +1,225 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <expected>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <system_error>
+
+#include "safe.h"
+
+// Lazy views over the structured text fields (see formatV3.txt).
+//
+// The views decode in place over the decrypted field data and never
+// allocate. Each element is yielded as std::expected so malformed data is
+// reported where it is found; iteration ends after the first error.
+
+namespace psafe3 {
+
+using Uuid = std::array<std::byte, 16>;
+
+// UUIDs are random, so any eight of their bytes make a good hash.
+struct UuidHash {
+    size_t operator()(const Uuid& uuid) const noexcept
+    {
+        size_t h;
+        std::memcpy(&h, uuid.data(), sizeof(h));
+        return h;
+    }
+};
+
+struct PasswordPolicy {
+    enum Flags : uint16_t {
+        USE_LOWERCASE = 0x8000,
+        USE_UPPERCASE = 0x4000,
+        USE_DIGITS = 0x2000,
+        USE_SYMBOLS = 0x1000,
+        USE_HEX_DIGITS = 0x0800,
+        USE_EASY_VISION = 0x0400,
+        MAKE_PRONOUNCEABLE = 0x0200,
+    };
+
+    uint16_t flags;
+    uint16_t length;
+    uint16_t min_lowercase;
+    uint16_t min_uppercase;
+    uint16_t min_digits;
+    uint16_t min_symbols;
+};
+
+struct HistoryEntry {
+    std::time_t time;
+    std::string_view password;
+};
+
+struct NamedPasswordPolicy {
+    std::string_view name;
+    PasswordPolicy policy;
+    std::string_view symbols;
+};
+
+inline std::string_view as_string_view(std::span<const std::byte> data) noexcept
+{
+    return { reinterpret_cast<const char*>(data.data()), data.size() };
+}
+
+// First field of `type` in `record`, or nullptr.
+inline const RecordField* find_field(const Record& record, RecordFieldType type) noexcept
+{
+    for (const auto& field : record.fields) {
+        if (field.type == type)
+            return &field;
+    }
+    return nullptr;
+}
+
+inline std::optional<Uuid> record_uuid(const Record& record) noexcept
+{
+    const auto* field = find_field(record, RecordFieldType::UUID);
+    if (!field || field->data.size() != std::tuple_size_v<Uuid>)
+        return std::nullopt;
+    Uuid uuid;
+    std::memcpy(uuid.data(), field->data.data(), uuid.size());
+    return uuid;
+}
+
+// Decode a PASSWORD_POLICY record field ("ffffnnnllluuudddsss").
+std::expected<PasswordPolicy, std::error_code>
+parse_password_policy(std::span<const std::byte> data);
+
+namespace detail {
+
+    // Each decoder consumes one element from the front of `rest`.
+    std::expected<HistoryEntry, std::error_code> decode_history_entry(std::span<const std::byte>& rest);
+    std::expected<NamedPasswordPolicy, std::error_code> decode_named_policy(std::span<const std::byte>& rest);
+    std::expected<Uuid, std::error_code> decode_hex_uuid(std::span<const std::byte>& rest);
+
+    template <typename T, auto Decode>
+    class DecodingIterator {
+    public:
+        using value_type = std::expected<T, std::error_code>;
+        using difference_type = std::ptrdiff_t;
+
+        DecodingIterator() = default;
+        DecodingIterator(std::span<const std::byte> rest, size_t remaining)
+            : rest_(rest)
+            , remaining_(remaining)
+        {
+            advance();
+        }
+
+        const value_type& operator*() const noexcept { return current_; }
+        const value_type* operator->() const noexcept { return &current_; }
+
+        DecodingIterator& operator++()
+        {
+            advance();
+            return *this;
+        }
+        void operator++(int) { advance(); }
+
+        bool operator==(std::default_sentinel_t) const noexcept { return done_; }
+
+    private:
+        std::span<const std::byte> rest_;
+        size_t remaining_ = 0;
+        value_type current_ {};
+        bool done_ = false;
+
+        void advance()
+        {
+            if (remaining_ == 0 || !current_) {
+                done_ = true;
+                return;
+            }
+            --remaining_;
+            current_ = Decode(rest_);
+        }
+    };
+
+    // A counted sequence of encoded elements.
+    template <typename T, auto Decode>
+    class DecodingView {
+    public:
+        using iterator = DecodingIterator<T, Decode>;
+
+        DecodingView() = default;
+        DecodingView(std::span<const std::byte> entries, size_t count) noexcept
+            : entries_(entries)
+            , count_(count)
+        {
+        }
+
+        size_t size() const noexcept { return count_; }
+        bool empty() const noexcept { return count_ == 0; }
+        iterator begin() const { return iterator(entries_, count_); }
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+    private:
+        std::span<const std::byte> entries_;
+        size_t count_ = 0;
+    };
+
+} // namespace detail
+
+// PASSWORD_HISTORY record field ("fmmnnTLPTLP...TLP").
+class PasswordHistory : public detail::DecodingView<HistoryEntry, detail::decode_history_entry> {
+public:
+    static std::expected<PasswordHistory, std::error_code> parse(std::span<const std::byte> data);
+
+    bool enabled() const noexcept { return enabled_; }
+    uint8_t max_entries() const noexcept { return max_entries_; }
+
+private:
+    bool enabled_ = false;
+    uint8_t max_entries_ = 0;
+
+    PasswordHistory(std::span<const std::byte> entries, size_t count, bool enabled, uint8_t max_entries) noexcept
+        : DecodingView(entries, count)
+        , enabled_(enabled)
+        , max_entries_(max_entries)
+    {
+    }
+};
+
+// NAMED_PASSWORD_POLICIES header field ("NN{LLxxx...ffffnnnllluuudddsssMMSSS...}").
+class NamedPasswordPolicies : public detail::DecodingView<NamedPasswordPolicy, detail::decode_named_policy> {
+public:
+    static std::expected<NamedPasswordPolicies, std::error_code> parse(std::span<const std::byte> data);
+
+private:
+    NamedPasswordPolicies(std::span<const std::byte> entries, size_t count) noexcept
+        : DecodingView(entries, count)
+    {
+    }
+};
+
+// RECENTLY_USED_ENTRIES header field ("NN" followed by 32 hex digit UUIDs).
+class RecentlyUsedEntries : public detail::DecodingView<Uuid, detail::decode_hex_uuid> {
+public:
+    static std::expected<RecentlyUsedEntries, std::error_code> parse(std::span<const std::byte> data);
+
+private:
+    RecentlyUsedEntries(std::span<const std::byte> entries, size_t count) noexcept
+        : DecodingView(entries, count)
+    {
+    }
+};
+
+// EMPTY_GROUPS may appear many times in the header, one group name each.
+inline auto empty_groups(std::span<const HeaderField> header)
+{
+    return header
+        | std::views::filter([](const HeaderField& field) { return field.type == HeaderFieldType::EMPTY_GROUPS; })
+        | std::views::transform([](const HeaderField& field) { return as_string_view(field.data); });
+}
+
+} // namespace psafe3
@@ -0,0 +1,89 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cerrno>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "fileio.h"
+
+namespace psafe3 {
+
+// FileDescriptor
+
+FileDescriptor::~FileDescriptor()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+FileDescriptor::FileDescriptor(FileDescriptor&& other) noexcept
+    : fd_(other.fd_)
+{
+    other.fd_ = -1;
+}
+
+FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept
+{
+    FileDescriptor tmp(std::move(other));
+    std::swap(fd_, tmp.fd_);
+    return *this;
+}
+
+int FileDescriptor::release() noexcept
+{
+    return std::exchange(fd_, -1);
+}
+
+std::error_code last_system_error()
+{
+    return { errno, std::system_category() };
+}
+
+std::error_code read_exact(int fd, std::span<std::byte> buf, off_t offset)
+{
+    while (!buf.empty()) {
+        auto n = ::pread(fd, buf.data(), buf.size(), offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return last_system_error();
+        if (n == 0)
+            return Error::corrupt_file;
+        buf = buf.subspan(static_cast<size_t>(n));
+        offset += n;
+    }
+    return {};
+}
+
+std::error_code write_exact(int fd, std::span<const std::byte> buf, off_t offset)
+{
+    while (!buf.empty()) {
+        auto n = ::pwrite(fd, buf.data(), buf.size(), offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return last_system_error();
+        buf = buf.subspan(static_cast<size_t>(n));
+        offset += n;
+    }
+    return {};
+}
+
+std::error_code sync_directory(const std::filesystem::path& path)
+{
+    auto dir = path.parent_path();
+    if (dir.empty())
+        dir = ".";
+    FileDescriptor d(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!d || ::fsync(d.get()) != 0)
+        return last_system_error();
+    return {};
+}
+
+} // namespace psafe3
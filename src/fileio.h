@@ -0,0 +1,42 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+#include <sys/types.h>
+
+namespace psafe3 {
+
+// Owning file descriptor.
+class FileDescriptor {
+public:
+    FileDescriptor() noexcept = default;
+    explicit FileDescriptor(int fd) noexcept : fd_(fd) { }
+    ~FileDescriptor();
+    FileDescriptor(FileDescriptor&&) noexcept;
+    FileDescriptor& operator=(FileDescriptor&&) noexcept;
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const noexcept { return fd_; }
+    explicit operator bool() const noexcept { return fd_ >= 0; }
+    int release() noexcept;
+
+private:
+    int fd_ = -1;
+};
+
+std::error_code last_system_error();
+
+// Positioned I/O that retries short transfers and EINTR. Reading past the
+// end of file is reported as Error::corrupt_file.
+std::error_code read_exact(int fd, std::span<std::byte> buf, off_t offset);
+std::error_code write_exact(int fd, std::span<const std::byte> buf, off_t offset);
+
+// fsync the directory containing `path` so that entry changes are durable.
+std::error_code sync_directory(const std::filesystem::path& path);
+
+} // namespace psafe3
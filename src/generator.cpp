@@ -0,0 +1,175 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <gcrypt.h>
+
+#include "error.h"
+#include "fields.h"
+#include "generator.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Random bytes drawn from libgcrypt at a time.
+    constexpr size_t ENTROPY_BATCH = 4096;
+
+    constexpr std::string_view LOWERCASE = "abcdefghijklmnopqrstuvwxyz";
+    constexpr std::string_view UPPERCASE = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    constexpr std::string_view DIGITS = "0123456789";
+    constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+    constexpr std::string_view EASY_LOWERCASE = "abcdefghijkmnpqrstuvwxyz";
+    constexpr std::string_view EASY_UPPERCASE = "ABCDEFGHJKLMNPQRTUVWXY";
+    constexpr std::string_view EASY_DIGITS = "346789";
+
+    // Drop repeated characters, which would otherwise be picked more often.
+    std::string unique(std::string_view chars)
+    {
+        std::bitset<256> seen;
+        std::string out;
+        for (auto c : chars) {
+            auto b = static_cast<unsigned char>(c);
+            if (!seen[b]) {
+                seen.set(b);
+                out.push_back(c);
+            }
+        }
+        return out;
+    }
+
+} // namespace
+
+PasswordGenerator::PasswordGenerator(std::vector<CharClass>&& classes, size_t length)
+    : classes_(std::move(classes))
+    , length_(length)
+    , entropy_(ENTROPY_BATCH)
+    , used_(ENTROPY_BATCH)
+{
+    std::string all;
+    for (const auto& c : classes_)
+        all += c.chars;
+    all_ = unique(all);
+}
+
+std::expected<PasswordGenerator, std::error_code>
+PasswordGenerator::compile(const PasswordPolicy& policy, std::string_view symbols)
+{
+    using Flags = PasswordPolicy::Flags;
+    if (policy.flags & Flags::MAKE_PRONOUNCEABLE)
+        return std::unexpected(Error::unsupported_policy);
+    if (policy.length == 0)
+        return std::unexpected(Error::invalid_policy);
+    if (std::ranges::any_of(symbols, [](char c) { return static_cast<unsigned char>(c) >= 0x80; }))
+        return std::unexpected(Error::invalid_policy);
+
+    std::vector<CharClass> classes;
+    if (policy.flags & Flags::USE_HEX_DIGITS) {
+        classes.push_back({ std::string(HEX_DIGITS), 0 });
+    } else {
+        bool easy = policy.flags & Flags::USE_EASY_VISION;
+        if (policy.flags & Flags::USE_LOWERCASE)
+            classes.push_back({ std::string(easy ? EASY_LOWERCASE : LOWERCASE), policy.min_lowercase });
+        if (policy.flags & Flags::USE_UPPERCASE)
+            classes.push_back({ std::string(easy ? EASY_UPPERCASE : UPPERCASE), policy.min_uppercase });
+        if (policy.flags & Flags::USE_DIGITS)
+            classes.push_back({ std::string(easy ? EASY_DIGITS : DIGITS), policy.min_digits });
+        if (policy.flags & Flags::USE_SYMBOLS) {
+            auto chars = unique(!symbols.empty() ? symbols : easy ? EASY_VISION_SYMBOLS : DEFAULT_SYMBOLS);
+            if (chars.empty())
+                return std::unexpected(Error::invalid_policy);
+            classes.push_back({ std::move(chars), policy.min_symbols });
+        }
+    }
+    if (classes.empty())
+        return std::unexpected(Error::invalid_policy);
+
+    size_t required = 0;
+    for (const auto& c : classes)
+        required += c.minimum;
+    if (required > policy.length)
+        return std::unexpected(Error::invalid_policy);
+
+    return PasswordGenerator(std::move(classes), policy.length);
+}
+
+std::expected<PasswordGenerator, std::error_code>
+PasswordGenerator::for_record(const Record& record, std::span<const HeaderField> header, const PasswordPolicy& fallback)
+{
+    if (const auto* name = find_field(record, RecordFieldType::PASSWORD_POLICY_NAME); name) {
+        auto wanted = as_string_view(name->data);
+        for (const auto& field : header) {
+            if (field.type != HeaderFieldType::NAMED_PASSWORD_POLICIES)
+                continue;
+            auto policies = NamedPasswordPolicies::parse(field.data);
+            if (!policies)
+                return std::unexpected(policies.error());
+            for (const auto& named : *policies) {
+                if (!named)
+                    return std::unexpected(named.error());
+                if (named->name == wanted)
+                    return compile(named->policy, named->symbols);
+            }
+        }
+        return std::unexpected(Error::invalid_policy);
+    }
+
+    if (const auto* field = find_field(record, RecordFieldType::PASSWORD_POLICY); field) {
+        auto policy = parse_password_policy(field->data);
+        if (!policy)
+            return std::unexpected(policy.error());
+        const auto* symbols = find_field(record, RecordFieldType::OWN_SYMBOLS_FOR_PASSWORD);
+        return compile(*policy, symbols ? as_string_view(symbols->data) : std::string_view());
+    }
+
+    return compile(fallback);
+}
+
+uint32_t PasswordGenerator::uniform(uint32_t n)
+{
+    // Reject draws from the incomplete last stretch of the range, so that
+    // the remainder is unbiased.
+    uint32_t bytes = n <= 256 ? 1 : 2;
+    uint32_t range = 1u << (8 * bytes);
+    uint32_t limit = range - range % n;
+    for (;;) {
+        if (used_ + bytes > entropy_.size()) {
+            gcry_randomize(entropy_.data(), entropy_.size(), GCRY_STRONG_RANDOM);
+            used_ = 0;
+        }
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < bytes; ++i)
+            value = (value << 8) | static_cast<uint8_t>(entropy_.byte(used_++));
+        if (value < limit)
+            return value % n;
+    }
+}
+
+GeneratedPasswords PasswordGenerator::generate(size_t count)
+{
+    auto buffer = SecureBytes::mapped(std::max<size_t>(count * length_, 1));
+    for (size_t i = 0; i < count; ++i) {
+        auto* out = reinterpret_cast<char*>(buffer.data(i * length_));
+        size_t pos = 0;
+        for (const auto& c : classes_) {
+            for (uint16_t m = 0; m < c.minimum; ++m)
+                out[pos++] = c.chars[uniform(static_cast<uint32_t>(c.chars.size()))];
+        }
+        while (pos < length_)
+            out[pos++] = all_[uniform(static_cast<uint32_t>(all_.size()))];
+        // Fisher-Yates, so that the required characters land anywhere.
+        for (size_t j = length_ - 1; j > 0; --j)
+            std::swap(out[j], out[uniform(static_cast<uint32_t>(j + 1))]);
+    }
+    return GeneratedPasswords(std::move(buffer), count, length_);
+}
+
+} // namespace psafe3
@@ -0,0 +1,93 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "crypto.h"
+#include "fields.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// Passwords made by one PasswordGenerator::generate() call, all of the
+// policy's length, in a single secure buffer.
+class GeneratedPasswords {
+public:
+    size_t size() const noexcept { return count_; }
+    std::string_view operator[](size_t i) const noexcept
+    {
+        return { reinterpret_cast<const char*>(buffer_.data(i * length_)), length_ };
+    }
+
+private:
+    friend class PasswordGenerator;
+
+    SecureBytes buffer_;
+    size_t count_;
+    size_t length_;
+
+    GeneratedPasswords(SecureBytes&& buffer, size_t count, size_t length) noexcept
+        : buffer_(std::move(buffer))
+        , count_(count)
+        , length_(length)
+    {
+    }
+};
+
+// Password generation for a compiled password policy.
+//
+// Compiling resolves the policy flags and symbol set into character
+// classes once. Each password takes the minimum number of characters from
+// every class with one, fills up from all enabled classes, and is then
+// shuffled. Characters are picked by rejection sampling from random bytes
+// that are drawn from libgcrypt in batches and kept in secure memory.
+//
+// As in Password Safe, easy vision leaves out look-alike characters, hex
+// digits override every other class and the minimums, and an empty symbol
+// set means the default symbols. Pronounceable passwords are not
+// supported. Not thread safe.
+class PasswordGenerator {
+public:
+    static constexpr std::string_view DEFAULT_SYMBOLS = "+-=_@#$%^&;:,.<>/~\\[](){}?!|*";
+    static constexpr std::string_view EASY_VISION_SYMBOLS = "+-=_@#$%^&<>/~\\?*";
+
+    static std::expected<PasswordGenerator, std::error_code>
+    compile(const PasswordPolicy& policy, std::string_view symbols = {});
+
+    // The policy of `record`: the named policy from the header's
+    // NAMED_PASSWORD_POLICIES if it has a PASSWORD_POLICY_NAME, else its
+    // PASSWORD_POLICY and OWN_SYMBOLS_FOR_PASSWORD, else `fallback`.
+    static std::expected<PasswordGenerator, std::error_code>
+    for_record(const Record& record, std::span<const HeaderField> header, const PasswordPolicy& fallback);
+
+    size_t length() const noexcept { return length_; }
+
+    GeneratedPasswords generate(size_t count);
+
+private:
+    struct CharClass {
+        std::string chars;
+        uint16_t minimum;
+    };
+
+    std::vector<CharClass> classes_;
+    // Every enabled class together.
+    std::string all_;
+    size_t length_;
+    SecureBytes entropy_;
+    size_t used_;
+
+    PasswordGenerator(std::vector<CharClass>&& classes, size_t length);
+
+    // Uniform in [0, n), n at most 65536.
+    uint32_t uniform(uint32_t n);
+};
+
+} // namespace psafe3
@@ -0,0 +1,165 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fields.h"
+#include "groups.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Call `fn(segment)` for each segment of a dotted path. A backslash
+    // escapes the character after it.
+    template <typename Fn>
+    void for_each_segment(std::string_view path, Fn fn)
+    {
+        if (path.empty())
+            return;
+        size_t start = 0;
+        for (size_t i = 0; i < path.size(); ++i) {
+            if (path[i] == '\\') {
+                ++i;
+            } else if (path[i] == '.') {
+                fn(path.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+        fn(path.substr(start));
+    }
+
+    struct Pending {
+        uint32_t segment;
+        uint32_t parent;
+        std::vector<uint32_t> children;
+        std::vector<uint32_t> records;
+    };
+
+} // namespace
+
+GroupTree GroupTree::build(std::span<const Record> records, std::span<const HeaderField> header)
+{
+    GroupTree tree;
+    std::unordered_map<std::string_view, uint32_t> interned;
+    auto intern = [&](std::string_view segment) {
+        auto [it, added] = interned.try_emplace(segment, static_cast<uint32_t>(tree.segments_.size()));
+        if (added)
+            tree.segments_.push_back(segment);
+        return it->second;
+    };
+    intern({});
+
+    // Build an unordered trie first; edges are keyed by parent and segment.
+    std::vector<Pending> pending(1, Pending { 0, ROOT, {}, {} });
+    std::unordered_map<uint64_t, uint32_t> edges;
+    auto insert = [&](std::string_view path) {
+        uint32_t node = ROOT;
+        for_each_segment(path, [&](std::string_view name) {
+            auto segment = intern(name);
+            auto key = (uint64_t { node } << 32) | segment;
+            auto [it, added] = edges.try_emplace(key, static_cast<uint32_t>(pending.size()));
+            if (added) {
+                pending.push_back({ segment, node, {}, {} });
+                pending[node].children.push_back(it->second);
+            }
+            node = it->second;
+        });
+        return node;
+    };
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto* group = find_field(records[i], RecordFieldType::GROUP);
+        auto node = group ? insert(as_string_view(group->data)) : ROOT;
+        pending[node].records.push_back(static_cast<uint32_t>(i));
+    }
+    for (auto path : empty_groups(header))
+        insert(path);
+
+    // Number the nodes breadth first so that siblings are adjacent.
+    std::vector<uint32_t> renumbered(pending.size());
+    std::vector<uint32_t> queue { ROOT };
+    tree.nodes_.reserve(pending.size());
+    tree.nodes_.push_back({ 0, ROOT, 0, 0, 0, 0, 0 });
+    for (size_t head = 0; head < queue.size(); ++head) {
+        auto& p = pending[queue[head]];
+        std::ranges::sort(p.children, {}, [&](uint32_t c) { return tree.segments_[pending[c].segment]; });
+        auto id = renumbered[queue[head]];
+        tree.nodes_[id].first_child = static_cast<uint32_t>(tree.nodes_.size());
+        tree.nodes_[id].child_count = static_cast<uint32_t>(p.children.size());
+        for (auto c : p.children) {
+            renumbered[c] = static_cast<uint32_t>(tree.nodes_.size());
+            tree.nodes_.push_back({ pending[c].segment, id, 0, 0, 0, 0, 0 });
+            queue.push_back(c);
+        }
+    }
+
+    // Lay the records out depth first. The stack holds a node and the
+    // number of its children already visited.
+    tree.order_.reserve(records.size());
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    auto enter = [&](uint32_t pending_id) {
+        auto& node = tree.nodes_[renumbered[pending_id]];
+        node.begin = static_cast<uint32_t>(tree.order_.size());
+        tree.order_.insert(tree.order_.end(), pending[pending_id].records.begin(), pending[pending_id].records.end());
+        node.own_end = static_cast<uint32_t>(tree.order_.size());
+        stack.emplace_back(pending_id, 0);
+    };
+    enter(ROOT);
+    while (!stack.empty()) {
+        auto& [pending_id, visited] = stack.back();
+        const auto& children = pending[pending_id].children;
+        if (visited < children.size()) {
+            enter(children[visited++]);
+        } else {
+            tree.nodes_[renumbered[pending_id]].end = static_cast<uint32_t>(tree.order_.size());
+            stack.pop_back();
+        }
+    }
+    return tree;
+}
+
+std::string GroupTree::path(uint32_t id) const
+{
+    std::vector<std::string_view> names;
+    for (; id != ROOT; id = nodes_[id].parent)
+        names.push_back(name(id));
+    std::string result;
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+        if (it != names.rbegin())
+            result += '.';
+        result += *it;
+    }
+    return result;
+}
+
+std::optional<uint32_t> GroupTree::child(uint32_t id, std::string_view segment) const
+{
+    const auto& n = nodes_[id];
+    auto first = nodes_.begin() + n.first_child;
+    auto last = first + n.child_count;
+    auto it = std::ranges::lower_bound(first, last, segment, {}, [&](const Node& c) { return segments_[c.segment]; });
+    if (it == last || segments_[it->segment] != segment)
+        return std::nullopt;
+    return static_cast<uint32_t>(it - nodes_.begin());
+}
+
+std::optional<uint32_t> GroupTree::find(std::string_view path) const
+{
+    std::optional<uint32_t> node = ROOT;
+    for_each_segment(path, [&](std::string_view segment) {
+        if (node)
+            node = child(*node, segment);
+    });
+    return node;
+}
+
+} // namespace psafe3
@@ -0,0 +1,87 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstdint>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "safe.h"
+
+namespace psafe3 {
+
+// The group hierarchy of a safe.
+//
+// GROUP fields hold dot-separated paths, with literal dots escaped as "\.".
+// Each distinct segment is stored once, as a view into the field data it
+// came from; the tree is only valid as long as the records and header it
+// was built from. Groups named by EMPTY_GROUPS header fields are included
+// even when no record is in them, and records without a group belong to
+// the root.
+//
+// Record indices are laid out in depth-first order so that every node owns
+// a contiguous range: first the records directly in the group, then those
+// of each subgroup in turn. Children are numbered contiguously and sorted
+// by name.
+class GroupTree {
+public:
+    static constexpr uint32_t ROOT = 0;
+
+    struct Node {
+        uint32_t segment;
+        uint32_t parent;
+        uint32_t first_child;
+        uint32_t child_count;
+        // Ranges of records(), see above.
+        uint32_t begin;
+        uint32_t own_end;
+        uint32_t end;
+    };
+
+    static GroupTree build(std::span<const Record> records, std::span<const HeaderField> header);
+
+    std::span<const Node> nodes() const noexcept { return nodes_; }
+    const Node& node(uint32_t id) const noexcept { return nodes_[id]; }
+
+    // Segment name of `id`; empty for the root. Escaped dots are kept.
+    std::string_view name(uint32_t id) const noexcept { return segments_[nodes_[id].segment]; }
+
+    // Full dotted path of `id`.
+    std::string path(uint32_t id) const;
+
+    auto children(uint32_t id) const noexcept
+    {
+        const auto& n = nodes_[id];
+        return std::views::iota(n.first_child, n.first_child + n.child_count);
+    }
+
+    // Child of `id` named `segment`, by binary search.
+    std::optional<uint32_t> child(uint32_t id, std::string_view segment) const;
+
+    // Node for a dotted path, walking down from the root.
+    std::optional<uint32_t> find(std::string_view path) const;
+
+    // Indices of the records in the subtree of `id`.
+    std::span<const uint32_t> records(uint32_t id) const noexcept
+    {
+        return std::span(order_).subspan(nodes_[id].begin, nodes_[id].end - nodes_[id].begin);
+    }
+
+    // Indices of the records directly in `id`.
+    std::span<const uint32_t> own_records(uint32_t id) const noexcept
+    {
+        return std::span(order_).subspan(nodes_[id].begin, nodes_[id].own_end - nodes_[id].begin);
+    }
+
+    size_t segment_count() const noexcept { return segments_.size(); }
+
+private:
+    std::vector<std::string_view> segments_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> order_;
+};
+
+} // namespace psafe3
@@ -0,0 +1,394 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <expected>
+#include <istream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <gcrypt.h>
+
+#include "error.h"
+#include "import.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+
+    char lower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    std::span<const std::byte> bytes(std::string_view s)
+    {
+        return { reinterpret_cast<const std::byte*>(s.data()), s.size() };
+    }
+
+    // Clear a buffer that held plaintext, including spare capacity, and
+    // release it if it has grown past `limit`.
+    template <typename String>
+    void wipe(String& s, size_t limit)
+    {
+        s.resize(s.capacity());
+        ::explicit_bzero(s.data(), s.size());
+        s.clear();
+        if (s.capacity() > limit)
+            s.shrink_to_fit();
+    }
+
+    bool json_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    template <typename String>
+    void append_utf8(String& out, uint32_t cp)
+    {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        } else {
+            out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    std::optional<uint32_t> hex4(std::string_view s, size_t pos)
+    {
+        if (pos + 4 > s.size())
+            return std::nullopt;
+        uint32_t value = 0;
+        for (size_t i = pos; i < pos + 4; ++i) {
+            char c = lower(s[i]);
+            uint32_t digit;
+            if (c >= '0' && c <= '9')
+                digit = static_cast<uint32_t>(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                digit = static_cast<uint32_t>(c - 'a' + 10);
+            else
+                return std::nullopt;
+            value = value << 4 | digit;
+        }
+        return value;
+    }
+
+    // Decode the JSON string starting after the opening quote at `pos`
+    // into `out`. Leaves `pos` after the closing quote.
+    template <typename String>
+    bool json_string(std::string_view s, size_t& pos, String& out)
+    {
+        out.clear();
+        while (pos < s.size()) {
+            char c = s[pos++];
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return false;
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos >= s.size())
+                return false;
+            switch (s[pos++]) {
+            case '"':
+                out.push_back('"');
+                break;
+            case '\\':
+                out.push_back('\\');
+                break;
+            case '/':
+                out.push_back('/');
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                auto cp = hex4(s, pos);
+                if (!cp)
+                    return false;
+                pos += 4;
+                if (*cp >= 0xd800 && *cp < 0xdc00) {
+                    auto low = pos + 1 < s.size() && s[pos] == '\\' && s[pos + 1] == 'u' ? hex4(s, pos + 2) : std::nullopt;
+                    if (!low || *low < 0xdc00 || *low >= 0xe000)
+                        return false;
+                    pos += 6;
+                    cp = 0x10000 + ((*cp - 0xd800) << 10) + (*low - 0xdc00);
+                } else if (*cp >= 0xdc00 && *cp < 0xe000) {
+                    return false;
+                }
+                append_utf8(out, *cp);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+} // namespace
+
+RecordImporter::RecordImporter(ImportFormat format, std::span<const ImportColumn> columns)
+    : format_(format)
+{
+    for (const auto& column : columns) {
+        std::string name(column.name);
+        std::ranges::transform(name, name.begin(), lower);
+        columns_.emplace_back(std::move(name), column.type);
+    }
+}
+
+RecordImporter::~RecordImporter()
+{
+    wipe_buffers();
+}
+
+void RecordImporter::wipe_buffers()
+{
+    wipe(line_, MAX_RETAINED);
+    wipe(value_, MAX_RETAINED);
+    for (auto& value : values_)
+        wipe(value, MAX_RETAINED);
+}
+
+std::optional<RecordFieldType> RecordImporter::lookup(std::string_view name)
+{
+    key_.assign(name);
+    std::ranges::transform(key_, key_.begin(), lower);
+    for (const auto& [column, type] : columns_) {
+        if (column == key_)
+            return type;
+    }
+    return std::nullopt;
+}
+
+bool RecordImporter::next_line(std::istream& in)
+{
+    if (!std::getline(in, line_))
+        return false;
+    ++line_number_;
+    if (!line_.empty() && line_.back() == '\r')
+        line_.pop_back();
+    return true;
+}
+
+// Split one CSV row, which may span lines inside quotes, into values_.
+std::error_code RecordImporter::read_csv_row(std::istream& in, size_t& count)
+{
+    count = 0;
+    size_t pos = 0;
+    for (;;) {
+        if (values_.size() <= count)
+            values_.emplace_back();
+        auto& value = values_[count++];
+        value.clear();
+
+        if (pos < line_.size() && line_[pos] == '"') {
+            ++pos;
+            for (;;) {
+                auto quote = line_.find('"', pos);
+                if (quote == std::string::npos) {
+                    value.append(line_, pos);
+                    value.push_back('\n');
+                    if (!next_line(in))
+                        return Error::malformed_input;
+                    pos = 0;
+                    continue;
+                }
+                value.append(line_, pos, quote - pos);
+                pos = quote + 1;
+                if (pos < line_.size() && line_[pos] == '"') {
+                    value.push_back('"');
+                    ++pos;
+                    continue;
+                }
+                break;
+            }
+            if (pos < line_.size() && line_[pos] != ',')
+                return Error::malformed_input;
+        } else {
+            auto comma = std::min(line_.find(',', pos), line_.size());
+            value.append(line_, pos, comma - pos);
+            pos = comma;
+        }
+
+        if (pos >= line_.size())
+            return {};
+        ++pos;
+    }
+}
+
+std::error_code RecordImporter::begin_record(BodyWriter& out)
+{
+    // What uuid_generate_random() does, but without a system call for
+    // every record.
+    if (uuids_used_ == uuids_.size()) {
+        gcry_create_nonce(uuids_.data(), uuids_.size());
+        uuids_used_ = 0;
+    }
+    auto uuid = std::span(uuids_).subspan(uuids_used_, 16);
+    uuids_used_ += 16;
+    uuid[6] = (uuid[6] & std::byte { 0x0f }) | std::byte { 0x40 };
+    uuid[8] = (uuid[8] & std::byte { 0x3f }) | std::byte { 0x80 };
+    if (auto err = out.write_field(static_cast<uint8_t>(RecordFieldType::UUID), uuid); err)
+        return err;
+    std::array<std::byte, 4> now;
+    store<std::endian::little>(std::span(now), static_cast<uint32_t>(std::time(nullptr)));
+    return out.write_field(static_cast<uint8_t>(RecordFieldType::CREATION_TIME), now);
+}
+
+// Parse one NDJSON object, writing mapped values as they are decoded.
+std::error_code RecordImporter::write_ndjson(std::string_view s, BodyWriter& out)
+{
+    size_t pos = 0;
+    auto skip_space = [&] {
+        while (pos < s.size() && json_space(s[pos]))
+            ++pos;
+    };
+    skip_space();
+    if (pos >= s.size() || s[pos++] != '{')
+        return Error::malformed_input;
+    if (auto err = begin_record(out); err)
+        return err;
+
+    skip_space();
+    if (pos < s.size() && s[pos] == '}') {
+        ++pos;
+    } else {
+        for (;;) {
+            skip_space();
+            if (pos >= s.size() || s[pos++] != '"' || !json_string(s, pos, value_))
+                return Error::malformed_input;
+            auto type = lookup(value_);
+            skip_space();
+            if (pos >= s.size() || s[pos++] != ':')
+                return Error::malformed_input;
+            skip_space();
+            if (pos >= s.size())
+                return Error::malformed_input;
+
+            if (s[pos] == '"') {
+                ++pos;
+                if (!json_string(s, pos, value_))
+                    return Error::malformed_input;
+            } else if (s[pos] == '{' || s[pos] == '[') {
+                return Error::malformed_input;
+            } else {
+                // Numbers and literals are kept as written; null is no value.
+                auto end = pos;
+                while (end < s.size() && s[end] != ',' && s[end] != '}' && !json_space(s[end]))
+                    ++end;
+                value_.assign(s.substr(pos, end - pos));
+                if (value_.empty())
+                    return Error::malformed_input;
+                if (value_ == "null")
+                    value_.clear();
+                pos = end;
+            }
+            if (type && !value_.empty()) {
+                if (auto err = out.write_field(static_cast<uint8_t>(*type), bytes(value_)); err)
+                    return err;
+            }
+
+            skip_space();
+            if (pos >= s.size())
+                return Error::malformed_input;
+            char c = s[pos++];
+            if (c == '}')
+                break;
+            if (c != ',')
+                return Error::malformed_input;
+        }
+    }
+    skip_space();
+    if (pos != s.size())
+        return Error::malformed_input;
+    return out.end_entry();
+}
+
+std::expected<size_t, std::error_code> RecordImporter::run(std::istream& in, BodyWriter& out)
+{
+    size_t records = 0;
+    if (format_ == ImportFormat::ndjson) {
+        while (next_line(in)) {
+            if (std::ranges::all_of(line_, json_space))
+                continue;
+            auto err = write_ndjson(line_, out);
+            wipe_buffers();
+            if (err)
+                return std::unexpected(err);
+            ++records;
+        }
+        if (in.bad())
+            return std::unexpected(std::make_error_code(std::errc::io_error));
+        return records;
+    }
+
+    size_t count;
+    if (!next_line(in)) {
+        if (in.bad())
+            return std::unexpected(std::make_error_code(std::errc::io_error));
+        return 0;
+    }
+    if (auto err = read_csv_row(in, count); err)
+        return std::unexpected(err);
+    positions_.clear();
+    for (size_t i = 0; i < count; ++i)
+        positions_.push_back(lookup(values_[i]));
+
+    while (next_line(in)) {
+        if (line_.empty())
+            continue;
+        if (auto err = read_csv_row(in, count); err)
+            return std::unexpected(err);
+        if (count > positions_.size())
+            return std::unexpected(Error::malformed_input);
+        if (auto err = begin_record(out); err)
+            return std::unexpected(err);
+        for (size_t i = 0; i < count; ++i) {
+            if (!positions_[i] || values_[i].empty())
+                continue;
+            if (auto err = out.write_field(static_cast<uint8_t>(*positions_[i]), bytes(values_[i])); err)
+                return std::unexpected(err);
+        }
+        if (auto err = out.end_entry(); err)
+            return std::unexpected(err);
+        wipe_buffers();
+        ++records;
+    }
+    if (in.bad())
+        return std::unexpected(std::make_error_code(std::errc::io_error));
+    return records;
+}
+
+} // namespace psafe3
@@ -0,0 +1,94 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstddef>
+#include <expected>
+#include <istream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "crypto.h"
+#include "safe.h"
+#include "writer.h"
+
+namespace psafe3 {
+
+enum class ImportFormat {
+    // RFC 4180, with a header row naming the columns.
+    csv,
+    // One flat JSON object per line, keys naming the columns.
+    ndjson,
+};
+
+struct ImportColumn {
+    // Matched case-insensitively.
+    std::string_view name;
+    RecordFieldType type;
+};
+
+inline constexpr std::array DEFAULT_IMPORT_COLUMNS = {
+    ImportColumn { "group", RecordFieldType::GROUP },
+    ImportColumn { "title", RecordFieldType::TITLE },
+    ImportColumn { "username", RecordFieldType::USERNAME },
+    ImportColumn { "password", RecordFieldType::PASSWORD },
+    ImportColumn { "url", RecordFieldType::URL },
+    ImportColumn { "notes", RecordFieldType::NOTES },
+    ImportColumn { "email", RecordFieldType::EMAIL_ADDRESS },
+};
+
+// Streams records from CSV or NDJSON into a BodyWriter.
+//
+// Each input record becomes one record with a new random (version 4) UUID, a
+// CREATION_TIME of now and a field for every non-empty value in a mapped
+// column; other columns are ignored. Values are copied as they are, so
+// they should be UTF-8. Input is read a line at a time into buffers that
+// are reused for every record and wiped after each one; memory they give
+// up when they grow is wiped too. Nothing is kept per record.
+class RecordImporter {
+public:
+    explicit RecordImporter(ImportFormat format, std::span<const ImportColumn> columns = DEFAULT_IMPORT_COLUMNS);
+    ~RecordImporter();
+    RecordImporter(const RecordImporter&) = delete;
+    RecordImporter& operator=(const RecordImporter&) = delete;
+
+    // Import every record of `in`. Returns the number of records written,
+    // or Error::malformed_input with line() telling where.
+    std::expected<size_t, std::error_code> run(std::istream& in, BodyWriter& out);
+
+    // Line of the input last read, counting from 1.
+    size_t line() const noexcept { return line_number_; }
+
+private:
+    using Text = std::basic_string<char, std::char_traits<char>, WipingAllocator<char>>;
+
+    // Buffers larger than this after a record are released, so that one
+    // long line does not make wiping every later record slow.
+    static constexpr size_t MAX_RETAINED = 64 * 1024;
+
+    ImportFormat format_;
+    std::vector<std::pair<std::string, RecordFieldType>> columns_;
+    // For CSV, the field type of each column position.
+    std::vector<std::optional<RecordFieldType>> positions_;
+    Text line_;
+    std::string key_;
+    Text value_;
+    std::vector<Text> values_;
+    size_t line_number_ = 0;
+    // Random bytes for record UUIDs, drawn in batches.
+    std::array<std::byte, 256 * 16> uuids_;
+    size_t uuids_used_ = 256 * 16;
+
+    std::optional<RecordFieldType> lookup(std::string_view name);
+    bool next_line(std::istream& in);
+    std::error_code read_csv_row(std::istream& in, size_t& count);
+    std::error_code write_ndjson(std::string_view line, BodyWriter& out);
+    std::error_code begin_record(BodyWriter& out);
+    void wipe_buffers();
+};
+
+} // namespace psafe3
@@ -0,0 +1,42 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <filesystem>
+#include <system_error>
+
+namespace psafe3 {
+
+// Undo journals kept next to a safe while it is rewritten in place. Each
+// is synced before the safe is touched and removed once the change is
+// durable; one left behind means the change may be torn.
+
+// "<safe>.rekey", written by rekey().
+inline std::filesystem::path rekey_journal_path(const std::filesystem::path& path)
+{
+    auto journal = path;
+    journal += ".rekey";
+    return journal;
+}
+
+// "<safe>.tail", written by Safe::save_tail().
+inline std::filesystem::path tail_journal_path(const std::filesystem::path& path)
+{
+    auto journal = path;
+    journal += ".tail";
+    return journal;
+}
+
+// Finish with a rekey interrupted after its journal was written. `fd` is
+// the safe, open for writing and locked with flock(). In rekey.cpp.
+std::error_code recover_rekey(int fd, const std::filesystem::path& path);
+
+// Put back the tail journaled by an interrupted save_tail(). `fd` is as
+// for recover_rekey(). In safe.cpp.
+std::error_code recover_tail(int fd, const std::filesystem::path& path);
+
+// Both of the above for a safe that is not open yet, under an exclusive
+// flock(). Cheap when there is no journal; otherwise needs write access to
+// `path`. Called before a safe is read.
+std::error_code recover_journals(const std::filesystem::path& path);
+
+} // namespace psafe3
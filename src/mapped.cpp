@@ -47,6 +47,14 @@ MappedMemory::~MappedMemory()
         munmap(reinterpret_cast<void*>(base_), size_);
 }
 
+std::expected<MappedMemory, std::error_code> MappedMemory::map(int fd, size_t size, MemoryAccess access)
+{
+    void* ptr = ::mmap(nullptr, size, static_cast<int>(access), MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return std::unexpected(std::error_code(errno, std::system_category()));
+    return MappedMemory(reinterpret_cast<uintptr_t>(ptr), size, access);
+}
+
 const std::byte* MappedMemory::data() const noexcept
 {
     return reinterpret_cast<const std::byte*>(base_);
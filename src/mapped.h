@@ -24,7 +24,18 @@ class MappedFile;
 
 class MappedMemory {
 public:
+    // Maps nothing.
+    MappedMemory() noexcept
+        : base_(0)
+        , size_(0)
+        , access_(PROT_NONE)
+    {
+    }
     ~MappedMemory();
+
+    // Map the first `size` bytes of `fd` shared.
+    static std::expected<MappedMemory, std::error_code> map(int fd, size_t size, MemoryAccess access);
+
     MappedMemory(MappedMemory&&) noexcept;
     MappedMemory& operator=(MappedMemory&&) noexcept;
     MappedMemory(const MappedMemory&) = delete;
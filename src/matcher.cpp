@@ -0,0 +1,166 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fields.h"
+#include "matcher.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Between the fields of a record. Never part of a lowercased query.
+    constexpr char SEPARATOR = '\x1f';
+
+    constexpr int32_t MATCH = 16;
+    constexpr int32_t CONSECUTIVE = 24;
+    constexpr int32_t WORD_START = 16;
+    constexpr int32_t MAX_GAP_PENALTY = 16;
+
+    char lower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    bool word_boundary(char c)
+    {
+        switch (c) {
+        case SEPARATOR:
+        case ' ':
+        case '.':
+        case '/':
+        case '-':
+        case '_':
+        case '@':
+        case ':':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Greedy leftmost subsequence match. memchr() does the skipping, which
+    // libc vectorizes. Returns a negative score when there is no match.
+    int32_t score(std::string_view text, std::string_view query)
+    {
+        int32_t total = 0;
+        size_t pos = 0;
+        size_t prev = 0;
+        for (size_t q = 0; q < query.size(); ++q) {
+            const auto* hit = static_cast<const char*>(std::memchr(text.data() + pos, query[q], text.size() - pos));
+            if (!hit)
+                return -1;
+            size_t i = static_cast<size_t>(hit - text.data());
+            total += MATCH;
+            if (q > 0 && i == prev + 1)
+                total += CONSECUTIVE;
+            else if (i == 0 || word_boundary(text[i - 1]))
+                total += WORD_START;
+            size_t gap = q == 0 ? i : i - prev - 1;
+            total -= static_cast<int32_t>(std::min<size_t>(gap, MAX_GAP_PENALTY));
+            prev = i;
+            pos = i + 1;
+        }
+        // Prefer shorter candidates among equals.
+        return std::max<int32_t>(total - static_cast<int32_t>(text.size() / 32), 0);
+    }
+
+    bool better(const FuzzyMatcher::Match& a, const FuzzyMatcher::Match& b)
+    {
+        return a.score != b.score ? a.score > b.score : a.record < b.record;
+    }
+
+} // namespace
+
+FuzzyMatcher::FuzzyMatcher(SecureBytes&& text, std::vector<uint32_t>&& offsets)
+    : text_(std::move(text))
+    , offsets_(std::move(offsets))
+{
+}
+
+FuzzyMatcher FuzzyMatcher::build(std::span<const Record> records, std::span<const RecordFieldType> fields)
+{
+    std::vector<uint32_t> offsets;
+    offsets.reserve(records.size() + 1);
+    size_t total = 0;
+    for (const auto& record : records) {
+        offsets.push_back(static_cast<uint32_t>(total));
+        for (auto type : fields) {
+            if (const auto* field = find_field(record, type); field)
+                total += field->data.size() + 1;
+        }
+    }
+    offsets.push_back(static_cast<uint32_t>(total));
+
+    auto text = SecureBytes::mapped(std::max<size_t>(total, 1));
+    auto* out = reinterpret_cast<char*>(text.data());
+    for (const auto& record : records) {
+        for (auto type : fields) {
+            const auto* field = find_field(record, type);
+            if (!field)
+                continue;
+            for (auto c : as_string_view(field->data))
+                *out++ = lower(c);
+            *out++ = SEPARATOR;
+        }
+    }
+    return FuzzyMatcher(std::move(text), std::move(offsets));
+}
+
+std::string_view FuzzyMatcher::candidate(uint32_t record) const noexcept
+{
+    return { reinterpret_cast<const char*>(text_.data(offsets_[record])), offsets_[record + 1] - offsets_[record] };
+}
+
+std::vector<FuzzyMatcher::Match> FuzzyMatcher::query(std::string_view query, size_t k)
+{
+    std::string lowered(query);
+    std::ranges::transform(lowered, lowered.begin(), lower);
+
+    // Only records that matched a prefix of the query can match the query.
+    bool narrowing = !fresh_ && lowered.starts_with(last_query_);
+    std::vector<uint32_t> matched;
+    matched.reserve(narrowing ? matched_.size() : offsets_.size() - 1);
+
+    // Min-heap of the best k so far, worst on top.
+    std::vector<Match> top;
+    top.reserve(k + 1);
+    auto consider = [&](uint32_t record) {
+        auto s = score(candidate(record), lowered);
+        if (s < 0)
+            return;
+        matched.push_back(record);
+        if (k == 0)
+            return;
+        Match m { record, s };
+        if (top.size() < k) {
+            top.push_back(m);
+            std::ranges::push_heap(top, better);
+        } else if (better(m, top.front())) {
+            std::ranges::pop_heap(top, better);
+            top.back() = m;
+            std::ranges::push_heap(top, better);
+        }
+    };
+    if (narrowing) {
+        for (auto record : matched_)
+            consider(record);
+    } else {
+        for (uint32_t record = 0; record + 1 < offsets_.size(); ++record)
+            consider(record);
+    }
+
+    matched_ = std::move(matched);
+    last_query_ = std::move(lowered);
+    fresh_ = false;
+    std::ranges::sort_heap(top, better);
+    return top;
+}
+
+} // namespace psafe3
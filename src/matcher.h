@@ -0,0 +1,63 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "crypto.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// As-you-type fuzzy lookup of records.
+//
+// The chosen fields of every record are lowercased (ASCII only) into one
+// contiguous secure buffer when the matcher is built; the records are not
+// consulted again. A query matches a record when its characters appear in
+// order in that text. Matches score higher for consecutive characters and
+// for characters at the start of a word, and lower for gaps.
+//
+// The matcher remembers which records matched the previous query. When the
+// next query extends it, as it does while typing, only those records are
+// scored again. Not thread safe.
+class FuzzyMatcher {
+public:
+    struct Match {
+        uint32_t record;
+        int32_t score;
+    };
+
+    static constexpr std::array DEFAULT_FIELDS = {
+        RecordFieldType::TITLE,
+        RecordFieldType::URL,
+        RecordFieldType::USERNAME,
+    };
+
+    static FuzzyMatcher build(std::span<const Record> records,
+        std::span<const RecordFieldType> fields = DEFAULT_FIELDS);
+
+    // The best `k` matches for `query`, best first; ties go to the lower
+    // record index.
+    std::vector<Match> query(std::string_view query, size_t k);
+
+    // Number of records that matched the last query.
+    size_t matched() const noexcept { return matched_.size(); }
+
+private:
+    SecureBytes text_;
+    // Record i is text_[offsets_[i], offsets_[i + 1]).
+    std::vector<uint32_t> offsets_;
+    std::string last_query_;
+    std::vector<uint32_t> matched_;
+    bool fresh_ = true;
+
+    FuzzyMatcher(SecureBytes&& text, std::vector<uint32_t>&& offsets);
+
+    std::string_view candidate(uint32_t record) const noexcept;
+};
+
+} // namespace psafe3
@@ -0,0 +1,252 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <bitset>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "fields.h"
+#include "merge.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+namespace {
+    // splitmix64 finalizer.
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Summing the mixed field hashes makes the fingerprint independent of
+    // field order.
+    uint64_t fingerprint(const Record& record)
+    {
+        uint64_t fp = 0;
+        for (const auto& field : record.fields) {
+            uint64_t h = std::hash<std::string_view> {}(as_string_view(field.data));
+            fp += mix(h ^ (uint64_t { static_cast<uint8_t>(field.type) } << 56));
+        }
+        return fp;
+    }
+
+    struct Entry {
+        size_t index;
+        uint64_t fingerprint;
+    };
+
+    using Index = std::unordered_map<Uuid, Entry, UuidHash>;
+
+    // The first record wins when a UUID repeats.
+    Index make_index(std::span<const Record> records)
+    {
+        Index index;
+        index.reserve(records.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (auto uuid = record_uuid(records[i]); uuid)
+                index.try_emplace(*uuid, Entry { i, fingerprint(records[i]) });
+        }
+        return index;
+    }
+
+    const Entry* lookup(const Index& index, const std::optional<Uuid>& uuid)
+    {
+        if (!uuid)
+            return nullptr;
+        auto it = index.find(*uuid);
+        return it == index.end() ? nullptr : &it->second;
+    }
+
+    bool same_field(const RecordField* a, const RecordField* b)
+    {
+        if (!a || !b)
+            return a == b;
+        return a->data.size() == b->data.size()
+            && std::memcmp(a->data.data(), b->data.data(), a->data.size()) == 0;
+    }
+
+    // Whether the records have the same fields, in any order.
+    bool same_fields(const Record& a, const Record& b)
+    {
+        if (a.fields.size() != b.fields.size())
+            return false;
+        std::vector<bool> used(b.fields.size());
+        for (const auto& field : a.fields) {
+            size_t i = 0;
+            while (i < b.fields.size()
+                && (used[i] || b.fields[i].type != field.type || !same_field(&b.fields[i], &field)))
+                ++i;
+            if (i == b.fields.size())
+                return false;
+            used[i] = true;
+        }
+        return true;
+    }
+
+    // Fingerprints are only a filter: equal ones are confirmed byte for
+    // byte, so a collision cannot hide a change.
+    bool unchanged(const Record& a, uint64_t a_fingerprint, const Record& b, uint64_t b_fingerprint)
+    {
+        return a_fingerprint == b_fingerprint && same_fields(a, b);
+    }
+
+    // Call `fn(type, a_field, b_field)` once for each field type present in
+    // either record, in the order of `a` then `b`.
+    template <typename Fn>
+    void for_each_type(const Record& a, const Record& b, Fn fn)
+    {
+        std::bitset<256> seen;
+        for (const auto* record : { &a, &b }) {
+            for (const auto& field : record->fields) {
+                auto t = static_cast<uint8_t>(field.type);
+                if (seen.test(t))
+                    continue;
+                seen.set(t);
+                fn(field.type, find_field(a, field.type), find_field(b, field.type));
+            }
+        }
+    }
+
+    std::vector<FieldChange> field_changes(const Record& before, const Record& after)
+    {
+        std::vector<FieldChange> changes;
+        for_each_type(before, after, [&](RecordFieldType type, const RecordField* b, const RecordField* a) {
+            if (!same_field(b, a))
+                changes.push_back({ type, b, a });
+        });
+        return changes;
+    }
+
+    const RecordField* uuid_field(const Record& record)
+    {
+        return find_field(record, RecordFieldType::UUID);
+    }
+}
+
+std::vector<RecordChange> diff(std::span<const Record> before, std::span<const Record> after)
+{
+    using Kind = RecordChange::Kind;
+
+    auto after_index = make_index(after);
+    std::vector<bool> matched(after.size());
+    std::vector<RecordChange> changes;
+
+    for (const auto& record : before) {
+        auto uuid = record_uuid(record);
+        const auto* entry = lookup(after_index, uuid);
+        if (!entry || matched[entry->index]) {
+            changes.push_back({ Kind::removed, uuid.value_or(Uuid {}), &record, nullptr, {} });
+            continue;
+        }
+        matched[entry->index] = true;
+        const auto& other = after[entry->index];
+        if (unchanged(record, fingerprint(record), other, entry->fingerprint))
+            continue;
+        if (auto fields = field_changes(record, other); !fields.empty())
+            changes.push_back({ Kind::modified, *uuid, &record, &other, std::move(fields) });
+    }
+
+    for (size_t i = 0; i < after.size(); ++i) {
+        if (!matched[i])
+            changes.push_back({ Kind::added, record_uuid(after[i]).value_or(Uuid {}), nullptr, &after[i], {} });
+    }
+    return changes;
+}
+
+std::vector<RecordChange> diff(const Safe& before, const Safe& after)
+{
+    return diff(before.database(), after.database());
+}
+
+MergeResult merge(std::span<const Record> base, std::span<const Record> ours, std::span<const Record> theirs)
+{
+    auto base_index = make_index(base);
+    auto theirs_index = make_index(theirs);
+    std::vector<bool> seen(theirs.size());
+    MergeResult result;
+    result.records.reserve(ours.size());
+
+    auto deleted_vs_modified = [&](const Uuid& uuid, const RecordField* ours, const RecordField* theirs) {
+        result.conflicts.push_back({ uuid, RecordFieldType::END_OF_ENTRY, ours, theirs });
+    };
+
+    for (const auto& record : ours) {
+        auto uuid = record_uuid(record);
+        if (!uuid) {
+            result.records.push_back(record);
+            continue;
+        }
+        const auto* b = lookup(base_index, uuid);
+        const auto* t = lookup(theirs_index, uuid);
+        auto fp = fingerprint(record);
+
+        if (!t) {
+            if (!b) {
+                result.records.push_back(record);
+            } else if (!unchanged(base[b->index], b->fingerprint, record, fp)) {
+                deleted_vs_modified(*uuid, uuid_field(record), nullptr);
+                result.records.push_back(record);
+            }
+            continue;
+        }
+
+        seen[t->index] = true;
+        const auto& other = theirs[t->index];
+        const Record* base_record = b ? &base[b->index] : nullptr;
+        if (unchanged(other, t->fingerprint, record, fp)
+            || (b && unchanged(*base_record, b->fingerprint, other, t->fingerprint))) {
+            result.records.push_back(record);
+            continue;
+        }
+        if (b && unchanged(*base_record, b->fingerprint, record, fp)) {
+            result.records.push_back(other);
+            continue;
+        }
+
+        // Both sides changed the record: merge field by field.
+        Record merged;
+        for_each_type(record, other, [&](RecordFieldType type, const RecordField* o, const RecordField* th) {
+            const auto* bf = base_record ? find_field(*base_record, type) : nullptr;
+            const RecordField* chosen = o;
+            if (same_field(o, bf))
+                chosen = th;
+            else if (!same_field(o, th) && !same_field(th, bf))
+                result.conflicts.push_back({ *uuid, type, o, th });
+            if (chosen)
+                merged.fields.push_back(*chosen);
+        });
+        result.records.push_back(std::move(merged));
+    }
+
+    for (size_t i = 0; i < theirs.size(); ++i) {
+        if (seen[i])
+            continue;
+        auto uuid = record_uuid(theirs[i]);
+        if (!uuid)
+            continue;
+        const auto* b = lookup(base_index, uuid);
+        if (!b) {
+            result.records.push_back(theirs[i]);
+        } else if (!unchanged(base[b->index], b->fingerprint, theirs[i], theirs_index.at(*uuid).fingerprint)) {
+            deleted_vs_modified(*uuid, nullptr, uuid_field(theirs[i]));
+            result.records.push_back(theirs[i]);
+        }
+    }
+    return result;
+}
+
+MergeResult merge(const Safe& base, const Safe& ours, const Safe& theirs)
+{
+    return merge(base.database(), ours.database(), theirs.database());
+}
+
+} // namespace psafe3
@@ -0,0 +1,77 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "fields.h"
+#include "safe.h"
+
+// Record-level diff and three-way merge of safes.
+//
+// Records are matched on their UUID field with a hash join, so the cost is
+// linear in the number of records. Each record is reduced to a fingerprint
+// of its field types and data first. Records whose fingerprints differ are
+// compared field by field; equal fingerprints are confirmed by comparing
+// the fields' bytes, so a collision cannot hide a change. Field order
+// within a record and the random block padding do not affect either.
+//
+// Records without a valid UUID cannot be matched: diff reports them as
+// removed and added, and merge keeps only ours. Within a record fields are
+// matched by type; should a type repeat, only its first occurrence is
+// compared.
+//
+// Results point into the safes passed in and are only valid as long as
+// they are. Safes loaded with LoadOptions::on_demand have no materialized
+// records and compare as empty.
+
+namespace psafe3 {
+
+struct FieldChange {
+    RecordFieldType type;
+    // nullptr when the field was added or removed, respectively.
+    const RecordField* before;
+    const RecordField* after;
+};
+
+struct RecordChange {
+    enum class Kind : uint8_t { added, removed, modified };
+
+    Kind kind;
+    Uuid uuid;
+    const Record* before;
+    const Record* after;
+    // Empty unless kind == modified.
+    std::vector<FieldChange> fields;
+};
+
+// Changes from `before` to `after`: removed and modified records in the
+// order of `before`, then added records in the order of `after`.
+std::vector<RecordChange> diff(std::span<const Record> before, std::span<const Record> after);
+std::vector<RecordChange> diff(const Safe& before, const Safe& after);
+
+struct MergeConflict {
+    Uuid uuid;
+    // END_OF_ENTRY when one side deleted a record the other modified.
+    RecordFieldType type;
+    // nullptr when absent on that side.
+    const RecordField* ours;
+    const RecordField* theirs;
+};
+
+struct MergeResult {
+    // Merged database: our records in our order, then records only they
+    // added. Merged records only carry fields; their data and extent spans
+    // are empty.
+    std::vector<Record> records;
+    // Conflicts are resolved in favour of ours: our field is kept, and a
+    // record that one side deleted and the other modified is kept.
+    std::vector<MergeConflict> conflicts;
+};
+
+// Three-way merge of `ours` and `theirs`, both derived from `base`.
+MergeResult merge(std::span<const Record> base, std::span<const Record> ours, std::span<const Record> theirs);
+MergeResult merge(const Safe& base, const Safe& ours, const Safe& theirs);
+
+} // namespace psafe3
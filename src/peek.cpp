@@ -0,0 +1,167 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <new>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "executor.h"
+#include "fileio.h"
+#include "journal.h"
+#include "peek.h"
+#include "prologue.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+
+    constexpr size_t LEN_SIZE = sizeof(uint32_t);
+
+    // Larger headers are decrypted into their own mapping rather than
+    // libgcrypt's secure heap, which is small and shared by every thread.
+    constexpr size_t SECURE_HEAP_LIMIT = 4 * PEEK_SIZE;
+
+    struct Located {
+        HeaderFieldType type;
+        uint32_t len;
+        size_t offset;
+        size_t extent;
+    };
+
+} // namespace
+
+UnauthenticatedHeader::UnauthenticatedHeader(SecureBytes&& plaintext, std::vector<HeaderField>&& fields, size_t bytes_read)
+    : plaintext_(std::move(plaintext))
+    , fields_(std::move(fields))
+    , bytes_read_(bytes_read)
+{
+}
+
+std::expected<UnauthenticatedHeader, std::error_code>
+peek_header(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, const StretchOptions& options)
+{
+    if (auto err = options.interrupted(); err)
+        return std::unexpected(err);
+    if (auto err = recover_journals(path); err)
+        return std::unexpected(err);
+
+    FileDescriptor file(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!file)
+        return std::unexpected(last_system_error());
+    struct stat st;
+    if (::fstat(file.get(), &st) != 0)
+        return std::unexpected(last_system_error());
+    auto file_size = static_cast<size_t>(st.st_size);
+    if (file_size < PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE)
+        return std::unexpected(Error::corrupt_file);
+    size_t body_size = file_size - (PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE);
+    if (body_size == 0 || body_size % TWOFISH_SIZE != 0)
+        return std::unexpected(Error::corrupt_file);
+
+    std::array<std::byte, PROLOGUE_SIZE> prologue;
+    if (auto err = read_exact(file.get(), prologue, 0); err)
+        return std::unexpected(err);
+    auto keys = unlock(prologue, pass_phrase, options);
+    if (!keys)
+        return std::unexpected(keys.error());
+    auto cipher = TwofishCBC::create(keys->k.as_span(), std::span(prologue).subspan<OFFSET_IV, IV_SIZE>());
+    if (!cipher)
+        return std::unexpected(cipher.error());
+
+    // Decrypt body bytes [from, buffer.size()) into `buffer`. The chaining
+    // value carries over, so every read continues where the last stopped.
+    std::vector<std::byte> encrypted;
+    auto decrypt = [&](SecureBytes& buffer, size_t from) -> std::error_code {
+        encrypted.resize(buffer.size() - from);
+        if (auto err = read_exact(file.get(), encrypted, static_cast<off_t>(PROLOGUE_SIZE + from)); err)
+            return err;
+        return cipher->decrypt(buffer.span(from, encrypted.size()), encrypted);
+    };
+    auto allocate = [](size_t size) {
+        return size > SECURE_HEAP_LIMIT ? SecureBytes::mapped(size) : SecureBytes(size);
+    };
+
+    auto plain = allocate(std::min(body_size, PEEK_SIZE));
+    if (auto err = decrypt(plain, 0); err)
+        return std::unexpected(err);
+    auto extend = [&](size_t want) -> std::error_code {
+        if (want > body_size)
+            return Error::corrupt_file;
+        auto have = plain.size();
+        auto grown = allocate(std::min(body_size, std::max(round_up_to(want, PEEK_SIZE), 2 * have)));
+        std::memcpy(grown.data(), plain.data(), have);
+        if (auto err = decrypt(grown, have); err)
+            return err;
+        plain = std::move(grown);
+        return {};
+    };
+
+    std::vector<Located> located;
+    size_t offset = 0;
+    for (;;) {
+        if (offset + TWOFISH_SIZE > plain.size()) {
+            if (auto err = extend(offset + TWOFISH_SIZE); err)
+                return std::unexpected(err);
+        }
+        auto type = static_cast<HeaderFieldType>(plain.byte(offset + LEN_SIZE));
+        auto len = load<std::endian::little>(plain.span<LEN_SIZE>(offset));
+        auto extent = round_up_to<size_t>(size_t { len } + LEN_SIZE + 1, TWOFISH_SIZE);
+        if (extent > body_size - offset)
+            return std::unexpected(Error::corrupt_file);
+        if (type == HeaderFieldType::END_OF_ENTRY)
+            break;
+        if (offset + extent > plain.size()) {
+            if (auto err = extend(offset + extent); err)
+                return std::unexpected(err);
+        }
+        located.push_back({ type, len, offset, extent });
+        offset += extent;
+    }
+
+    std::vector<HeaderField> fields;
+    fields.reserve(located.size());
+    for (const auto& field : located) {
+        fields.push_back(HeaderField {
+            .type = field.type,
+            .len = field.len,
+            .data = plain.span(field.offset + LEN_SIZE + 1, field.len),
+            .extent = plain.span(field.offset, field.extent),
+        });
+    }
+    auto bytes_read = PROLOGUE_SIZE + plain.size();
+    return UnauthenticatedHeader(std::move(plain), std::move(fields), bytes_read);
+}
+
+std::vector<std::expected<UnauthenticatedHeader, std::error_code>>
+peek_headers(std::span<const PeekRequest> requests, const PeekOptions& options)
+{
+    std::vector<std::expected<UnauthenticatedHeader, std::error_code>> results;
+    results.reserve(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i)
+        results.emplace_back(std::unexpect, Error::cancelled);
+
+    auto& executor = options.executor ? *options.executor : default_executor();
+    executor.bulk(requests.size(), [&](size_t i) {
+        try {
+            results[i] = peek_header(requests[i].path, requests[i].pass_phrase, options.stretch);
+        } catch (const std::bad_alloc&) {
+            results[i] = std::unexpected(std::make_error_code(std::errc::not_enough_memory));
+        }
+    });
+    // Unlocking left keyed handles idle on the executor's threads.
+    drop_cached_handles();
+    return results;
+}
+
+} // namespace psafe3
@@ -0,0 +1,74 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "crypto.h"
+#include "executor.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// The header of a safe as read by peek_header().
+//
+// NOT AUTHENTICATED. The HMAC covers the whole body, so it cannot be checked
+// without reading the whole file; nothing here has been. The fields are
+// whatever decrypts from the first blocks of the file under the key the
+// pass phrase unlocks: a file truncated, corrupted or tampered with after
+// the header peeks fine. Use them for display only, and Safe::load() or
+// verify() before trusting anything in the file.
+class UnauthenticatedHeader {
+public:
+    std::span<const HeaderField> fields() const noexcept { return fields_; }
+
+    // Bytes read from the file, prologue included.
+    size_t bytes_read() const noexcept { return bytes_read_; }
+
+private:
+    friend std::expected<UnauthenticatedHeader, std::error_code>
+    peek_header(const std::filesystem::path&, std::span<const std::byte>, const StretchOptions&);
+
+    SecureBytes plaintext_;
+    std::vector<HeaderField> fields_;
+    size_t bytes_read_;
+
+    UnauthenticatedHeader(SecureBytes&& plaintext, std::vector<HeaderField>&& fields, size_t bytes_read);
+};
+
+// Body bytes read at a time by peek_header(). Most headers fit in one.
+inline constexpr size_t PEEK_SIZE = 4096;
+
+// Stretch the pass phrase and decrypt only the header of the safe at
+// `path`, reading blocks until the header's END_OF_ENTRY. See
+// UnauthenticatedHeader for what this does not check. Journals left by an
+// interrupted rekey() or Safe::save_tail() are recovered first, as by
+// Safe::load().
+std::expected<UnauthenticatedHeader, std::error_code>
+peek_header(const std::filesystem::path& path, std::span<const std::byte> pass_phrase,
+    const StretchOptions& options = {});
+
+struct PeekRequest {
+    std::filesystem::path path;
+    std::span<const std::byte> pass_phrase;
+};
+
+struct PeekOptions {
+    // Runs the peeks in parallel; default_executor() if null.
+    Executor* executor = nullptr;
+    // Applied to every key stretch. `progress` may be called from several
+    // threads at once.
+    StretchOptions stretch = {};
+};
+
+// peek_header() for every request, in parallel since each one is mostly a
+// key stretch. Results are in the order of `requests`. Handles keyed on the
+// executor's threads are dropped afterwards, see drop_cached_handles().
+std::vector<std::expected<UnauthenticatedHeader, std::error_code>>
+peek_headers(std::span<const PeekRequest> requests, const PeekOptions& options = {});
+
+} // namespace psafe3
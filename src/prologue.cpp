@@ -0,0 +1,99 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <expected>
+#include <limits>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "crypto.h"
+#include "error.h"
+#include "prologue.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+std::expected<BodyKeys, std::error_code>
+unlock(std::span<const std::byte, PROLOGUE_SIZE> prologue, std::span<const std::byte> pass_phrase,
+    const StretchOptions& options)
+{
+    if (MAGIC != prologue.subspan<MAGIC_OFFSET, MAGIC_SIZE>()) {
+        return std::unexpected(psafe3::Error::invalid_magic);
+    }
+
+    // Validate the pass phrase against the hash in the prologue.
+    auto iter = psafe3::load<std::endian::little>(prologue.subspan<ITER_OFFSET, ITER_SIZE>());
+    auto stretch_result = psafe3::stretch_key(pass_phrase, prologue.subspan<SALT_OFFSET, SALT_SIZE>(), iter, options);
+    if (!stretch_result) [[unlikely]] {
+        return std::unexpected(stretch_result.error());
+    }
+    SecureBytes key = std::move(stretch_result.value());
+    auto key_hash_calc = psafe3::sha256(key.as_span());
+    if (!key_hash_calc) [[unlikely]] {
+        return std::unexpected(key_hash_calc.error());
+    }
+    auto key_hash = key_hash_calc.value();
+    if (key_hash != prologue.subspan<PASS_HASH_OFFSET, PASS_HASH_SIZE>()) {
+        return std::unexpected(psafe3::Error::invalid_pass_phrase);
+    }
+
+    auto key_k = extract_random_key(key, prologue.subspan<OFFSET_B1, B_SIZE>(), prologue.subspan<OFFSET_B2, B_SIZE>());
+    if (!key_k) {
+        return std::unexpected(key_k.error());
+    }
+    auto key_l = extract_random_key(key, prologue.subspan<OFFSET_B3, B_SIZE>(), prologue.subspan<OFFSET_B4, B_SIZE>());
+    if (!key_l) {
+        return std::unexpected(key_l.error());
+    }
+    return BodyKeys { .k = std::move(key_k.value()), .l = std::move(key_l.value()) };
+}
+
+std::expected<Calibration, std::error_code>
+calibrate_iterations(std::chrono::milliseconds target_latency, const CalibrateOptions& options)
+{
+    using clock = std::chrono::steady_clock;
+    const std::array<std::byte, 8> pass {};
+    const std::array<std::byte, SALT_SIZE> salt {};
+
+    auto time = [&](uint32_t iterations) -> std::expected<clock::duration, std::error_code> {
+        auto start = clock::now();
+        auto key = stretch_key(pass, salt, iterations);
+        if (!key)
+            return std::unexpected(key.error());
+        return clock::now() - start;
+    };
+
+    // Warm up, and find a run long enough to time: the clock has to be
+    // well resolved and the CPU at speed.
+    uint32_t iterations = MIN_ITERATIONS;
+    auto sample_time = std::max(options.sample_time, std::chrono::milliseconds(1));
+    for (;;) {
+        auto elapsed = time(iterations);
+        if (!elapsed)
+            return std::unexpected(elapsed.error());
+        if (*elapsed >= sample_time || iterations > std::numeric_limits<uint32_t>::max() / 2)
+            break;
+        iterations *= 2;
+    }
+
+    std::vector<double> rates;
+    for (unsigned i = 0; i < std::max(options.samples, 1u); ++i) {
+        auto elapsed = time(iterations);
+        if (!elapsed)
+            return std::unexpected(elapsed.error());
+        auto seconds = std::chrono::duration<double>(*elapsed).count();
+        rates.push_back(iterations / std::max(seconds, 1e-9));
+    }
+    std::ranges::nth_element(rates, rates.begin() + rates.size() / 2);
+    double rate = rates[rates.size() / 2];
+
+    auto target = rate * std::chrono::duration<double>(target_latency).count();
+    auto recommended = static_cast<uint32_t>(std::clamp(std::round(target),
+        static_cast<double>(MIN_ITERATIONS), static_cast<double>(std::numeric_limits<uint32_t>::max())));
+    return Calibration { .iterations_per_second = rate, .iterations = recommended };
+}
+
+} // namespace psafe3
@@ -0,0 +1,112 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <span>
+#include <system_error>
+
+#include "crypto.h"
+
+// File format.
+//
+// OFF SZ NAME
+//   0  4 MAGIC
+//   4 32 SALT
+//  36  4 ITER
+//  40 32 H(P')
+//  72 16 B1
+//  88 16 B2
+// 104 16 B3
+// 120 16 B4
+// 136 16 IV
+//
+//  Field
+//   0  4 LENGTH
+//   4  1 TYPE
+//   5  * FIELD DATA
+
+namespace psafe3 {
+
+enum PROLOGUE : unsigned int {
+    MAGIC_OFFSET = 0,
+    MAGIC_SIZE = 4,
+    SALT_OFFSET = MAGIC_OFFSET + MAGIC_SIZE,
+    SALT_SIZE = 32,
+    ITER_OFFSET = SALT_OFFSET + SALT_SIZE,
+    ITER_SIZE = 4,
+    PASS_HASH_OFFSET = ITER_OFFSET + ITER_SIZE,
+    PASS_HASH_SIZE = 32,
+    OFFSET_B1 = PASS_HASH_OFFSET + PASS_HASH_SIZE,
+    B_SIZE = 16,
+    OFFSET_B2 = OFFSET_B1 + B_SIZE,
+    OFFSET_B3 = OFFSET_B2 + B_SIZE,
+    OFFSET_B4 = OFFSET_B3 + B_SIZE,
+    OFFSET_IV = OFFSET_B4 + B_SIZE,
+    IV_SIZE = 16,
+    PROLOGUE_SIZE = OFFSET_IV + IV_SIZE
+};
+
+// The smallest number of iterations the format allows.
+static constexpr uint32_t MIN_ITERATIONS = 2048;
+
+static const std::array<std::byte, MAGIC_SIZE> MAGIC = {
+    std::byte { 'P' },
+    std::byte { 'W' },
+    std::byte { 'S' },
+    std::byte { '3' },
+};
+
+static const std::array<std::byte, 16> DBEND = {
+    std::byte { 'P' },
+    std::byte { 'W' },
+    std::byte { 'S' },
+    std::byte { '3' },
+    std::byte { '-' },
+    std::byte { 'E' },
+    std::byte { 'O' },
+    std::byte { 'F' },
+    std::byte { 'P' },
+    std::byte { 'W' },
+    std::byte { 'S' },
+    std::byte { '3' },
+    std::byte { '-' },
+    std::byte { 'E' },
+    std::byte { 'O' },
+    std::byte { 'F' },
+};
+
+// The random keys wrapped by the prologue: K encrypts the body and L keys
+// the HMAC.
+struct BodyKeys {
+    SecureBytes k;
+    SecureBytes l;
+};
+
+// Validate the magic and pass phrase and unwrap K and L.
+std::expected<BodyKeys, std::error_code>
+unlock(std::span<const std::byte, PROLOGUE_SIZE> prologue, std::span<const std::byte> pass_phrase,
+    const StretchOptions& options = {});
+
+struct CalibrateOptions {
+    // Each timed run of stretch_key() lasts at least this long.
+    std::chrono::milliseconds sample_time { 50 };
+    unsigned samples = 5;
+};
+
+struct Calibration {
+    // Median over the samples.
+    double iterations_per_second;
+    // ITER for an unlock taking about the target latency on this host, at
+    // least MIN_ITERATIONS.
+    uint32_t iterations;
+};
+
+// Measure stretch_key() on this host, after a warm-up, and pick the
+// iteration count that makes stretching take `target_latency`.
+std::expected<Calibration, std::error_code>
+calibrate_iterations(std::chrono::milliseconds target_latency, const CalibrateOptions& options = {});
+
+} // namespace psafe3
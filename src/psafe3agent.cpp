@@ -0,0 +1,113 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <expected>
+#include <iostream>
+#include <optional>
+#include <stop_token>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "crypto.h"
+#include "error.h"
+#include "executor.h"
+#include "fileio.h"
+#include "safe.h"
+
+int main(int argc, char** argv)
+{
+    std::optional<std::chrono::milliseconds> idle_timeout;
+    int arg = 1;
+    if (arg < argc && std::string_view(argv[arg]).starts_with("--idle=")) {
+        char* end;
+        auto seconds = std::strtoul(argv[arg] + 7, &end, 10);
+        if (*end != '\0' || end == argv[arg] + 7) {
+            std::cerr << "Invalid idle timeout: " << argv[arg] << '\n';
+            return 2;
+        }
+        idle_timeout = std::chrono::seconds(seconds);
+        ++arg;
+    }
+    if (argc - arg < 3 || (argc - arg) % 2 != 1) {
+        std::cerr << "Usage: psafe3agent [--idle=SECONDS] <socket> <file> <password> [<file> <password>]...\n";
+        return 2;
+    }
+    const char* socket_path = argv[arg++];
+
+    // Each load is mostly a key stretch, so unlock the safes in parallel.
+    std::vector<std::expected<psafe3::Safe, std::error_code>> safes;
+    for (int i = arg; i < argc; i += 2)
+        safes.emplace_back(std::unexpect, psafe3::Error::cancelled);
+    psafe3::default_executor().bulk(safes.size(), [&](size_t i) {
+        auto* file = argv[arg + 2 * i];
+        const auto* pass = reinterpret_cast<const std::byte*>(argv[arg + 2 * i + 1]);
+        std::vector<std::byte> pass_phrase(pass, pass + std::strlen(argv[arg + 2 * i + 1]));
+        safes[i] = psafe3::Safe::load(file, std::move(pass_phrase), { .group_tree = true });
+    });
+    // The loads left keyed handles idle on the executor's threads.
+    psafe3::drop_cached_handles();
+
+    psafe3::Agent agent;
+    for (size_t i = 0; i < safes.size(); ++i) {
+        if (!safes[i]) {
+            std::cerr << "Failed: " << argv[arg + 2 * i] << ": " << safes[i].error().message() << '\n';
+            return 2;
+        }
+        agent.add(std::move(safes[i].value()));
+    }
+
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(socket_path) >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << '\n';
+        return 2;
+    }
+    std::strcpy(addr.sun_path, socket_path);
+    psafe3::FileDescriptor listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    // Nobody else may even connect; serve() checks the peer's uid too.
+    auto old_mask = ::umask(0177);
+    bool bound = listener && ::bind(listener.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    ::umask(old_mask);
+    if (!bound || ::listen(listener.get(), SOMAXCONN) != 0) {
+        std::cerr << "Failed: " << socket_path << ": " << psafe3::last_system_error().message() << '\n';
+        return 2;
+    }
+
+    // Blocked in every thread; the signal thread takes them with sigwait.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    std::stop_source stop;
+    std::jthread signal_thread([&] {
+        int sig;
+        sigwait(&signals, &sig);
+        stop.request_stop();
+    });
+
+    auto err = psafe3::serve(agent, listener.get(), { .idle_timeout = idle_timeout, .stop_token = stop.get_token() });
+    ::unlink(socket_path);
+    agent.lock();
+    // Release the signal thread if serve() stopped by itself.
+    if (!stop.stop_requested())
+        ::kill(::getpid(), SIGTERM);
+    if (err) {
+        std::cerr << "Failed: " << err.message() << '\n';
+        return 2;
+    }
+    return 0;
+}
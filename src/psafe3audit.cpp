@@ -0,0 +1,55 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstring>
+#include <iostream>
+#include <print>
+#include <string>
+#include <vector>
+
+#include "audit.h"
+#include "safe.h"
+#include "safeio.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 3 || argc % 2 != 1) {
+        std::cerr << "Usage: psafe3audit <file> <password> [<file> <password>]...\n";
+        return 2;
+    }
+
+    auto auditor = psafe3::ReuseAuditor::create();
+    if (!auditor) {
+        std::cerr << "Failed: " << auditor.error().message() << '\n';
+        return 2;
+    }
+
+    std::vector<psafe3::Safe> safes;
+    std::vector<const char*> names;
+    for (int arg = 1; arg < argc; arg += 2) {
+        const auto* pass = reinterpret_cast<const std::byte*>(argv[arg + 1]);
+        std::vector<std::byte> pass_phrase(pass, pass + std::strlen(argv[arg + 1]));
+        auto safe = psafe3::Safe::load(argv[arg], std::move(pass_phrase));
+        if (!safe) {
+            std::cerr << "Failed: " << argv[arg] << ": " << safe.error().message() << '\n';
+            return 2;
+        }
+        if (auto err = auditor->add(*safe); err) {
+            std::cerr << "Failed: " << argv[arg] << ": " << err.message() << '\n';
+            return 2;
+        }
+        safes.push_back(std::move(safe.value()));
+        names.push_back(argv[arg]);
+    }
+
+    auto reused = auditor->reused();
+    for (const auto& group : reused) {
+        std::println(std::cout, "Shared by {} records:", group.size());
+        for (const auto& occurrence : group) {
+            const auto& record = safes[occurrence.safe].database()[occurrence.record];
+            std::println(std::cout, "    {}: {}{}", names[occurrence.safe], psafe3::record_as_text(record),
+                occurrence.history ? " (history)" : "");
+        }
+    }
+
+    return reused.empty() ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <print>
+#include <string>
+#include <vector>
+
+#include "fields.h"
+#include "merge.h"
+#include "safe.h"
+#include "safeio.h"
+
+static std::vector<std::byte> pass_phrase(const char* arg)
+{
+    const auto* pass = reinterpret_cast<const std::byte*>(arg);
+    return { pass, pass + std::strlen(arg) };
+}
+
+// Passwords are never printed, only that they changed.
+static std::string field_text(const psafe3::RecordField* field)
+{
+    using psafe3::RecordFieldType;
+    if (!field)
+        return "(none)";
+    if (field->type == RecordFieldType::PASSWORD || field->type == RecordFieldType::PASSWORD_HISTORY)
+        return "(hidden)";
+    return std::format("\"{}\"", psafe3::record_field_as_text(*field));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 4 && argc != 5) {
+        std::cerr << "Usage: psafe3diff <before> <after> <password> [<after-password>]\n";
+        return 2;
+    }
+
+    auto before = psafe3::Safe::load(argv[1], pass_phrase(argv[3]));
+    if (!before) {
+        std::cerr << "Failed: " << argv[1] << ": " << before.error().message() << '\n';
+        return 2;
+    }
+    auto after = psafe3::Safe::load(argv[2], pass_phrase(argv[argc == 5 ? 4 : 3]));
+    if (!after) {
+        std::cerr << "Failed: " << argv[2] << ": " << after.error().message() << '\n';
+        return 2;
+    }
+
+    auto changes = psafe3::diff(*before, *after);
+    for (const auto& change : changes) {
+        using Kind = psafe3::RecordChange::Kind;
+        switch (change.kind) {
+        case Kind::removed:
+            std::println(std::cout, "- {}", psafe3::record_as_text(*change.before));
+            break;
+        case Kind::added:
+            std::println(std::cout, "+ {}", psafe3::record_as_text(*change.after));
+            break;
+        case Kind::modified:
+            std::println(std::cout, "~ {}", psafe3::record_as_text(*change.after));
+            for (const auto& field : change.fields) {
+                std::println(std::cout, "    type={:02x}  {} -> {}", static_cast<uint8_t>(field.type),
+                    field_text(field.before), field_text(field.after));
+            }
+            break;
+        }
+    }
+
+    return changes.empty() ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "import.h"
+#include "writer.h"
+
+// Password Safe's default.
+static constexpr uint32_t DEFAULT_ITERATIONS = 262144;
+
+static std::optional<psafe3::ImportFormat> parse_format(std::string_view name)
+{
+    if (name == "csv")
+        return psafe3::ImportFormat::csv;
+    if (name == "ndjson")
+        return psafe3::ImportFormat::ndjson;
+    return std::nullopt;
+}
+
+int main(int argc, char** argv)
+{
+    std::optional<psafe3::ImportFormat> format;
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    bool force = false;
+    int arg = 1;
+    for (; arg < argc && std::string_view(argv[arg]).starts_with("--"); ++arg) {
+        std::string_view option(argv[arg]);
+        if (option.starts_with("--format=")) {
+            format = parse_format(option.substr(std::strlen("--format=")));
+            if (!format) {
+                std::cerr << "Unknown format: " << argv[arg] << '\n';
+                return 1;
+            }
+        } else if (option.starts_with("--iterations=")) {
+            char* end;
+            auto value = std::strtoul(argv[arg] + std::strlen("--iterations="), &end, 10);
+            if (*end != '\0' || value > UINT32_MAX) {
+                std::cerr << "Invalid iterations: " << argv[arg] << '\n';
+                return 1;
+            }
+            iterations = static_cast<uint32_t>(value);
+        } else if (option == "--force") {
+            force = true;
+        } else {
+            std::cerr << "Unknown option: " << argv[arg] << '\n';
+            return 1;
+        }
+    }
+
+    if (argc - arg != 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--format=csv|ndjson] [--iterations=N] [--force] <input|-> <output> <password>\n";
+        return 1;
+    }
+    std::string_view input(argv[arg]);
+    if (!format) {
+        bool json = input.ends_with(".ndjson") || input.ends_with(".jsonl") || input.ends_with(".json");
+        format = json ? psafe3::ImportFormat::ndjson : psafe3::ImportFormat::csv;
+    }
+
+    std::ifstream file;
+    if (input != "-") {
+        file.open(argv[arg], std::ios::binary);
+        if (!file) {
+            std::cerr << "Failed: cannot open " << input << '\n';
+            return 1;
+        }
+    }
+    std::istream& in = input == "-" ? std::cin : file;
+
+    const auto* pass = reinterpret_cast<const std::byte*>(argv[arg + 2]);
+    std::vector<std::byte> pass_phrase(pass, pass + std::strlen(argv[arg + 2]));
+    auto writer = psafe3::SafeWriter::create(argv[arg + 1], pass_phrase, iterations, {}, force);
+    if (!writer && writer.error() == std::errc::file_exists) {
+        std::cerr << "Failed: " << argv[arg + 1] << " exists; use --force to replace it\n";
+        return 1;
+    }
+    if (!writer) {
+        std::cerr << "Failed: " << writer.error().message() << '\n';
+        return 1;
+    }
+
+    psafe3::RecordImporter importer(*format);
+    auto records = importer.run(in, writer->body());
+    if (!records) {
+        std::cerr << "Failed: " << input << ":" << importer.line() << ": " << records.error().message() << '\n';
+        return 1;
+    }
+    if (auto committed = writer->commit(); !committed) {
+        std::cerr << "Failed: " << committed.error().message() << '\n';
+        return 1;
+    }
+    std::cout << "Imported " << *records << " records\n";
+    return 0;
+}
@@ -1,23 +1,83 @@
 // https://github.com/marcbutler/libpsafe3/LICENSE
 
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <optional>
+#include <string_view>
 #include <vector>
 
-#include "safe.h"
+#include "prologue.h"
+#include "verify.h"
+
+static std::optional<psafe3::VerifyLevel> parse_level(std::string_view name)
+{
+    if (name == "passphrase")
+        return psafe3::VerifyLevel::passphrase;
+    if (name == "integrity")
+        return psafe3::VerifyLevel::integrity;
+    if (name == "full")
+        return psafe3::VerifyLevel::full;
+    return std::nullopt;
+}
+
+// Report the stretch rate of this host and the ITER it takes to spend
+// `arg` (milliseconds, default 1000) unlocking a safe.
+static int calibrate(std::string_view arg)
+{
+    unsigned long ms = 1000;
+    if (!arg.empty()) {
+        char* end;
+        ms = std::strtoul(arg.data(), &end, 10);
+        if (*end != '\0') {
+            std::cerr << "Invalid latency: " << arg << '\n';
+            return 1;
+        }
+    }
+    auto result = psafe3::calibrate_iterations(std::chrono::milliseconds(ms));
+    if (!result) {
+        std::cerr << "Failed: " << result.error().message() << '\n';
+        return 1;
+    }
+    std::cout << static_cast<uint64_t>(result->iterations_per_second) << " iterations/s\n"
+              << "ITER " << result->iterations << " for " << ms << " ms\n";
+    return 0;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <file> <password>\n";
+    if (argc == 2 && std::string_view(argv[1]).starts_with("--calibrate")) {
+        std::string_view option(argv[1]);
+        if (option == "--calibrate")
+            return calibrate({});
+        if (option.starts_with("--calibrate="))
+            return calibrate(option.substr(std::strlen("--calibrate=")));
+    }
+
+    auto level = psafe3::VerifyLevel::full;
+    int arg = 1;
+    if (argc > 1 && std::string_view(argv[1]).starts_with("--level=")) {
+        auto parsed = parse_level(std::string_view(argv[1]).substr(std::strlen("--level=")));
+        if (!parsed) {
+            std::cerr << "Unknown level: " << argv[1] << '\n';
+            return 1;
+        }
+        level = *parsed;
+        ++arg;
+    }
+
+    if (argc - arg != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--level=passphrase|integrity|full] <file> <password>\n"
+                  << "       " << argv[0] << " --calibrate[=MILLISECONDS]\n";
         return 1;
     }
 
-    const auto* pass = reinterpret_cast<const std::byte*>(argv[2]);
-    std::vector<std::byte> pass_phrase(pass, pass + std::strlen(argv[2]));
+    const auto* pass = reinterpret_cast<const std::byte*>(argv[arg + 1]);
+    std::vector<std::byte> pass_phrase(pass, pass + std::strlen(argv[arg + 1]));
 
-    auto safe_path = std::filesystem::path(argv[1]);
-    auto result = psafe3::Safe::load(safe_path, std::move(pass_phrase));
+    auto safe_path = std::filesystem::path(argv[arg]);
+    auto result = psafe3::verify(safe_path, pass_phrase, level);
     if (!result) {
         std::cerr << "Failed: " << result.error().message() << '\n';
         return 1;
@@ -0,0 +1,166 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "fileio.h"
+#include "journal.h"
+#include "prologue.h"
+#include "safe.h"
+#include "utility.h"
+
+// Rekeying rewrites bytes SALT_OFFSET..OFFSET_IV of the prologue. Before
+// touching the safe the original and the new prologue, followed by their
+// SHA-256, are written to "<safe>.rekey" and synced; the journal is removed
+// once the new prologue is durable. A journal whose checksum verifies means
+// the safe may hold a torn prologue. If the safe holds either prologue whole
+// it is left alone, as Safe::load() accepts it as it is; only a prologue
+// that is neither is rolled back to the original. Safe::load(), verify()
+// and peek_header() recover the same way before reading the safe.
+
+namespace psafe3 {
+
+namespace {
+
+    constexpr size_t JOURNAL_SIZE = 2 * PROLOGUE_SIZE + SHA256_SIZE;
+
+    std::error_code write_journal(const std::filesystem::path& path,
+        std::span<const std::byte, PROLOGUE_SIZE> original, std::span<const std::byte, PROLOGUE_SIZE> updated)
+    {
+        std::array<std::byte, JOURNAL_SIZE> journal;
+        std::memcpy(journal.data(), original.data(), PROLOGUE_SIZE);
+        std::memcpy(journal.data() + PROLOGUE_SIZE, updated.data(), PROLOGUE_SIZE);
+        auto hash = sha256(std::span(journal).first<2 * PROLOGUE_SIZE>());
+        if (!hash)
+            return hash.error();
+        std::memcpy(journal.data() + 2 * PROLOGUE_SIZE, hash->data(), SHA256_SIZE);
+
+        auto journal_file = rekey_journal_path(path);
+        FileDescriptor j(::open(journal_file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+        if (!j)
+            return last_system_error();
+        if (auto err = write_exact(j.get(), journal, 0); err)
+            return err;
+        if (::fsync(j.get()) != 0)
+            return last_system_error();
+        return sync_directory(path);
+    }
+
+} // namespace
+
+std::error_code recover_rekey(int fd, const std::filesystem::path& path)
+{
+    auto journal = rekey_journal_path(path);
+    FileDescriptor j(::open(journal.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!j)
+        return errno == ENOENT ? std::error_code {} : last_system_error();
+
+    std::array<std::byte, JOURNAL_SIZE> saved;
+    bool complete = !read_exact(j.get(), saved, 0);
+    if (complete) {
+        auto prologues = std::span<const std::byte, JOURNAL_SIZE>(saved).first<2 * PROLOGUE_SIZE>();
+        auto hash = sha256(prologues);
+        if (!hash)
+            return hash.error();
+        complete = *hash == std::span<const std::byte, JOURNAL_SIZE>(saved).last<SHA256_SIZE>();
+    }
+    // An incomplete journal was never followed by a write to the safe.
+    if (complete) {
+        auto original = std::span(saved).first<PROLOGUE_SIZE>();
+        auto updated = std::span(saved).subspan<PROLOGUE_SIZE, PROLOGUE_SIZE>();
+        std::array<std::byte, PROLOGUE_SIZE> current;
+        if (auto err = read_exact(fd, current, 0); err)
+            return err;
+        bool torn = !std::ranges::equal(current, original) && !std::ranges::equal(current, updated);
+        if (torn) {
+            if (auto err = write_exact(fd, original, 0); err)
+                return err;
+            if (::fdatasync(fd) != 0)
+                return last_system_error();
+        }
+    }
+    if (::unlink(journal.c_str()) != 0)
+        return last_system_error();
+    return sync_directory(path);
+}
+
+std::expected<void, std::error_code>
+rekey(const std::filesystem::path& path,
+    std::span<const std::byte> old_pass_phrase,
+    std::span<const std::byte> new_pass_phrase,
+    uint32_t iterations)
+{
+    if (iterations < MIN_ITERATIONS)
+        return std::unexpected(Error::invalid_iterations);
+
+    FileDescriptor file(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (!file)
+        return std::unexpected(last_system_error());
+    // Serialize with other rekeys of the same file; released on close.
+    if (::flock(file.get(), LOCK_EX) != 0)
+        return std::unexpected(last_system_error());
+    if (auto err = recover_rekey(file.get(), path); err)
+        return std::unexpected(err);
+
+    struct stat st;
+    if (::fstat(file.get(), &st) != 0)
+        return std::unexpected(last_system_error());
+    if (static_cast<size_t>(st.st_size) < PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE)
+        return std::unexpected(Error::corrupt_file);
+
+    std::array<std::byte, PROLOGUE_SIZE> prologue;
+    if (auto err = read_exact(file.get(), prologue, 0); err)
+        return std::unexpected(err);
+    auto keys = unlock(prologue, old_pass_phrase);
+    if (!keys)
+        return std::unexpected(keys.error());
+
+    std::array<std::byte, PROLOGUE_SIZE> updated = prologue;
+    auto salt = std::span(updated).subspan<SALT_OFFSET, SALT_SIZE>();
+    gcry_randomize(salt.data(), salt.size(), GCRY_STRONG_RANDOM);
+    store<std::endian::little>(std::span(updated).subspan<ITER_OFFSET, ITER_SIZE>(), iterations);
+
+    auto stretched = stretch_key(new_pass_phrase, salt, iterations);
+    if (!stretched)
+        return std::unexpected(stretched.error());
+    auto key_hash = sha256(stretched->as_span());
+    if (!key_hash)
+        return std::unexpected(key_hash.error());
+    auto wrapped_k = wrap_random_key(*stretched, keys->k);
+    if (!wrapped_k)
+        return std::unexpected(wrapped_k.error());
+    auto wrapped_l = wrap_random_key(*stretched, keys->l);
+    if (!wrapped_l)
+        return std::unexpected(wrapped_l.error());
+    std::memcpy(updated.data() + PASS_HASH_OFFSET, key_hash->data(), PASS_HASH_SIZE);
+    std::memcpy(updated.data() + OFFSET_B1, wrapped_k->data(), 2 * B_SIZE);
+    std::memcpy(updated.data() + OFFSET_B3, wrapped_l->data(), 2 * B_SIZE);
+
+    if (auto err = write_journal(path, prologue, updated); err)
+        return std::unexpected(err);
+    auto changed = std::span<const std::byte>(updated).subspan(SALT_OFFSET, OFFSET_IV - SALT_OFFSET);
+    if (auto err = write_exact(file.get(), changed, SALT_OFFSET); err)
+        return std::unexpected(err);
+    if (::fdatasync(file.get()) != 0)
+        return std::unexpected(last_system_error());
+    if (::unlink(rekey_journal_path(path).c_str()) != 0)
+        return std::unexpected(last_system_error());
+    if (auto err = sync_directory(path); err)
+        return std::unexpected(err);
+    return {};
+}
+
+} // namespace psafe3
@@ -1,178 +1,322 @@
 // https://github.com/marcbutler/libpsafe3/LICENSE
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <bitset>
+#include <cerrno>
+#include <cstring>
 #include <expected>
+#include <filesystem>
+#include <list>
+#include <mutex>
 #include <span>
 #include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "crypto.h"
+#include "domains.h"
 #include "error.h"
+#include "executor.h"
+#include "fileio.h"
 #include "gcrypt.h"
+#include "groups.h"
 #include "handle.h"
+#include "journal.h"
 #include "mapped.h"
+#include "prologue.h"
 #include "safe.h"
+#include "scan.h"
+#include "utf8.h"
 #include "utility.h"
+#include "view.h"
+#include "writer.h"
 
-// File format.
-//
-// OFF SZ NAME
-//   0  4 MAGIC
-//   4 32 SALT
-//  36  4 ITER
-//  40 32 H(P')
-//  72 16 B1
-//  88 16 B2
-// 104 16 B3
-// 120 16 B4
-// 136 16 IV
-//
-//  Field
-//   0  4 LENGTH
-//   4  1 TYPE
-//   5  * FIELD DATA
+namespace psafe3 {
 
 namespace {
-enum PROLOGUE : unsigned int {
-    MAGIC_OFFSET = 0,
-    MAGIC_SIZE = 4,
-    SALT_OFFSET = MAGIC_OFFSET + MAGIC_SIZE,
-    SALT_SIZE = 32,
-    ITER_OFFSET = SALT_OFFSET + SALT_SIZE,
-    ITER_SIZE = 4,
-    PASS_HASH_OFFSET = ITER_OFFSET + ITER_SIZE,
-    PASS_HASH_SIZE = 32,
-    OFFSET_B1 = PASS_HASH_OFFSET + PASS_HASH_SIZE,
-    B_SIZE = 16,
-    OFFSET_B2 = OFFSET_B1 + B_SIZE,
-    OFFSET_B3 = OFFSET_B2 + B_SIZE,
-    OFFSET_B4 = OFFSET_B3 + B_SIZE,
-    OFFSET_IV = OFFSET_B4 + B_SIZE,
-    IV_SIZE = 16,
-    PROLOGUE_SIZE = OFFSET_IV + IV_SIZE
-};
 
-static const std::array<std::byte, MAGIC_SIZE> MAGIC = {
-    std::byte { 'P' },
-    std::byte { 'W' },
-    std::byte { 'S' },
-    std::byte { '3' },
-};
+    constexpr size_t LEN_SIZE = sizeof(std::uint32_t);
 
-static const std::array<std::byte, 16> DBEND = {
-    std::byte { 'P' },
-    std::byte { 'W' },
-    std::byte { 'S' },
-    std::byte { '3' },
-    std::byte { '-' },
-    std::byte { 'E' },
-    std::byte { 'O' },
-    std::byte { 'F' },
-    std::byte { 'P' },
-    std::byte { 'W' },
-    std::byte { 'S' },
-    std::byte { '3' },
-    std::byte { '-' },
-    std::byte { 'E' },
-    std::byte { 'O' },
-    std::byte { 'F' },
-};
+    // How many records or fields to process between checks for
+    // cancellation and the deadline.
+    constexpr size_t INTERRUPT_INTERVAL = 4096;
 
-} // namespace
+    // Parse the fields of one entry starting at `offset`, leaving `offset`
+    // just past its END_OF_ENTRY. Only fields whose type is in `keep` are
+    // added to `fields`; the data of the others is wiped after the HMAC has
+    // seen it if `wipe` is set. Kept text fields are checked for UTF-8 if
+    // `validate` is set.
+    template <typename E>
+    std::error_code parse_entry(std::span<std::byte> plain, size_t& offset,
+        std::vector<Field<E>>& fields, SHA256HMA* hmac,
+        const std::bitset<256>& keep, bool wipe, bool validate)
+    {
+        while (offset < plain.size()) {
+            if (plain.size() - offset < LEN_SIZE + 1)
+                return Error::corrupt_file;
+            const auto field_type = static_cast<E>(plain[offset + LEN_SIZE]);
+            auto field_size = psafe3::load<std::endian::little>(std::span<const std::byte, LEN_SIZE>(plain.subspan(offset, LEN_SIZE)));
+            auto block_size = round_up_to<size_t>(size_t { field_size } + LEN_SIZE + 1, TWOFISH_SIZE);
+            if (block_size > plain.size() - offset)
+                return Error::corrupt_file;
+            if (field_type != E::END_OF_ENTRY) {
+                auto data = plain.subspan(offset + LEN_SIZE + 1, field_size);
+                if (hmac)
+                    hmac->write(data);
+                if (keep.test(static_cast<uint8_t>(field_type))) {
+                    fields.push_back(Field<E> {
+                        .type = field_type,
+                        .len = field_size,
+                        .data = data,
+                        .extent = plain.subspan(offset, block_size),
+                    });
+                    if (validate && is_text(field_type))
+                        check_utf8(fields.back());
+                } else if (wipe) {
+                    explicit_bzero(data.data(), data.size());
+                }
+            }
+            offset += block_size;
+            if (field_type == E::END_OF_ENTRY)
+                break;
+        }
+        return {};
+    }
 
-namespace psafe3 {
+    // CBC decryption of one block needs only the ciphertext block before
+    // it, so large bodies are split into chunks decrypted in parallel.
+    constexpr size_t DECRYPT_CHUNK = 1024 * 1024;
 
-std::expected<SecureBytes, std::error_code>
-extract_random_key(const SecureBytes& pass, std::span<const std::byte, TWOFISH_SIZE> block1, std::span<const std::byte, TWOFISH_SIZE> block2)
-{
-    psafe3::Handle<gcry_cipher_hd_t, gcry_cipher_close> cipher;
-    gcry_error_t err;
-    err = gcry_cipher_open(&cipher.actual, GCRY_CIPHER_TWOFISH, GCRY_CIPHER_MODE_ECB,
-        GCRY_CIPHER_SECURE);
-    if (err) {
-        return std::unexpected(make_error_code(err));
+    std::error_code decrypt_body(std::span<std::byte> out, std::span<const std::byte> in, const SecureBytes& key_k,
+        std::span<const std::byte, TWOFISH_SIZE> iv, Executor& executor)
+    {
+        size_t chunks = (in.size() + DECRYPT_CHUNK - 1) / DECRYPT_CHUNK;
+        if (chunks < 2 || executor.concurrency() < 2) {
+            auto cipher = TwofishCBC::create(key_k.as_span(), iv);
+            if (!cipher)
+                return cipher.error();
+            return cipher->decrypt(out, in);
+        }
+
+        std::vector<std::error_code> errors(chunks);
+        executor.bulk(chunks, [&](size_t chunk) {
+            auto offset = chunk * DECRYPT_CHUNK;
+            auto size = std::min(DECRYPT_CHUNK, in.size() - offset);
+            auto chain = offset == 0 ? iv : in.subspan(offset - TWOFISH_SIZE).first<TWOFISH_SIZE>();
+            auto cipher = TwofishCBC::create(key_k.as_span(), chain);
+            if (!cipher) {
+                errors[chunk] = cipher.error();
+                return;
+            }
+            errors[chunk] = cipher->decrypt(out.subspan(offset, size), in.subspan(offset, size));
+            // Keyed with K on a thread that may outlive this load.
+            cipher->close();
+        });
+        for (auto err : errors) {
+            if (err)
+                return err;
+        }
+        return {};
+    }
+
+    // Undo journal of save_tail(), "<safe>.tail": the offset the rewrite
+    // starts at and the size of the file, both 64-bit little endian, the
+    // original bytes from that offset to the end, then the SHA-256 of all
+    // of it. It is synced before the safe is touched and removed once the
+    // new tail is durable, so a journal whose checksum verifies means the
+    // safe may hold a torn tail.
+    constexpr size_t TAIL_JOURNAL_HEADER = 16;
+
+    std::error_code write_tail_journal(int fd, const std::filesystem::path& path, size_t start, size_t size)
+    {
+        std::vector<std::byte> journal(TAIL_JOURNAL_HEADER + (size - start) + SHA256_SIZE);
+        store<std::endian::little>(std::span(journal).first<8>(), uint64_t { start });
+        store<std::endian::little>(std::span(journal).subspan<8, 8>(), uint64_t { size });
+        auto original = std::span(journal).subspan(TAIL_JOURNAL_HEADER, size - start);
+        if (auto err = read_exact(fd, original, static_cast<off_t>(start)); err)
+            return err;
+        auto hash = sha256(std::span(journal).first(journal.size() - SHA256_SIZE));
+        if (!hash)
+            return hash.error();
+        std::memcpy(journal.data() + journal.size() - SHA256_SIZE, hash->data(), SHA256_SIZE);
+
+        auto journal_file = tail_journal_path(path);
+        FileDescriptor j(::open(journal_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+        if (!j)
+            return last_system_error();
+        if (auto err = write_exact(j.get(), journal, 0); err)
+            return err;
+        if (::fsync(j.get()) != 0)
+            return last_system_error();
+        return sync_directory(path);
     }
 
-    assert(pass.size() == SHA256_SIZE);
-    err = gcry_cipher_setkey(cipher(), pass.data(), SHA256_SIZE);
-    if (err) {
-        return std::unexpected(make_error_code(err));
+} // namespace
+
+std::error_code recover_tail(int fd, const std::filesystem::path& path)
+{
+    auto journal_file = tail_journal_path(path);
+    FileDescriptor j(::open(journal_file.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!j)
+        return errno == ENOENT ? std::error_code {} : last_system_error();
+
+    struct stat st;
+    if (::fstat(j.get(), &st) != 0)
+        return last_system_error();
+    std::vector<std::byte> journal(static_cast<size_t>(st.st_size));
+    bool complete = journal.size() >= TAIL_JOURNAL_HEADER + SHA256_SIZE && !read_exact(j.get(), journal, 0);
+    size_t start = 0;
+    size_t size = 0;
+    if (complete) {
+        start = load<std::endian::little>(std::span<const std::byte>(journal).first<8>());
+        size = load<std::endian::little>(std::span<const std::byte>(journal).subspan<8, 8>());
+        complete = start <= size && size - start == journal.size() - TAIL_JOURNAL_HEADER - SHA256_SIZE;
+    }
+    if (complete) {
+        auto hash = sha256(std::span(journal).first(journal.size() - SHA256_SIZE));
+        if (!hash)
+            return hash.error();
+        complete = std::ranges::equal(*hash, std::span(journal).last<SHA256_SIZE>());
     }
+    // An incomplete journal was never followed by a write to the safe.
+    if (complete) {
+        auto original = std::span<const std::byte>(journal).subspan(TAIL_JOURNAL_HEADER, size - start);
+        if (auto err = write_exact(fd, original, static_cast<off_t>(start)); err)
+            return err;
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0 || ::fdatasync(fd) != 0)
+            return last_system_error();
+    }
+    if (::unlink(journal_file.c_str()) != 0)
+        return last_system_error();
+    return sync_directory(path);
+}
+
+std::error_code recover_journals(const std::filesystem::path& path)
+{
+    bool rekey = ::access(rekey_journal_path(path).c_str(), F_OK) == 0;
+    if (!rekey && errno != ENOENT)
+        return last_system_error();
+    bool tail = ::access(tail_journal_path(path).c_str(), F_OK) == 0;
+    if (!tail && errno != ENOENT)
+        return last_system_error();
+    if (!rekey && !tail)
+        return {};
+    FileDescriptor file(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (!file)
+        return last_system_error();
+    if (::flock(file.get(), LOCK_EX) != 0)
+        return last_system_error();
+    if (auto err = recover_rekey(file.get(), path); err)
+        return err;
+    return recover_tail(file.get(), path);
+}
+
+// State kept for save_tail(). Checkpoints are ordered by record.
+struct Safe::TailState {
+    struct Checkpoint {
+        size_t record;
+        SHA256HMA hmac;
+    };
 
-    SecureBytes random_key(2 * TWOFISH_SIZE);
-    gcry_cipher_decrypt(cipher(), random_key.data(), TWOFISH_SIZE, block1.data(), TWOFISH_SIZE);
-    gcry_cipher_reset(cipher());
-    gcry_cipher_decrypt(cipher(), random_key.data(TWOFISH_SIZE), TWOFISH_SIZE, block2.data(),
-        TWOFISH_SIZE);
-    return std::move(random_key);
+    SecureBytes key_k;
+    std::array<std::byte, PROLOGUE_SIZE> prologue;
+    size_t file_size;
+    std::vector<Checkpoint> checkpoints;
+};
+
+// State for records decrypted by fetch().
+struct Safe::OnDemandState {
+    struct Location {
+        size_t offset;
+        size_t size;
+    };
+    struct CachedRecord {
+        SecureBytes plaintext;
+        Record record;
+    };
+    using Lru = std::list<size_t>;
+
+    SecureBytes key_k;
+    std::vector<Location> records;
+    size_t budget;
+    std::bitset<256> record_fields;
+    bool wipe;
+    bool validate_utf8;
+
+    std::mutex mutex {};
+    Lru lru {}; // Most recently used first.
+    std::unordered_map<size_t, std::pair<std::shared_ptr<CachedRecord>, Lru::iterator>> cache {};
+    size_t cached_bytes = 0;
+};
+
+Safe::Safe(MappedMemory&& ondisk, SecureBytes&& decrypted,
+    std::vector<HeaderField>&& header, std::vector<Record>&& database)
+    : ondisk_(std::move(ondisk))
+    , decrypted_(std::move(decrypted))
+    , header_(std::move(header))
+    , database_(std::move(database))
+{
 }
 
+Safe::~Safe() = default;
+Safe::Safe(Safe&&) noexcept = default;
+Safe& Safe::operator=(Safe&&) noexcept = default;
+
 std::expected<Safe, std::error_code>
 Safe::load(const std::filesystem::path& path,
-    const std::vector<std::byte> pass_phrase)
+    const std::vector<std::byte> pass_phrase,
+    const LoadOptions& options)
 {
+    // Refuse combinations that cannot work before paying for the stretch.
+    // save_tail() replays the HMAC over the materialized fields.
+    if (options.checkpoint_interval > 0 && !options.record_fields.all())
+        return std::unexpected(Error::unsupported_options);
+    if (options.on_demand
+        && (options.checkpoint_interval > 0 || options.release_mapping || options.group_tree
+            || options.domain_index))
+        return std::unexpected(Error::unsupported_options);
+
+    if (auto err = options.stretch.interrupted(); err)
+        return std::unexpected(err);
+    if (auto err = recover_journals(path); err)
+        return std::unexpected(err);
+
     auto mapped_file = MappedFile::open(path, MemoryAccess::Read);
     if (!mapped_file) {
         return std::unexpected(mapped_file.error());
     }
     auto& contents = mapped_file.value();
-    if (MAGIC != contents.slice<MAGIC.size()>(PROLOGUE::MAGIC_OFFSET)) {
-        return std::unexpected(psafe3::Error::invalid_magic);
-    }
-
-    // Validate the pass phrase against the hash in the prologue.
-    auto iter = psafe3::load<std::endian::little>(contents.slice<PROLOGUE::ITER_SIZE>(PROLOGUE::ITER_OFFSET));
-    auto stretch_result = psafe3::stretch_key(pass_phrase, contents.slice<PROLOGUE::SALT_SIZE>(PROLOGUE::SALT_OFFSET), iter);
-    if (!stretch_result) [[unlikely]] {
-        return std::unexpected(stretch_result.error());
-    }
-    SecureBytes key = std::move(stretch_result.value());
-    auto key_hash_calc = psafe3::sha256(key.as_span());
-    if (!key_hash_calc) [[unlikely]] {
-        return std::unexpected(key_hash_calc.error());
-    }
-    auto key_hash = key_hash_calc.value();
-    if (key_hash != contents.slice<PROLOGUE::PASS_HASH_SIZE>(PROLOGUE::PASS_HASH_OFFSET)) {
-        return std::unexpected(psafe3::Error::invalid_pass_phrase);
+    if (contents.size() < PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE) {
+        return std::unexpected(psafe3::Error::corrupt_file);
     }
 
-    // Decrypt and verify database.
-    gcry_error_t err;
-
-    auto key_k_tmp = extract_random_key(key, contents.slice<PROLOGUE::B_SIZE>(PROLOGUE::OFFSET_B1),
-        contents.slice<PROLOGUE::B_SIZE>(PROLOGUE::OFFSET_B2));
-    if (!key_k_tmp) {
-        return std::unexpected(key_k_tmp.error());
-    }
-    auto key_k = std::move(key_k_tmp.value());
-    psafe3::Handle<gcry_cipher_hd_t, gcry_cipher_close> cipher;
-    err = gcry_cipher_open(&cipher.actual, GCRY_CIPHER_TWOFISH,
-        GCRY_CIPHER_MODE_CBC, GCRY_CIPHER_SECURE);
-    if (err) {
-        return std::unexpected(make_error_code(err));
-    }
-    err = gcry_cipher_setkey(cipher(), key_k.data(), SHA256_SIZE);
-    if (err) {
-        return std::unexpected(make_error_code(err));
+    auto keys = psafe3::unlock(contents.slice<PROLOGUE_SIZE>(0), pass_phrase, options.stretch);
+    if (!keys) {
+        return std::unexpected(keys.error());
     }
-    err = gcry_cipher_setiv(cipher(), contents.slice(PROLOGUE::OFFSET_IV, PROLOGUE::IV_SIZE).data(), TWOFISH_SIZE);
+    if (auto err = options.stretch.interrupted(); err)
+        return std::unexpected(err);
+    auto key_k = std::move(keys->k);
+    auto key_l = std::move(keys->l);
 
-    auto key_l_tmp = extract_random_key(key, contents.slice<PROLOGUE::B_SIZE>(PROLOGUE::OFFSET_B3),
-        contents.slice<PROLOGUE::B_SIZE>(PROLOGUE::OFFSET_B4));
-    if (!key_l_tmp) {
-        return std::unexpected(key_l_tmp.error());
-    }
-    auto key_l = std::move(key_l_tmp.value());
+    if (options.on_demand)
+        return load_on_demand(std::move(contents), std::move(key_k), key_l, options);
 
+    // Decrypt and verify database.
     auto encrypted = contents.slice(PROLOGUE_SIZE, contents.size() - (PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE));
     assert(encrypted.size() > 0 && (encrypted.size() % TWOFISH_SIZE == 0));
-    SecureBytes decrypted(encrypted.size());
-
-    size_t offset = 0;
-    // Decrypted header fields.
-    while (offset < encrypted.size()) {
-        err = gcry_cipher_decrypt(cipher(), decrypted.data(offset), TWOFISH_SIZE,
-            encrypted.subspan(offset, TWOFISH_SIZE).data(), TWOFISH_SIZE);
-        offset += TWOFISH_SIZE;
+    auto decrypted = options.release_mapping ? SecureBytes::mapped(encrypted.size()) : SecureBytes(encrypted.size());
+    if (auto err = decrypt_body(decrypted.as_span(), encrypted, key_k, contents.slice<PROLOGUE::IV_SIZE>(PROLOGUE::OFFSET_IV),
+            options.executor ? *options.executor : default_executor());
+        err) {
+        return std::unexpected(err);
     }
 
     size_t epilogue_offset = PROLOGUE_SIZE + encrypted.size();
@@ -185,65 +329,224 @@ Safe::load(const std::filesystem::path& path,
         return std::unexpected(hmac_result.error());
     auto hmac = std::move(hmac_result.value());
 
-    auto const LEN_SIZE = sizeof(std::uint32_t);
-    std::vector<HeaderField> header;
-    offset = 0;
-    while (offset < decrypted.size()) {
-        const auto field_type = static_cast<HeaderFieldType>(decrypted.byte(offset + LEN_SIZE));
-        auto field_size = psafe3::load<std::endian::little>(decrypted.span<LEN_SIZE>(offset));
-        auto data_size = field_size + LEN_SIZE + 1;
-        auto block_size = round_up_to(data_size, TWOFISH_SIZE);
-        if (field_type != HeaderFieldType::END_OF_ENTRY) {
-            hmac.write(decrypted.span(offset + LEN_SIZE + 1, field_size));
-            header.push_back(HeaderField {
-                .type = field_type,
-                .len = field_size,
-                .data = decrypted.span(offset + LEN_SIZE + 1, field_size),
-                .extent = decrypted.span(offset, block_size),
-            });
-        }
-        offset += block_size;
-        if (field_type == HeaderFieldType::END_OF_ENTRY)
-            break;
+    std::unique_ptr<TailState> tail;
+    if (options.checkpoint_interval > 0) {
+        tail = std::make_unique<TailState>(TailState {
+            .key_k = std::move(key_k),
+            .prologue = {},
+            .file_size = contents.size(),
+            .checkpoints = {},
+        });
+        std::ranges::copy(contents.slice<PROLOGUE_SIZE>(0), tail->prologue.begin());
     }
+    size_t last_checkpoint = 0;
+    auto checkpoint = [&](size_t record, size_t offset) -> std::error_code {
+        if (!tail)
+            return {};
+        if (!tail->checkpoints.empty() && tail->checkpoints.back().record == record)
+            return {};
+        auto state = hmac.clone();
+        if (!state)
+            return state.error();
+        tail->checkpoints.push_back({ .record = record, .hmac = std::move(state.value()) });
+        last_checkpoint = offset;
+        return {};
+    };
+
+    std::vector<HeaderField> header;
+    size_t offset = 0;
+    if (auto err = parse_entry(decrypted.as_span(), offset, header, &hmac, options.header_fields, options.wipe_unprojected, options.validate_utf8); err)
+        return std::unexpected(err);
+
     std::vector<Record> database;
     while (offset < decrypted.size()) {
         if (decrypted.span<TWOFISH_SIZE>(offset) == DBEND) {
             offset += TWOFISH_SIZE;
             break;
         }
+        if (database.size() % INTERRUPT_INTERVAL == INTERRUPT_INTERVAL - 1) {
+            if (auto err = options.stretch.interrupted(); err)
+                return std::unexpected(err);
+        }
+        if (database.empty() || offset - last_checkpoint >= options.checkpoint_interval) {
+            if (auto err = checkpoint(database.size(), offset); err)
+                return std::unexpected(err);
+        }
         Record record;
         size_t record_start = offset;
-        while (offset < decrypted.size()) {
-            const auto field_type = static_cast<RecordFieldType>(decrypted.byte(offset + LEN_SIZE));
-            auto field_size = psafe3::load<std::endian::little>(decrypted.span<LEN_SIZE>(offset));
-            auto data_size = field_size + LEN_SIZE + 1;
-            auto block_size = round_up_to(data_size, TWOFISH_SIZE);
-            if (field_type != RecordFieldType::END_OF_ENTRY) {
-                hmac.write(decrypted.span(offset + LEN_SIZE + 1, field_size));
-                record.fields.push_back(RecordField {
-                    .type = field_type,
-                    .len = field_size,
-                    .data = decrypted.span(offset + LEN_SIZE + 1, field_size),
-                    .extent = decrypted.span(offset, block_size),
-                });
-            }
-            offset += block_size;
-            if (field_type == RecordFieldType::END_OF_ENTRY)
-                break;
-        }
+        if (auto err = parse_entry(decrypted.as_span(), offset, record.fields, &hmac, options.record_fields, options.wipe_unprojected, options.validate_utf8); err)
+            return std::unexpected(err);
         record.data = decrypted.span(record_start, offset - record_start);
         record.extent = record.data;
         database.push_back(std::move(record));
     }
 
+    // Appending records resumes from the end.
+    if (auto err = checkpoint(database.size(), offset); err)
+        return std::unexpected(err);
+
     auto computed_hmac = hmac.finish();
     if (!computed_hmac)
         return std::unexpected(computed_hmac.error());
     if (*computed_hmac != contents.slice<SHA256_SIZE>(epilogue_offset + TWOFISH_SIZE))
         return std::unexpected(psafe3::Error::hmac_mismatch);
 
-    return Safe(contents.detach(), std::move(decrypted), std::move(header), std::move(database));
+    auto ondisk = options.release_mapping ? MappedMemory() : contents.detach();
+    Safe safe(std::move(ondisk), std::move(decrypted), std::move(header), std::move(database));
+    safe.tail_ = std::move(tail);
+    safe.projected_ = !options.header_fields.all() || !options.record_fields.all();
+    if (options.group_tree)
+        safe.groups_ = std::make_unique<GroupTree>(GroupTree::build(safe.database_, safe.header_));
+    if (options.domain_index)
+        safe.domains_ = std::make_unique<DomainIndex>(DomainIndex::build(safe.database_));
+    return safe;
+}
+
+std::expected<Safe, std::error_code>
+Safe::load_on_demand(MappedFile&& contents, SecureBytes&& key_k, const SecureBytes& key_l,
+    const LoadOptions& options)
+{
+    auto iv = contents.slice<PROLOGUE::IV_SIZE>(PROLOGUE::OFFSET_IV);
+    auto encrypted = contents.slice(PROLOGUE_SIZE, contents.size() - (PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE));
+    size_t epilogue_offset = PROLOGUE_SIZE + encrypted.size();
+    if (contents.slice<TWOFISH_SIZE>(epilogue_offset) != DBEND) {
+        return std::unexpected(psafe3::Error::corrupt_file);
+    }
+
+    // Authenticate everything and note where each entry ends.
+    auto scanner = BodyScanner::create(encrypted, key_k, iv, key_l);
+    if (!scanner)
+        return std::unexpected(scanner.error());
+    size_t header_end = 0;
+    bool in_header = true;
+    std::vector<OnDemandState::Location> records;
+    for (size_t fields = 1;; ++fields) {
+        if (fields % INTERRUPT_INTERVAL == 0) {
+            if (auto err = options.stretch.interrupted(); err)
+                return std::unexpected(err);
+        }
+        auto field = scanner->next();
+        if (!field)
+            return std::unexpected(field.error());
+        if (!*field)
+            break;
+        if ((*field)->type != static_cast<uint8_t>(RecordFieldType::END_OF_ENTRY))
+            continue;
+        size_t end = (*field)->offset + (*field)->extent;
+        if (in_header) {
+            header_end = end;
+            in_header = false;
+        } else {
+            size_t start = records.empty() ? header_end : records.back().offset + records.back().size;
+            records.push_back({ .offset = start, .size = end - start });
+        }
+    }
+    if (in_header)
+        header_end = encrypted.size();
+
+    auto computed_hmac = scanner->finish();
+    if (!computed_hmac)
+        return std::unexpected(computed_hmac.error());
+    if (*computed_hmac != contents.slice<SHA256_SIZE>(epilogue_offset + TWOFISH_SIZE))
+        return std::unexpected(psafe3::Error::hmac_mismatch);
+
+    // Only the header stays decrypted.
+    auto cipher = TwofishCBC::create(key_k.as_span(), iv);
+    if (!cipher)
+        return std::unexpected(cipher.error());
+    SecureBytes decrypted(header_end);
+    if (auto err = cipher->decrypt(decrypted.as_span(), encrypted.first(header_end)); err)
+        return std::unexpected(err);
+    std::vector<HeaderField> header;
+    size_t offset = 0;
+    if (auto err = parse_entry(decrypted.as_span(), offset, header, nullptr, options.header_fields, options.wipe_unprojected, options.validate_utf8); err)
+        return std::unexpected(err);
+
+    Safe safe(contents.detach(), std::move(decrypted), std::move(header), {});
+    safe.projected_ = !options.header_fields.all() || !options.record_fields.all();
+    safe.on_demand_.reset(new OnDemandState {
+        .key_k = std::move(key_k),
+        .records = std::move(records),
+        .budget = options.cache_budget,
+        .record_fields = options.record_fields,
+        .wipe = options.wipe_unprojected,
+        .validate_utf8 = options.validate_utf8,
+    });
+    return safe;
+}
+
+std::expected<void, std::error_code>
+Safe::save_tail(const std::filesystem::path& path, size_t first, std::span<const Record> records)
+{
+    if (!tail_)
+        return std::unexpected(Error::no_checkpoint);
+    if (first > database_.size())
+        return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+
+    FileDescriptor file(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (!file)
+        return std::unexpected(last_system_error());
+    if (::flock(file.get(), LOCK_EX) != 0)
+        return std::unexpected(last_system_error());
+    if (auto err = recover_tail(file.get(), path); err)
+        return std::unexpected(err);
+
+    // Refuse to splice onto a file that is not the one we loaded.
+    struct stat st;
+    if (::fstat(file.get(), &st) != 0)
+        return std::unexpected(last_system_error());
+    std::array<std::byte, PROLOGUE_SIZE> prologue;
+    if (static_cast<size_t>(st.st_size) != tail_->file_size)
+        return std::unexpected(Error::stale_checkpoint);
+    if (auto err = read_exact(file.get(), prologue, 0); err)
+        return std::unexpected(err);
+    if (prologue != std::span<const std::byte, PROLOGUE_SIZE>(tail_->prologue))
+        return std::unexpected(Error::stale_checkpoint);
+
+    // Catch the HMAC up from the nearest checkpoint; the ciphertext of the
+    // records in between is unchanged and stays where it is.
+    auto& checkpoints = tail_->checkpoints;
+    auto next = std::ranges::upper_bound(checkpoints, first, {}, &TailState::Checkpoint::record);
+    assert(next != checkpoints.begin());
+    auto hmac = std::prev(next)->hmac.clone();
+    if (!hmac)
+        return std::unexpected(hmac.error());
+    for (size_t i = std::prev(next)->record; i < first; ++i) {
+        for (const auto& field : database_[i].fields)
+            hmac->write(field.data);
+    }
+
+    size_t offset = first < database_.size()
+        ? static_cast<size_t>(database_[first].extent.data() - decrypted_.data())
+        : decrypted_.size();
+    std::array<std::byte, TWOFISH_SIZE> chain;
+    if (auto err = read_exact(file.get(), chain, PROLOGUE_SIZE + offset - TWOFISH_SIZE); err)
+        return std::unexpected(err);
+    auto cipher = TwofishCBC::create(tail_->key_k.as_span(), chain);
+    if (!cipher)
+        return std::unexpected(cipher.error());
+
+    auto writer = BodyWriter::create(file.get(), PROLOGUE_SIZE + offset, std::move(cipher.value()), std::move(hmac.value()));
+    if (!writer)
+        return std::unexpected(writer.error());
+    if (auto err = write_tail_journal(file.get(), path, PROLOGUE_SIZE + offset, tail_->file_size); err)
+        return std::unexpected(err);
+    for (const auto& record : records) {
+        if (auto err = writer->write_record(record); err)
+            return std::unexpected(err);
+    }
+    auto end = writer->finish();
+    if (!end)
+        return std::unexpected(end.error());
+    if (::ftruncate(file.get(), *end) != 0 || ::fdatasync(file.get()) != 0)
+        return std::unexpected(last_system_error());
+    if (::unlink(tail_journal_path(path).c_str()) != 0)
+        return std::unexpected(last_system_error());
+    if (auto err = sync_directory(path); err)
+        return std::unexpected(err);
+
+    tail_.reset();
+    return {};
 }
 
 std::span<const HeaderField> Safe::header() const noexcept
@@ -256,4 +559,84 @@ std::span<const Record> Safe::database() const noexcept
     return database_;
 }
 
+const GroupTree* Safe::groups() const noexcept
+{
+    return groups_.get();
+}
+
+const DomainIndex* Safe::domains() const noexcept
+{
+    return domains_.get();
+}
+
+RecordView Safe::view(std::span<const SortKey> spec, Executor& executor) const
+{
+    return RecordView::build(database_, spec, executor);
+}
+
+size_t Safe::record_count() const noexcept
+{
+    return on_demand_ ? on_demand_->records.size() : database_.size();
+}
+
+std::expected<std::shared_ptr<const Record>, std::error_code> Safe::fetch(size_t index) const
+{
+    if (!on_demand_) {
+        if (index >= database_.size())
+            return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+        return std::shared_ptr<const Record>(std::shared_ptr<const Record>(), &database_[index]);
+    }
+
+    auto& state = *on_demand_;
+    if (index >= state.records.size())
+        return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+    {
+        std::lock_guard lock(state.mutex);
+        if (auto it = state.cache.find(index); it != state.cache.end()) {
+            state.lru.splice(state.lru.begin(), state.lru, it->second.second);
+            const auto& entry = it->second.first;
+            return std::shared_ptr<const Record>(entry, &entry->record);
+        }
+    }
+
+    // CBC decryption can start anywhere given the preceding ciphertext block.
+    auto [offset, size] = state.records[index];
+    auto encrypted = ondisk_.span().subspan(PROLOGUE_SIZE);
+    auto chain = offset == 0
+        ? ondisk_.span().subspan<PROLOGUE::OFFSET_IV, PROLOGUE::IV_SIZE>()
+        : encrypted.subspan(offset - TWOFISH_SIZE).first<TWOFISH_SIZE>();
+    auto cipher = TwofishCBC::create(state.key_k.as_span(), chain);
+    if (!cipher)
+        return std::unexpected(cipher.error());
+    auto entry = std::make_shared<OnDemandState::CachedRecord>(OnDemandState::CachedRecord {
+        .plaintext = SecureBytes(size),
+        .record = {},
+    });
+    auto plaintext = entry->plaintext.as_span();
+    if (auto err = cipher->decrypt(plaintext, encrypted.subspan(offset, size)); err)
+        return std::unexpected(err);
+    size_t pos = 0;
+    if (auto err = parse_entry(plaintext, pos, entry->record.fields, nullptr, state.record_fields, state.wipe, state.validate_utf8); err)
+        return std::unexpected(err);
+    entry->record.data = plaintext;
+    entry->record.extent = plaintext;
+
+    std::lock_guard lock(state.mutex);
+    if (auto it = state.cache.find(index); it != state.cache.end()) {
+        // Another thread got here first.
+        const auto& cached = it->second.first;
+        return std::shared_ptr<const Record>(cached, &cached->record);
+    }
+    state.lru.push_front(index);
+    state.cache.emplace(index, std::make_pair(entry, state.lru.begin()));
+    state.cached_bytes += size;
+    while (state.cached_bytes > state.budget && state.lru.size() > 1) {
+        auto victim = state.cache.find(state.lru.back());
+        state.cached_bytes -= victim->second.first->plaintext.size();
+        state.cache.erase(victim);
+        state.lru.pop_back();
+    }
+    return std::shared_ptr<const Record>(entry, &entry->record);
+}
+
 } // namespace psafe3
@@ -1,8 +1,11 @@
 #pragma once
 // https://github.com/marcbutler/libpsafe3/LICENSE
 
+#include <bitset>
 #include <expected>
 #include <filesystem>
+#include <initializer_list>
+#include <memory>
 #include <span>
 #include <system_error>
 #include <vector>
@@ -10,6 +13,7 @@
 #include <cstdint>
 
 #include "crypto.h"
+#include "executor.h"
 #include "mapped.h"
 
 namespace psafe3 {
@@ -66,6 +70,13 @@ enum class RecordFieldType : uint8_t {
     END_OF_ENTRY = 0xff,
 };
 
+// Whether the data of a field is well-formed UTF-8, see utf8.h.
+enum class Utf8 : uint8_t {
+    unchecked,
+    valid,
+    invalid,
+};
+
 template <typename E>
 struct Field {
     friend class Safe;
@@ -74,6 +85,7 @@ struct Field {
     uint32_t len;
     std::span<std::byte> data;
     std::span<std::byte> extent;
+    Utf8 utf8 = Utf8::unchecked;
 };
 
 using HeaderField = Field<HeaderFieldType>;
@@ -87,28 +99,162 @@ struct Record {
     std::span<std::byte> extent;
 };
 
+struct LoadOptions {
+    // Keep a resumable HMAC state at a record boundary about every this many
+    // bytes of body so that Safe::save_tail() can start from the first
+    // changed record. Zero disables checkpoints.
+    size_t checkpoint_interval = 0;
+
+    // Verify the body in one streaming pass and keep only the header and
+    // the location of each record instead of a plaintext copy of the whole
+    // body. Records are decrypted by Safe::fetch() into a cache holding at
+    // most `cache_budget` bytes of plaintext; database() is empty. The file
+    // must not be modified while the Safe is open.
+    bool on_demand = false;
+    size_t cache_budget = 1024 * 1024;
+
+    // Decrypt the body straight into a single buffer of its own mapping
+    // (see SecureBytes::mapped()) and unmap the file before load() returns,
+    // so that an open Safe holds one copy of the body instead of two.
+    // Cannot be combined with on_demand, which reads from the mapping.
+    bool release_mapping = false;
+
+    // Index the group hierarchy, see Safe::groups(). Needs the records, so
+    // cannot be combined with on_demand.
+    bool group_tree = false;
+
+    // Index the hosts of URL fields, see Safe::domains(). Needs the records,
+    // so cannot be combined with on_demand.
+    bool domain_index = false;
+
+    // Cancellation, deadline, iteration limit and progress reporting for
+    // the key stretch. The stop token and deadline are also checked while
+    // the body is decrypted and parsed.
+    StretchOptions stretch = {};
+
+    // Field types to materialize, indexed by HeaderFieldType and
+    // RecordFieldType value. Fields of other types are still authenticated
+    // but left out of header() and Record::fields. A partial record mask
+    // cannot be combined with checkpoints.
+    std::bitset<256> header_fields = std::bitset<256>().set();
+    std::bitset<256> record_fields = std::bitset<256>().set();
+
+    // Overwrite the plaintext of fields left out by the masks as soon as
+    // it has been authenticated, so that it does not linger in memory for
+    // the life of the Safe. Record::data then covers wiped bytes.
+    bool wipe_unprojected = false;
+
+    // Check that text fields are well-formed UTF-8 as they are parsed and
+    // record the result in Field::utf8, so that as_u8string_view() need
+    // not check them again. Binary fields are left unchecked.
+    bool validate_utf8 = true;
+
+    // Runs the decryption of large bodies in parallel; default_executor()
+    // if null. The HMAC and parsing are sequential either way.
+    Executor* executor = nullptr;
+};
+
+// A mask for LoadOptions::header_fields or LoadOptions::record_fields.
+template <typename E>
+std::bitset<256> field_mask(std::initializer_list<E> types)
+{
+    std::bitset<256> mask;
+    for (auto type : types)
+        mask.set(static_cast<uint8_t>(type));
+    return mask;
+}
+
+class DomainIndex;
+class GroupTree;
+class RecordView;
+struct SortKey;
+
 class Safe {
 public:
+    // A prologue or tail left torn by an interrupted rekey() or save_tail()
+    // is recovered from its journal first, which needs write access to
+    // `path`.
     static std::expected<Safe, std::error_code>
     load(const std::filesystem::path& path,
-        const std::vector<std::byte> pass_phrase);
+        const std::vector<std::byte> pass_phrase,
+        const LoadOptions& options = {});
+
+    ~Safe();
+    Safe(Safe&&) noexcept;
+    Safe& operator=(Safe&&) noexcept;
 
     std::span<const HeaderField> header() const noexcept;
     std::span<const Record> database() const noexcept;
 
+    // The group hierarchy of database(), or nullptr unless loaded with
+    // LoadOptions::group_tree.
+    const GroupTree* groups() const noexcept;
+
+    // The URL hosts of database(), or nullptr unless loaded with
+    // LoadOptions::domain_index.
+    const DomainIndex* domains() const noexcept;
+
+    // The records of database() sorted by `spec`, see RecordView.
+    RecordView view(std::span<const SortKey> spec, Executor& executor = default_executor()) const;
+
+    // Number of records, materialized or not.
+    size_t record_count() const noexcept;
+
+    // Whether LoadOptions::header_fields or LoadOptions::record_fields left
+    // fields out, so that header() or database() is not the whole safe.
+    bool projected() const noexcept { return projected_; }
+
+    // Record `index`, decrypting it first when loaded on demand. The
+    // returned pointer keeps the record's plaintext alive after it has been
+    // evicted from the cache.
+    std::expected<std::shared_ptr<const Record>, std::error_code> fetch(size_t index) const;
+
+    // Replace the records from index `first` onwards with `records`,
+    // re-encrypting and re-authenticating only that tail of the file at
+    // `path`, which must be unchanged since load. Requires checkpoints; the
+    // HMAC is resumed from the nearest one before `first`.
+    //
+    // The tail is overwritten in place, after its original bytes have been
+    // journaled to "<path>.tail" and synced. load() and save_tail() put a
+    // journaled tail back before anything else, so an interrupted save
+    // leaves the safe as it was. The Safe no longer describes the file
+    // afterwards and must be reloaded before saving again.
+    std::expected<void, std::error_code>
+    save_tail(const std::filesystem::path& path, size_t first, std::span<const Record> records);
+
 private:
+    struct TailState;
+    struct OnDemandState;
+
     MappedMemory ondisk_;
     SecureBytes decrypted_;
     std::vector<HeaderField> header_;
     std::vector<Record> database_;
+    std::unique_ptr<TailState> tail_;
+    std::unique_ptr<OnDemandState> on_demand_;
+    std::unique_ptr<GroupTree> groups_;
+    std::unique_ptr<DomainIndex> domains_;
+    bool projected_ = false;
 
     Safe(MappedMemory&& ondisk, SecureBytes&& decrypted,
-        std::vector<HeaderField>&& header, std::vector<Record>&& database)
-        : ondisk_(std::move(ondisk))
-        , decrypted_(std::move(decrypted))
-        , header_(std::move(header))
-        , database_(std::move(database))
-    {
-    }
+        std::vector<HeaderField>&& header, std::vector<Record>&& database);
+
+    static std::expected<Safe, std::error_code>
+    load_on_demand(MappedFile&& contents, SecureBytes&& key_k, const SecureBytes& key_l,
+        const LoadOptions& options);
 };
+
+// Change the pass phrase of the safe at `path` in place.
+//
+// The body stays encrypted under the same random keys K and L; only SALT,
+// ITER, H(P') and B1-B4 in the prologue are rewritten. Both prologues are
+// journaled next to the safe first. After a crash, the next rekey(),
+// Safe::load(), verify() or peek_header() of the path keeps whichever of
+// them the safe holds whole and rolls a torn prologue back to the original.
+std::expected<void, std::error_code>
+rekey(const std::filesystem::path& path,
+    std::span<const std::byte> old_pass_phrase,
+    std::span<const std::byte> new_pass_phrase,
+    uint32_t iterations);
+
 } // namespace psafe3
@@ -5,17 +5,24 @@
 #include <span>
 #include <string>
 
+#include "fields.h"
 #include "safe.h"
 #include "safeio.h"
+#include "utf8.h"
 #include "utility.h"
 
 namespace psafe3 {
 
 namespace {
 
-    std::string as_text(std::span<std::byte> data)
+    // Ill-formed UTF-8 is repaired so that the result can be passed on
+    // as text.
+    template <typename E>
+    std::string as_text(const Field<E>& field)
     {
-        return { reinterpret_cast<const char*>(data.data()), data.size() };
+        if (auto text = as_u8string_view(field))
+            return { reinterpret_cast<const char*>(text->data()), text->size() };
+        return utf8_lossy(field.data);
     }
 
     std::time_t as_time(std::span<std::byte> data)
@@ -82,7 +89,7 @@ std::string header_field_as_text(const HeaderField& field)
     case HeaderFieldType::NAMED_PASSWORD_POLICIES:
     case HeaderFieldType::EMPTY_GROUPS:
     case HeaderFieldType::RESERVED_12:
-        return as_text(field.data);
+        return as_text(field);
     case HeaderFieldType::RESERVED_0C:
     case HeaderFieldType::RESERVED_0D:
     case HeaderFieldType::RESERVED_0E:
@@ -124,7 +131,7 @@ std::string record_field_as_text(const RecordField& field)
     case RecordFieldType::EMAIL_ADDRESS:
     case RecordFieldType::OWN_SYMBOLS_FOR_PASSWORD:
     case RecordFieldType::PASSWORD_POLICY_NAME:
-        return as_text(field.data);
+        return as_text(field);
     case RecordFieldType::RESERVED_0B:
     case RecordFieldType::END_OF_ENTRY:
         return {};
@@ -132,4 +139,14 @@ std::string record_field_as_text(const RecordField& field)
     return {};
 }
 
+std::string record_as_text(const Record& record)
+{
+    std::string text;
+    if (const auto* uuid = find_field(record, RecordFieldType::UUID); uuid)
+        text = record_field_as_text(*uuid);
+    if (const auto* title = find_field(record, RecordFieldType::TITLE); title)
+        text += std::format(" {}", record_field_as_text(*title));
+    return text;
+}
+
 } // namespace psafe3
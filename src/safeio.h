@@ -10,4 +10,7 @@ namespace psafe3 {
 std::string header_field_as_text(const HeaderField& field);
 std::string record_field_as_text(const RecordField& field);
 
+// The UUID and title of `record`, to name it in output.
+std::string record_as_text(const Record& record);
+
 } // namespace psafe3
@@ -0,0 +1,98 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <expected>
+#include <optional>
+#include <span>
+#include <system_error>
+
+#include "crypto.h"
+#include "error.h"
+#include "scan.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+    constexpr size_t LEN_SIZE = sizeof(uint32_t);
+    constexpr uint8_t END_OF_ENTRY = 0xff;
+}
+
+BodyScanner::BodyScanner(std::span<const std::byte> encrypted, TwofishCBC&& cipher, SHA256HMA&& hmac, size_t window)
+    : encrypted_(encrypted)
+    , cipher_(std::move(cipher))
+    , hmac_(std::move(hmac))
+    , window_(window)
+{
+}
+
+std::expected<BodyScanner, std::error_code>
+BodyScanner::create(std::span<const std::byte> encrypted, const SecureBytes& key_k,
+    std::span<const std::byte, TWOFISH_SIZE> iv, const SecureBytes& key_l, size_t window)
+{
+    if (encrypted.size() % TWOFISH_SIZE != 0)
+        return std::unexpected(Error::corrupt_file);
+    auto cipher = TwofishCBC::create(key_k.as_span(), iv);
+    if (!cipher)
+        return std::unexpected(cipher.error());
+    auto hmac = SHA256HMA::create(key_l.as_span());
+    if (!hmac)
+        return std::unexpected(hmac.error());
+    window = std::max(round_up_to(window, TWOFISH_SIZE), TWOFISH_SIZE);
+    return BodyScanner(encrypted, std::move(cipher.value()), std::move(hmac.value()), window);
+}
+
+// Decrypt the blocks following the current window.
+std::error_code BodyScanner::refill()
+{
+    assert(window_end_ < encrypted_.size());
+    auto n = std::min(window_.size(), encrypted_.size() - window_end_);
+    if (auto err = cipher_.decrypt(window_.span(0, n), encrypted_.subspan(window_end_, n)); err)
+        return err;
+    window_begin_ = window_end_;
+    window_end_ += n;
+    return {};
+}
+
+std::expected<std::optional<BodyScanner::FieldInfo>, std::error_code> BodyScanner::next()
+{
+    if (pos_ >= encrypted_.size())
+        return std::nullopt;
+    if (pos_ == window_end_) {
+        if (auto err = refill(); err)
+            return std::unexpected(err);
+    }
+
+    // Fields start on a block boundary, so the length and type are in the
+    // window together.
+    auto* head = window_.data(pos_ - window_begin_);
+    FieldInfo info {
+        .type = static_cast<uint8_t>(head[LEN_SIZE]),
+        .len = load<std::endian::little>(std::span<const std::byte, LEN_SIZE>(head, LEN_SIZE)),
+        .offset = pos_,
+        .extent = 0,
+    };
+    info.extent = round_up_to<size_t>(size_t { info.len } + LEN_SIZE + 1, TWOFISH_SIZE);
+    if (info.extent > encrypted_.size() - pos_)
+        return std::unexpected(Error::corrupt_file);
+
+    size_t cursor = pos_ + LEN_SIZE + 1;
+    size_t remaining = info.len;
+    while (remaining > 0) {
+        if (cursor == window_end_) {
+            if (auto err = refill(); err)
+                return std::unexpected(err);
+        }
+        auto n = std::min(remaining, window_end_ - cursor);
+        if (info.type != END_OF_ENTRY)
+            hmac_.write(window_.span(cursor - window_begin_, n));
+        cursor += n;
+        remaining -= n;
+    }
+    pos_ += info.extent;
+    assert(pos_ <= window_end_);
+    return info;
+}
+
+} // namespace psafe3
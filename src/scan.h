@@ -0,0 +1,60 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <system_error>
+
+#include "crypto.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+// Walks the fields of an encrypted body in order, decrypting through a
+// fixed-size secure window and feeding field data to the HMAC. Nothing is
+// kept once the scanner moves past it, so memory use does not depend on the
+// size of the body.
+class BodyScanner {
+public:
+    static constexpr size_t DEFAULT_WINDOW = 16 * 1024;
+
+    struct FieldInfo {
+        uint8_t type;
+        uint32_t len;
+        // Offset of the field within the body and its block-rounded size.
+        size_t offset;
+        size_t extent;
+    };
+
+    static std::expected<BodyScanner, std::error_code>
+    create(std::span<const std::byte> encrypted, const SecureBytes& key_k,
+        std::span<const std::byte, TWOFISH_SIZE> iv, const SecureBytes& key_l,
+        size_t window = DEFAULT_WINDOW);
+
+    // The next field, or std::nullopt at the end of the body.
+    std::expected<std::optional<FieldInfo>, std::error_code> next();
+
+    // Body offset of the next field.
+    size_t offset() const noexcept { return pos_; }
+
+    std::expected<std::array<std::byte, SHA256_SIZE>, std::error_code> finish() { return hmac_.finish(); }
+
+private:
+    std::span<const std::byte> encrypted_;
+    TwofishCBC cipher_;
+    SHA256HMA hmac_;
+    SecureBytes window_;
+    size_t window_begin_ = 0;
+    size_t window_end_ = 0;
+    size_t pos_ = 0;
+
+    BodyScanner(std::span<const std::byte> encrypted, TwofishCBC&& cipher, SHA256HMA&& hmac, size_t window);
+
+    std::error_code refill();
+};
+
+} // namespace psafe3
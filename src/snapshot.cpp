@@ -0,0 +1,227 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cerrno>
+#include <cstring>
+#include <expected>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "fileio.h"
+#include "mapped.h"
+#include "snapshot.h"
+#include "utility.h"
+
+namespace psafe3 {
+
+namespace {
+
+    constexpr std::array<char, 8> SNAPSHOT_MAGIC = { 'P', 'W', 'S', '3', 'S', 'N', 'A', 'P' };
+    constexpr uint32_t SNAPSHOT_VERSION = 1;
+    constexpr uint64_t DATA_OFFSET = sizeof(SnapshotHeader);
+
+    constexpr int REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+    // Whether `count` elements of `T` at `offset` fit in `size` bytes.
+    template <typename T>
+    bool table_fits(uint64_t offset, uint64_t count, uint64_t size)
+    {
+        return offset % alignof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+    }
+
+} // namespace
+
+std::expected<FileDescriptor, std::error_code> export_snapshot(const Safe& safe)
+{
+    FileDescriptor fd(::memfd_create("psafe3-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if (!fd)
+        return std::unexpected(last_system_error());
+
+    // The field data goes straight from the Safe's plaintext into the
+    // memfd; only the tables are built in ordinary memory.
+    std::vector<SnapshotField> fields;
+    std::vector<SnapshotRecord> records;
+    uint64_t data_size = 0;
+    auto append = [&](uint8_t type, std::span<const std::byte> data) -> std::error_code {
+        if (auto err = write_exact(fd.get(), data, static_cast<off_t>(DATA_OFFSET + data_size)); err)
+            return err;
+        fields.push_back({ type, static_cast<uint32_t>(data.size()), data_size });
+        data_size += data.size();
+        return {};
+    };
+
+    for (const auto& field : safe.header()) {
+        if (auto err = append(static_cast<uint8_t>(field.type), field.data); err)
+            return std::unexpected(err);
+    }
+    size_t header_count = fields.size();
+    records.reserve(safe.record_count());
+    for (size_t i = 0; i < safe.record_count(); ++i) {
+        auto record = safe.fetch(i);
+        if (!record)
+            return std::unexpected(record.error());
+        records.push_back({ fields.size(), (*record)->fields.size() });
+        for (const auto& field : (*record)->fields) {
+            if (auto err = append(static_cast<uint8_t>(field.type), field.data); err)
+                return std::unexpected(err);
+        }
+    }
+
+    SnapshotHeader header {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .header_count = static_cast<uint32_t>(header_count),
+        .record_count = records.size(),
+        .field_count = fields.size(),
+        .data_offset = DATA_OFFSET,
+        .data_size = data_size,
+        .fields_offset = round_up_to<uint64_t>(DATA_OFFSET + data_size, alignof(SnapshotField)),
+        .records_offset = 0,
+    };
+    header.records_offset = round_up_to<uint64_t>(header.fields_offset + fields.size() * sizeof(SnapshotField),
+        alignof(SnapshotRecord));
+    auto total = header.records_offset + records.size() * sizeof(SnapshotRecord);
+
+    if (::ftruncate(fd.get(), static_cast<off_t>(total)) != 0)
+        return std::unexpected(last_system_error());
+    if (auto err = write_exact(fd.get(), std::as_bytes(std::span(fields)), static_cast<off_t>(header.fields_offset)); err)
+        return std::unexpected(err);
+    if (auto err = write_exact(fd.get(), std::as_bytes(std::span(records)), static_cast<off_t>(header.records_offset)); err)
+        return std::unexpected(err);
+    if (auto err = write_exact(fd.get(), std::as_bytes(std::span(&header, 1)), 0); err)
+        return std::unexpected(err);
+
+    if (::fcntl(fd.get(), F_ADD_SEALS, REQUIRED_SEALS | F_SEAL_SEAL) != 0)
+        return std::unexpected(last_system_error());
+    return fd;
+}
+
+// SafeView
+
+SafeView::SafeView(MappedMemory&& mapping) noexcept
+    : mapping_(std::move(mapping))
+{
+}
+
+std::expected<SafeView, std::error_code> SafeView::map(int fd)
+{
+    // Without the seals the exporter could still change the tables after
+    // they have been validated.
+    int seals = ::fcntl(fd, F_GET_SEALS);
+    if (seals < 0)
+        return std::unexpected(last_system_error());
+    if ((seals & REQUIRED_SEALS) != REQUIRED_SEALS)
+        return std::unexpected(Error::invalid_snapshot);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+        return std::unexpected(last_system_error());
+    auto size = static_cast<uint64_t>(st.st_size);
+    if (size < sizeof(SnapshotHeader))
+        return std::unexpected(Error::invalid_snapshot);
+
+    auto mapping = MappedMemory::map(fd, size, MemoryAccess::Read);
+    if (!mapping)
+        return std::unexpected(mapping.error());
+    auto* base = const_cast<std::byte*>(mapping->data());
+    (void)::madvise(base, size, MADV_DONTDUMP);
+    (void)::mlock(base, size);
+
+    SnapshotHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION)
+        return std::unexpected(Error::invalid_snapshot);
+    if (header.data_offset > size || header.data_size > size - header.data_offset
+        || !table_fits<SnapshotField>(header.fields_offset, header.field_count, size)
+        || !table_fits<SnapshotRecord>(header.records_offset, header.record_count, size)
+        || header.header_count > header.field_count)
+        return std::unexpected(Error::invalid_snapshot);
+
+    SafeView view(std::move(mapping.value()));
+    view.data_ = view.mapping_.span().subspan(header.data_offset, header.data_size);
+    view.fields_ = { reinterpret_cast<const SnapshotField*>(base + header.fields_offset), header.field_count };
+    view.records_ = { reinterpret_cast<const SnapshotRecord*>(base + header.records_offset), header.record_count };
+    view.header_count_ = header.header_count;
+
+    for (const auto& field : view.fields_) {
+        if (field.offset > header.data_size || field.len > header.data_size - field.offset)
+            return std::unexpected(Error::invalid_snapshot);
+    }
+    for (const auto& record : view.records_) {
+        if (record.first_field > header.field_count || record.field_count > header.field_count - record.first_field)
+            return std::unexpected(Error::invalid_snapshot);
+    }
+    return view;
+}
+
+std::optional<std::span<const std::byte>> SafeView::find(size_t index, RecordFieldType type) const noexcept
+{
+    for (const auto& field : record(index)) {
+        if (field.type == static_cast<uint8_t>(type))
+            return data(field);
+    }
+    return std::nullopt;
+}
+
+// fd passing
+
+std::error_code send_fd(int socket, int fd)
+{
+    char byte = 0;
+    iovec iov { .iov_base = &byte, .iov_len = 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return last_system_error();
+    return {};
+}
+
+std::expected<FileDescriptor, std::error_code> receive_fd(int socket)
+{
+    char byte;
+    iovec iov { .iov_base = &byte, .iov_len = 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return std::unexpected(last_system_error());
+
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    if (n == 0 || (msg.msg_flags & MSG_CTRUNC) || !cmsg || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+        return std::unexpected(std::make_error_code(std::errc::bad_message));
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return FileDescriptor(fd);
+}
+
+} // namespace psafe3
@@ -0,0 +1,105 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <system_error>
+
+#include "fileio.h"
+#include "mapped.h"
+#include "safe.h"
+
+// Sharing an unlocked safe between processes.
+//
+// export_snapshot() copies the plaintext fields of a loaded Safe into a
+// memfd together with a table describing them, then seals it against any
+// further change. The fd can be handed to other processes, e.g. with
+// send_fd() over a Unix socket, which map it read-only with SafeView. Every
+// process shares the same pages and nobody but the exporter stretches the
+// pass phrase.
+//
+// The snapshot is only as protected as the fd: anyone holding it can read
+// the plaintext. Pages are locked into RAM while some SafeView maps them,
+// as far as RLIMIT_MEMLOCK allows, and are excluded from core dumps.
+//
+// Layout, all integers in host byte order:
+//
+//   SnapshotHeader
+//   field data, unpadded
+//   SnapshotField table: header fields, then record fields in order
+//   SnapshotRecord table
+
+namespace psafe3 {
+
+struct SnapshotHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t header_count;
+    uint64_t record_count;
+    uint64_t field_count;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t fields_offset;
+    uint64_t records_offset;
+};
+
+struct SnapshotField {
+    uint8_t type;
+    uint32_t len;
+    // Within the data region.
+    uint64_t offset;
+};
+
+struct SnapshotRecord {
+    uint64_t first_field;
+    uint64_t field_count;
+};
+
+// Export the header and every record of `safe`, fetching them if it was
+// loaded on demand. Returns a sealed memfd.
+std::expected<FileDescriptor, std::error_code> export_snapshot(const Safe& safe);
+
+// Read-only view of a snapshot.
+class SafeView {
+public:
+    // Map the snapshot in `fd`, which must be a sealed memfd made by
+    // export_snapshot(). The fd may be closed afterwards. The tables are
+    // validated once, here.
+    static std::expected<SafeView, std::error_code> map(int fd);
+
+    std::span<const SnapshotField> header() const noexcept { return fields_.first(header_count_); }
+    size_t record_count() const noexcept { return records_.size(); }
+    std::span<const SnapshotField> record(size_t index) const noexcept
+    {
+        return fields_.subspan(records_[index].first_field, records_[index].field_count);
+    }
+
+    std::span<const std::byte> data(const SnapshotField& field) const noexcept
+    {
+        return data_.subspan(field.offset, field.len);
+    }
+
+    // Data of the first field of `type` in record `index`.
+    std::optional<std::span<const std::byte>> find(size_t index, RecordFieldType type) const noexcept;
+
+private:
+    MappedMemory mapping_;
+    std::span<const std::byte> data_;
+    std::span<const SnapshotField> fields_;
+    std::span<const SnapshotRecord> records_;
+    size_t header_count_ = 0;
+
+    explicit SafeView(MappedMemory&& mapping) noexcept;
+};
+
+// Pass `fd` over the connected Unix socket `socket` (SCM_RIGHTS).
+std::error_code send_fd(int socket, int fd);
+
+// Receive an fd sent with send_fd().
+std::expected<FileDescriptor, std::error_code> receive_fd(int socket);
+
+} // namespace psafe3
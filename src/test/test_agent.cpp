@@ -0,0 +1,235 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "fields.h"
+#include "fileio.h"
+#include "safe.h"
+#include "utility.h"
+
+using psafe3::agent::Op;
+using psafe3::agent::Status;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static std::vector<std::byte> bytes(std::string_view s)
+{
+    const auto* p = reinterpret_cast<const std::byte*>(s.data());
+    return { p, p + s.size() };
+}
+
+static uint32_t u32(std::span<const std::byte> data, size_t offset)
+{
+    return psafe3::load<std::endian::little>(data.subspan(offset).first<4>());
+}
+
+static psafe3::Agent unlocked_agent(psafe3::Uuid& arcade)
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, bytes("Open sesame!"));
+    assert(safe.has_value());
+    arcade = *psafe3::record_uuid(safe->database()[0]);
+    psafe3::Agent agent;
+    agent.add(std::move(safe.value()));
+    return agent;
+}
+
+// Record indices in a records payload.
+static std::vector<uint32_t> record_indices(std::span<const std::byte> payload)
+{
+    std::vector<uint32_t> indices;
+    auto count = u32(payload, 0);
+    size_t at = 4;
+    for (uint32_t i = 0; i < count; ++i) {
+        assert(u32(payload, at) == 0);
+        indices.push_back(u32(payload, at + 4));
+        auto fields = u32(payload, at + 8);
+        at += 12;
+        for (uint32_t f = 0; f < fields; ++f)
+            at += 5 + u32(payload, at + 1);
+    }
+    assert(at == payload.size());
+    return indices;
+}
+
+static void test_pipelined()
+{
+    psafe3::Uuid arcade;
+    auto agent = unlocked_agent(arcade);
+
+    std::vector<std::byte> in;
+    psafe3::agent::encode_request(in, 1, Op::LOOKUP_UUID, arcade);
+    psafe3::agent::encode_request(in, 2, Op::LOOKUP_TITLE, bytes("Account #1"));
+    psafe3::agent::encode_request(in, 3, Op::LOOKUP_GROUP, bytes("Group 1"));
+    psafe3::agent::encode_request(in, 4, Op::LOOKUP_GROUP, bytes(""));
+    psafe3::agent::encode_request(in, 5, Op::LOOKUP_TITLE, bytes("Nothing"));
+    psafe3::agent::encode_request(in, 6, static_cast<Op>(99));
+    psafe3::agent::encode_request(in, 7, Op::STATS);
+    // A partial frame stays unconsumed.
+    auto whole = in.size();
+    psafe3::agent::encode_request(in, 8, Op::STATS);
+    in.pop_back();
+
+    psafe3::agent::Buffer out;
+    auto consumed = agent.process(in, out);
+    assert(consumed.has_value() && *consumed == whole);
+
+    std::span<const std::byte> rest = out;
+    auto next = [&] {
+        auto response = psafe3::agent::decode_response(rest);
+        assert(response.has_value() && response->has_value());
+        return **response;
+    };
+    auto r = next();
+    assert(r.id == 1 && r.status == Status::OK && record_indices(r.payload) == std::vector<uint32_t> { 0 });
+    r = next();
+    assert(r.id == 2 && r.status == Status::OK && record_indices(r.payload) == std::vector<uint32_t> { 1 });
+    r = next();
+    assert(r.id == 3 && r.status == Status::OK && record_indices(r.payload) == std::vector<uint32_t> { 0 });
+    r = next();
+    assert(r.id == 4 && r.status == Status::OK && record_indices(r.payload).size() == 2);
+    r = next();
+    assert(r.id == 5 && r.status == Status::NOT_FOUND && r.payload.empty());
+    r = next();
+    assert(r.id == 6 && r.status == Status::BAD_REQUEST);
+    r = next();
+    assert(r.id == 7 && r.status == Status::OK);
+    assert(r.payload.size() == 8 * (3 + psafe3::agent::LATENCY_BUCKETS));
+    assert(psafe3::load<std::endian::little>(r.payload.first<8>()) == 6);
+    assert(rest.empty());
+    assert(agent.stats().requests == 7);
+
+    // Oversized frames poison the stream.
+    std::vector<std::byte> huge(4);
+    psafe3::store<std::endian::little>(std::span(huge).first<4>(), uint32_t { 1 << 20 });
+    assert(!agent.process(huge, out).has_value());
+}
+
+static void test_lock()
+{
+    psafe3::Uuid arcade;
+    auto agent = unlocked_agent(arcade);
+
+    std::vector<std::byte> in;
+    psafe3::agent::Buffer out;
+    psafe3::agent::encode_request(in, 1, Op::LOCK);
+    psafe3::agent::encode_request(in, 2, Op::LOOKUP_UUID, arcade);
+    assert(agent.process(in, out).has_value());
+    assert(agent.locked());
+
+    std::span<const std::byte> rest = out;
+    assert((*psafe3::agent::decode_response(rest))->status == Status::OK);
+    assert((*psafe3::agent::decode_response(rest))->status == Status::LOCKED);
+}
+
+static void test_serve()
+{
+    psafe3::Uuid arcade;
+    auto agent = unlocked_agent(arcade);
+
+    // Abstract socket, nothing to clean up.
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    auto name = "psafe3-test-agent-" + std::to_string(::getpid());
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    auto addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+
+    psafe3::FileDescriptor listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    assert(listener);
+    assert(::bind(listener.get(), reinterpret_cast<sockaddr*>(&addr), addr_len) == 0);
+    assert(::listen(listener.get(), 4) == 0);
+
+    std::error_code served;
+    std::jthread server([&](std::stop_token stop) {
+        served = psafe3::serve(agent, listener.get(),
+            { .idle_timeout = std::chrono::milliseconds(300), .stop_token = stop });
+    });
+
+    psafe3::FileDescriptor client(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    assert(::connect(client.get(), reinterpret_cast<sockaddr*>(&addr), addr_len) == 0);
+
+    auto round_trip = [&](const std::vector<std::byte>& request, size_t responses) {
+        assert(::send(client.get(), request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+        std::vector<std::byte> buf;
+        std::vector<Status> statuses;
+        while (statuses.size() < responses) {
+            std::byte chunk[4096];
+            auto n = ::recv(client.get(), chunk, sizeof(chunk), 0);
+            assert(n > 0);
+            buf.insert(buf.end(), chunk, chunk + n);
+            std::span<const std::byte> rest = buf;
+            statuses.clear();
+            while (auto r = psafe3::agent::decode_response(rest)) {
+                if (!r->has_value())
+                    break;
+                statuses.push_back((*r)->status);
+            }
+        }
+        return statuses;
+    };
+
+    std::vector<std::byte> request;
+    for (uint32_t id = 0; id < 100; ++id)
+        psafe3::agent::encode_request(request, id, Op::LOOKUP_UUID, arcade);
+    auto statuses = round_trip(request, 100);
+    assert(statuses == std::vector<Status>(100, Status::OK));
+
+    // Requests filling whole read chunks, then a half-close: every one is
+    // still answered before the connection is dropped.
+    {
+        psafe3::FileDescriptor half(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        assert(::connect(half.get(), reinterpret_cast<sockaddr*>(&addr), addr_len) == 0);
+        request.clear();
+        psafe3::agent::encode_request(request, 0, Op::LOOKUP_UUID, arcade);
+        std::vector<std::byte> title(2 * 16 * 1024 - request.size() - 9, std::byte { 'x' });
+        psafe3::agent::encode_request(request, 1, Op::LOOKUP_TITLE, title);
+        assert(request.size() == 2 * 16 * 1024);
+        assert(::send(half.get(), request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+        assert(::shutdown(half.get(), SHUT_WR) == 0);
+        std::vector<std::byte> buf;
+        std::byte chunk[4096];
+        for (ssize_t n; (n = ::recv(half.get(), chunk, sizeof(chunk), 0)) > 0;)
+            buf.insert(buf.end(), chunk, chunk + n);
+        std::span<const std::byte> rest = buf;
+        assert((*psafe3::agent::decode_response(rest))->status == Status::OK);
+        assert((*psafe3::agent::decode_response(rest))->status == Status::NOT_FOUND);
+        assert(rest.empty());
+    }
+
+    // Polling STATS is not activity: idle long enough and the agent locks
+    // itself.
+    for (int i = 0; i < 6; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        request.clear();
+        psafe3::agent::encode_request(request, 0, Op::STATS);
+        assert(round_trip(request, 1) == std::vector<Status> { Status::OK });
+    }
+    request.clear();
+    psafe3::agent::encode_request(request, 0, Op::LOOKUP_UUID, arcade);
+    assert(round_trip(request, 1) == std::vector<Status> { Status::LOCKED });
+
+    server.request_stop();
+    server.join();
+    assert(!served);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_pipelined();
+    test_lock();
+    test_serve();
+
+    return 0;
+}
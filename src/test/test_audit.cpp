@@ -0,0 +1,101 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "audit.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+using psafe3::RecordFieldType;
+using psafe3::ReuseAuditor;
+
+static psafe3::Record record(std::string_view password, std::string_view history = {})
+{
+    psafe3::Record r;
+    r.fields.push_back(field(RecordFieldType::TITLE, "title"));
+    if (!password.empty())
+        r.fields.push_back(field(RecordFieldType::PASSWORD, password));
+    if (!history.empty())
+        r.fields.push_back(field(RecordFieldType::PASSWORD_HISTORY, history));
+    return r;
+}
+
+static void test_reuse()
+{
+    std::vector<psafe3::Record> first = {
+        record("hunter2"), // 0
+        record("correct horse", "10a01" "5f5e10000007hunter2"), // 1
+        record("unique"), // 2
+        record(""), // 3
+    };
+    std::vector<psafe3::Record> second = {
+        record("correct horse"), // 0
+        record("", "1"), // 1: malformed history
+        record(""), // 2
+    };
+
+    auto auditor = ReuseAuditor::create();
+    assert(auditor.has_value());
+    assert(!auditor->add(first));
+    assert(!auditor->add(second));
+
+    auto reused = auditor->reused();
+    assert(reused.size() == 2);
+
+    const auto& hunter = reused[0];
+    assert(hunter.size() == 2);
+    assert(hunter[0].safe == 0 && hunter[0].record == 0 && !hunter[0].history);
+    assert(hunter[1].safe == 0 && hunter[1].record == 1 && hunter[1].history);
+
+    const auto& horse = reused[1];
+    assert(horse.size() == 2);
+    assert(horse[0].safe == 0 && horse[0].record == 1);
+    assert(horse[1].safe == 1 && horse[1].record == 0);
+}
+
+static void test_own_history()
+{
+    // The current password repeated twice in the record's own history.
+    std::vector<psafe3::Record> records = {
+        record("hunter3", "10a02" "5f5e10000007hunter3" "5f5e10000007hunter3"),
+        record("other", "10a01" "5f5e10000007hunter3"),
+    };
+    auto auditor = ReuseAuditor::create();
+    assert(auditor.has_value());
+    assert(!auditor->add(std::span(records).first(1)));
+    assert(auditor->reused().empty());
+
+    // Another record sharing it counts each record once.
+    assert(!auditor->add(std::span(records).subspan(1)));
+    auto reused = auditor->reused();
+    assert(reused.size() == 1 && reused[0].size() == 2);
+    assert(reused[0][0].safe == 0 && reused[0][0].record == 0 && !reused[0][0].history);
+    assert(reused[0][1].safe == 1 && reused[0][1].record == 0 && reused[0][1].history);
+}
+
+static void test_independent_keys()
+{
+    // A fresh auditor knows nothing of what another has seen.
+    std::vector<psafe3::Record> records = { record("hunter2") };
+    auto a = ReuseAuditor::create();
+    auto b = ReuseAuditor::create();
+    assert(a.has_value() && b.has_value());
+    assert(!a->add(records));
+    assert(!b->add(records));
+    assert(a->reused().empty() && b->reused().empty());
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_reuse();
+    test_own_history();
+    test_independent_keys();
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <latch>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "crypto.h"
+#include "prologue.h"
+
+using namespace psafe3;
+
+static std::span<const std::byte> bytes(std::string_view s)
+{
+    return { reinterpret_cast<const std::byte*>(s.data()), s.size() };
+}
+
+static bool equals_hex(std::span<const std::byte> digest, std::string_view hex)
+{
+    static const char DIGITS[] = "0123456789abcdef";
+    if (hex.size() != 2 * digest.size())
+        return false;
+    for (size_t i = 0; i < digest.size(); ++i) {
+        auto b = static_cast<uint8_t>(digest[i]);
+        if (hex[2 * i] != DIGITS[b >> 4] || hex[2 * i + 1] != DIGITS[b & 0xf])
+            return false;
+    }
+    return true;
+}
+
+// FIPS 180-2 and RFC 4231 test case 2.
+static const char SHA256_ABC[] = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+static const char HMAC_JEFE[] = "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843";
+
+static bool hmac_jefe()
+{
+    auto hmac = SHA256HMA::create(bytes("Jefe"));
+    if (!hmac)
+        return false;
+    hmac->write(bytes("what do ya want for nothing?"));
+    auto digest = hmac->finish();
+    return digest && equals_hex(*digest, HMAC_JEFE);
+}
+
+static bool twofish_round_trip()
+{
+    std::array<std::byte, 32> key {};
+    std::array<std::byte, TWOFISH_SIZE> iv {};
+    std::array<std::byte, 4 * TWOFISH_SIZE> data {};
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<std::byte>(i);
+    auto original = data;
+
+    auto enc = TwofishCBC::create(key, iv);
+    if (!enc || enc->encrypt(data))
+        return false;
+    auto dec = TwofishCBC::create(key, iv);
+    if (!dec || dec->decrypt(data))
+        return false;
+    return data == original;
+}
+
+// Must run before anything else touches libgcrypt, so that the threads race
+// on initialization.
+static void test_concurrent_first_use()
+{
+    constexpr int THREADS = 8;
+    std::atomic<int> ready = 0;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; ++i) {
+        threads.emplace_back([&] {
+            ready.fetch_add(1);
+            while (ready.load() < THREADS) { }
+            for (int round = 0; round < 50; ++round) {
+                auto digest = sha256(bytes("abc"));
+                if (!digest || !equals_hex(*digest, SHA256_ABC) || !hmac_jefe() || !twofish_round_trip())
+                    failures.fetch_add(1);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    assert(failures.load() == 0);
+}
+
+// Pooled handles must not carry key or state over to their next user.
+static void test_reuse()
+{
+    for (int i = 0; i < 3; ++i) {
+        auto other = SHA256HMA::create(bytes("another key"));
+        assert(other.has_value());
+        other->write(bytes("left unfinished"));
+    }
+    assert(hmac_jefe());
+    assert(twofish_round_trip());
+
+    std::array<std::byte, 32> key {};
+    key[0] = std::byte { 1 };
+    std::array<std::byte, TWOFISH_SIZE> iv {};
+    std::array<std::byte, TWOFISH_SIZE> a {}, b {};
+    {
+        auto cipher = TwofishCBC::create(key, iv);
+        assert(cipher.has_value());
+        assert(!cipher->encrypt(a));
+    }
+    key[0] = std::byte { 2 };
+    auto cipher = TwofishCBC::create(key, iv);
+    assert(cipher.has_value());
+    assert(!cipher->encrypt(b));
+    assert(a != b);
+
+    drop_cached_handles();
+    assert(cached_handle_count() == 0);
+    assert(hmac_jefe());
+
+    // A closed cipher is not kept for reuse.
+    auto before = cached_handle_count();
+    {
+        auto closed = TwofishCBC::create(key, iv);
+        assert(closed.has_value());
+        assert(!closed->encrypt(a));
+        closed->close();
+    }
+    assert(cached_handle_count() == before);
+
+    // Handles idle on another, still running, thread are dropped too.
+    std::latch used(1), dropped(1);
+    std::jthread worker([&] {
+        assert(hmac_jefe());
+        assert(twofish_round_trip());
+        used.count_down();
+        dropped.wait();
+    });
+    used.wait();
+    assert(cached_handle_count() > 0);
+    drop_cached_handles();
+    assert(cached_handle_count() == 0);
+    dropped.count_down();
+}
+
+static void test_mapped_bytes()
+{
+    constexpr size_t SIZE = 4 * 1024 * 1024;
+    auto bytes = SecureBytes::mapped(SIZE);
+    assert(bytes.size() == SIZE);
+    bytes.data()[SIZE - 1] = std::byte { 0x5a };
+
+    auto moved = std::move(bytes);
+    assert(bytes.size() == 0);
+    assert(moved.byte(SIZE - 1) == std::byte { 0x5a });
+    moved = SecureBytes(16);
+    assert(moved.size() == 16);
+}
+
+static void test_stretch_progress()
+{
+    std::array<std::byte, SHA256_SIZE> salt {};
+    std::vector<uint32_t> reports;
+    StretchOptions options {
+        .progress = [&](uint32_t done, uint32_t total) {
+            assert(total == 5000);
+            reports.push_back(done);
+        },
+        .progress_interval = 2048,
+    };
+    auto key = stretch_key(bytes("pass"), salt, 5000, options);
+    assert(key.has_value());
+    assert((reports == std::vector<uint32_t> { 2048, 4096, 5000 }));
+
+    auto plain = stretch_key(bytes("pass"), salt, 5000);
+    assert(plain.has_value());
+    assert(std::memcmp(plain->data(), key->data(), SHA256_SIZE) == 0);
+}
+
+static void test_calibrate()
+{
+    psafe3::CalibrateOptions options { .sample_time = std::chrono::milliseconds(5), .samples = 3 };
+    auto fast = psafe3::calibrate_iterations(std::chrono::milliseconds(0), options);
+    assert(fast.has_value());
+    assert(fast->iterations_per_second > 0);
+    assert(fast->iterations == psafe3::MIN_ITERATIONS);
+
+    auto slow = psafe3::calibrate_iterations(std::chrono::seconds(1000), options);
+    assert(slow.has_value());
+    assert(slow->iterations > psafe3::MIN_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_concurrent_first_use();
+    test_reuse();
+    test_mapped_bytes();
+    test_stretch_progress();
+    test_calibrate();
+
+    return 0;
+}
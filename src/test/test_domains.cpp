@@ -0,0 +1,135 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "domains.h"
+#include "error.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+using psafe3::DomainIndex;
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static psafe3::Record record(std::string_view url)
+{
+    psafe3::Record r;
+    r.fields.push_back(field(RecordFieldType::TITLE, "title"));
+    if (!url.empty())
+        r.fields.push_back(field(RecordFieldType::URL, url));
+    return r;
+}
+
+static std::vector<uint32_t> sorted(std::span<const uint32_t> records)
+{
+    std::vector<uint32_t> result(records.begin(), records.end());
+    std::ranges::sort(result);
+    return result;
+}
+
+static void test_normalize()
+{
+    using psafe3::normalize_host;
+    assert(normalize_host("https://user:pw@WWW.Example.COM:8443/login?x=1#top") == "www.example.com");
+    assert(normalize_host("example.com/path") == "example.com");
+    assert(normalize_host("  //example.com.  ") == "example.com");
+    assert(normalize_host("[alt]http://example.com") == "example.com");
+    assert(normalize_host("http://[2001:DB8::1]:80/") == "[2001:db8::1]");
+    assert(normalize_host("192.168.1.1:8080") == "192.168.1.1");
+    assert(normalize_host("*.Example.com") == "*.example.com");
+    assert(normalize_host("https://bücher.de/") == "xn--bcher-kva.de");
+    assert(normalize_host("MÜNCHEN.de") == "xn--mnchen-3ya.de");
+    assert(!normalize_host(""));
+    assert(!normalize_host("https://"));
+    assert(!normalize_host("not a host"));
+    assert(!normalize_host("example..com"));
+    assert(!normalize_host("example.com:http"));
+
+    using psafe3::registrable_domain;
+    assert(registrable_domain("www.login.example.com") == "example.com");
+    assert(registrable_domain("example.com") == "example.com");
+    assert(registrable_domain("www.example.co.uk") == "example.co.uk");
+    assert(registrable_domain("co.uk") == "co.uk");
+    assert(registrable_domain("www.example.de") == "example.de");
+    assert(registrable_domain("localhost") == "localhost");
+    assert(registrable_domain("10.0.0.1") == "10.0.0.1");
+}
+
+static void test_build()
+{
+    std::vector<psafe3::Record> records = {
+        record("https://example.com/"), // 0
+        record("https://login.example.com/"), // 1
+        record("*.example.com"), // 2
+        record("https://a.login.example.com/"), // 3
+        record("example.org"), // 4
+        record(""), // 5
+        record("https://www.example.co.uk/"), // 6
+        record("https://co.uk/"), // 7
+        record("http://10.0.0.1/admin"), // 8
+        record("not a url"), // 9
+        record("https://LOGIN.example.com:443"), // 10
+    };
+    auto index = DomainIndex::build(records);
+    assert(index.records().size() == 9);
+
+    assert((sorted(index.exact("login.example.com")) == std::vector<uint32_t> { 1, 10 }));
+    assert((sorted(index.exact("https://example.com/other")) == std::vector<uint32_t> { 0 }));
+    assert(index.exact("www.example.com").empty());
+    assert(index.exact("com").empty());
+    assert(index.exact("example.net").empty());
+
+    assert((sorted(index.suffix("login.example.com")) == std::vector<uint32_t> { 1, 3, 10 }));
+    assert((sorted(index.suffix("example.com")) == std::vector<uint32_t> { 0, 1, 2, 3, 10 }));
+    assert((sorted(index.registrable("a.login.example.com")) == std::vector<uint32_t> { 0, 1, 2, 3, 10 }));
+    assert((sorted(index.registrable("example.co.uk")) == std::vector<uint32_t> { 6 }));
+
+    // The page's own host, then its parents up to example.com, whose
+    // wildcard comes after its own record.
+    auto matches = index.matches("https://a.login.example.com/form");
+    assert((matches == std::vector<uint32_t> { 3, 1, 10, 0, 2 }));
+    assert((index.matches("unknown.example.com") == std::vector<uint32_t> { 0, 2 }));
+    assert((index.matches("example.com") == std::vector<uint32_t> { 0 }));
+    // co.uk is a public suffix, so it never matches a site under it.
+    assert((index.matches("www.example.co.uk") == std::vector<uint32_t> { 6 }));
+    assert(index.matches("other.co.uk").empty());
+    assert((index.matches("10.0.0.1") == std::vector<uint32_t> { 8 }));
+    assert(index.matches("0.0.1").empty());
+    assert(index.matches("").empty());
+
+    auto com = index.child(DomainIndex::ROOT, "com");
+    assert(com && index.label(*com) == "com");
+    assert(index.node(*com).parent == DomainIndex::ROOT);
+    assert(index.find("example.com") == index.child(*com, "example"));
+}
+
+static void test_load()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .domain_index = true });
+    assert(safe.has_value());
+    assert(safe->domains());
+
+    auto plain = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(plain.has_value() && !plain->domains());
+
+    auto lazy = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .on_demand = true, .domain_index = true });
+    assert(!lazy.has_value());
+    assert(lazy.error() == psafe3::Error::unsupported_options);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_normalize();
+    test_build();
+    test_load();
+
+    return 0;
+}
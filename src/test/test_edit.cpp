@@ -0,0 +1,219 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "edit.h"
+#include "error.h"
+#include "fields.h"
+#include "safe.h"
+#include "test_helpers.h"
+#include "writer.h"
+
+namespace fs = std::filesystem;
+using psafe3::HeaderFieldType;
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static std::span<const std::byte> bytes(std::string_view s)
+{
+    return { reinterpret_cast<const std::byte*>(s.data()), s.size() };
+}
+
+static fs::path temp_path(std::string_view name)
+{
+    return fs::temp_directory_path() / ("test_edit." + std::string(name) + "." + std::to_string(::getpid()) + ".psafe3");
+}
+
+static std::string_view text(const psafe3::Record* record, RecordFieldType type)
+{
+    const auto* field = psafe3::find_field(*record, type);
+    return field ? psafe3::as_string_view(field->data) : std::string_view();
+}
+
+static psafe3::MutableSafe open_test_safe()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    auto edit = psafe3::MutableSafe::create(std::move(safe.value()));
+    assert(edit.has_value());
+    return std::move(edit.value());
+}
+
+static void test_edit()
+{
+    auto edit = open_test_safe();
+    const auto& current = edit.current();
+    assert(current.size() == 2 && current.slot_count() == 2);
+    assert(text(current.get(0), RecordFieldType::TITLE) == "Arcade");
+
+    auto before = edit.snapshot();
+    edit.set_field(0, RecordFieldType::TITLE, bytes("Pinball"));
+    assert(text(before.get(0), RecordFieldType::TITLE) == "Arcade");
+    assert(text(current.get(0), RecordFieldType::TITLE) == "Pinball");
+    assert(text(current.get(0), RecordFieldType::GROUP) == "Group 1");
+    assert(psafe3::find_field(*current.get(0), RecordFieldType::TITLE)->utf8 == psafe3::Utf8::valid);
+    // The untouched record is shared, not copied.
+    assert(before.get(1) == current.get(1));
+
+    assert(edit.remove_field(0, RecordFieldType::GROUP));
+    assert(!edit.remove_field(0, RecordFieldType::GROUP));
+    assert(!psafe3::find_field(*current.get(0), RecordFieldType::GROUP));
+    assert(text(before.get(0), RecordFieldType::GROUP) == "Group 1");
+
+    auto uuid0 = psafe3::record_uuid(*current.get(0));
+    auto uuid1 = psafe3::record_uuid(*current.get(1));
+    assert(uuid0 && uuid1 && edit.find(*uuid0) == 0 && edit.find(*uuid1) == 1);
+
+    psafe3::Uuid uuid {};
+    uuid[0] = std::byte { 0x42 };
+    const psafe3::FieldValue fields[] = {
+        { RecordFieldType::UUID, uuid },
+        { RecordFieldType::TITLE, bytes("Added") },
+        { RecordFieldType::PASSWORD, bytes("hunter2") },
+    };
+    auto slot = edit.add(fields);
+    assert(slot == 2 && current.size() == 3);
+    assert(edit.find(uuid) == 2);
+    assert(text(current.get(2), RecordFieldType::PASSWORD) == "hunter2");
+
+    edit.erase(1);
+    assert(current.size() == 2 && current.slot_count() == 3 && !current.get(1));
+    assert(!edit.find(*uuid1));
+    assert(before.size() == 2 && before.get(1));
+    std::vector<size_t> slots;
+    current.for_each([&](size_t slot, const psafe3::Record&) { slots.push_back(slot); });
+    assert((slots == std::vector<size_t> { 0, 2 }));
+
+    edit.set_header_field(HeaderFieldType::DATABASE_NAME, bytes("Edited"));
+    auto name = std::ranges::find(current.header(), HeaderFieldType::DATABASE_NAME, &psafe3::HeaderField::type);
+    assert(name != current.header().end() && psafe3::as_string_view(name->data) == "Edited");
+    auto old_name = std::ranges::find(before.header(), HeaderFieldType::DATABASE_NAME, &psafe3::HeaderField::type);
+    assert(old_name == before.header().end() || psafe3::as_string_view(old_name->data) != "Edited");
+}
+
+static void test_save()
+{
+    auto edit = open_test_safe();
+    auto original = edit.snapshot();
+    edit.set_field(1, RecordFieldType::NOTES, bytes("new notes"));
+    edit.erase(0);
+    auto edited = edit.snapshot();
+    // Edits after the snapshot do not reach it.
+    edit.set_field(1, RecordFieldType::NOTES, bytes("later"));
+
+    auto path = temp_path("save");
+    assert(edited.save(path, pass("edited"), 4096).has_value());
+    auto safe = psafe3::Safe::load(path, pass("edited"));
+    assert(safe.has_value());
+    assert(safe->database().size() == 1);
+    assert(text(&safe->database()[0], RecordFieldType::TITLE) == "Account #1");
+    assert(text(&safe->database()[0], RecordFieldType::NOTES) == "new notes");
+
+    auto header_uuid = [](std::span<const psafe3::HeaderField> header) {
+        auto it = std::ranges::find(header, HeaderFieldType::UUID, &psafe3::HeaderField::type);
+        assert(it != header.end());
+        return std::vector<std::byte>(it->data.begin(), it->data.end());
+    };
+    assert(header_uuid(safe->header()) == header_uuid(original.header()));
+    assert(std::ranges::count(safe->header(), HeaderFieldType::VERSION, &psafe3::HeaderField::type) == 1);
+
+    // The snapshot taken first still saves the original records.
+    assert(original.save(path, pass("edited"), 4096).has_value());
+    auto unedited = psafe3::Safe::load(path, pass("edited"));
+    assert(unedited.has_value() && unedited->database().size() == 2);
+    fs::remove(path);
+}
+
+// Batch edits with snapshots in between, across several trie levels.
+static void test_large()
+{
+    constexpr size_t COUNT = 40000;
+    auto path = temp_path("large");
+    auto writer = psafe3::SafeWriter::create(path, pass("large"), 4096);
+    assert(writer.has_value());
+    for (size_t i = 0; i < COUNT; ++i) {
+        auto title = std::to_string(i);
+        assert(!writer->body().write_field(static_cast<uint8_t>(RecordFieldType::TITLE), bytes(title)));
+        assert(!writer->body().end_entry());
+    }
+    assert(writer->commit().has_value());
+    psafe3::LoadOptions options;
+    options.release_mapping = true;
+    auto safe = psafe3::Safe::load(path, pass("large"), options);
+    fs::remove(path);
+    assert(safe.has_value());
+    auto edit = psafe3::MutableSafe::create(std::move(safe.value()));
+    assert(edit.has_value());
+
+    std::vector<psafe3::SafeSnapshot> snapshots;
+    for (size_t round = 0; round < 4; ++round) {
+        snapshots.push_back(edit->snapshot());
+        for (size_t i = round; i < COUNT; i += 4)
+            edit->set_field(i, RecordFieldType::TITLE, bytes("edited"));
+        edit->add(std::vector<psafe3::FieldValue> { { RecordFieldType::TITLE, bytes("added") } });
+    }
+    const auto& current = edit->current();
+    assert(current.size() == COUNT + 4);
+    for (size_t i = 0; i < COUNT; ++i)
+        assert(text(current.get(i), RecordFieldType::TITLE) == "edited");
+    for (size_t round = 0; round < 4; ++round) {
+        const auto& snapshot = snapshots[round];
+        assert(snapshot.size() == COUNT + round);
+        for (size_t i = 0; i < COUNT; ++i) {
+            bool edited = i % 4 < round;
+            assert(text(snapshot.get(i), RecordFieldType::TITLE) == (edited ? "edited" : std::to_string(i)));
+        }
+    }
+}
+
+static void test_on_demand()
+{
+    psafe3::LoadOptions options;
+    options.on_demand = true;
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(safe.has_value());
+    auto edit = psafe3::MutableSafe::create(std::move(safe.value()));
+    assert(!edit && edit.error() == psafe3::Error::unsupported_options);
+}
+
+static void test_projected()
+{
+    psafe3::LoadOptions options;
+    options.record_fields = psafe3::field_mask({ RecordFieldType::TITLE });
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(safe.has_value() && safe->projected());
+    auto edit = psafe3::MutableSafe::create(std::move(safe.value()));
+    assert(!edit && edit.error() == psafe3::Error::unsupported_options);
+
+    options = {};
+    options.header_fields = psafe3::field_mask({ HeaderFieldType::VERSION });
+    safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(safe.has_value() && safe->projected());
+    edit = psafe3::MutableSafe::create(std::move(safe.value()));
+    assert(!edit && edit.error() == psafe3::Error::unsupported_options);
+
+    safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value() && !safe->projected());
+    assert(psafe3::MutableSafe::create(std::move(safe.value())).has_value());
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    test_edit();
+    test_save();
+    test_large();
+    test_on_demand();
+    test_projected();
+    return 0;
+}
@@ -0,0 +1,163 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "executor.h"
+#include "safe.h"
+#include "test_helpers.h"
+#include "writer.h"
+
+namespace fs = std::filesystem;
+
+// Queues submitted tasks until run() is called, like a pool whose workers
+// are all busy.
+class QueueExecutor final : public psafe3::Executor {
+public:
+    explicit QueueExecutor(unsigned concurrency) : concurrency_(concurrency) { }
+
+    void submit(std::function<void()> task) override { queue_.push_back(std::move(task)); }
+    unsigned concurrency() const noexcept override { return concurrency_; }
+
+    size_t run()
+    {
+        size_t n = queue_.size();
+        while (!queue_.empty()) {
+            auto task = std::move(queue_.front());
+            queue_.pop_front();
+            task();
+        }
+        return n;
+    }
+
+private:
+    unsigned concurrency_;
+    std::deque<std::function<void()>> queue_;
+};
+
+// Counts the tasks handed to a ThreadExecutor.
+class CountingExecutor final : public psafe3::Executor {
+public:
+    void submit(std::function<void()> task) override
+    {
+        ++submitted;
+        threads_.submit(std::move(task));
+    }
+    unsigned concurrency() const noexcept override { return 4; }
+
+    std::atomic<size_t> submitted = 0;
+
+private:
+    psafe3::ThreadExecutor threads_ { 4 };
+};
+
+static void test_bulk()
+{
+    psafe3::ThreadExecutor executor(4);
+    assert(executor.concurrency() == 4);
+    std::vector<std::atomic<int>> calls(1000);
+    executor.bulk(calls.size(), [&](size_t i) { ++calls[i]; });
+    assert(std::ranges::all_of(calls, [](const std::atomic<int>& n) { return n == 1; }));
+    executor.bulk(0, [](size_t) { assert(false); });
+
+    // Nested bulk calls from inside tasks.
+    std::atomic<size_t> inner = 0;
+    executor.bulk(8, [&](size_t) { executor.bulk(8, [&](size_t) { ++inner; }); });
+    assert(inner == 64);
+
+    std::atomic<bool> ran = false;
+    executor.submit([&] { ran = true; });
+    executor.bulk(1, [](size_t) { });
+    while (!ran)
+        std::this_thread::yield();
+}
+
+// Tasks run on a fixed set of threads, and the destructor runs those still
+// queued.
+static void test_fixed_threads()
+{
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<size_t> ran = 0;
+    {
+        psafe3::ThreadExecutor executor(3);
+        for (int i = 0; i < 200; ++i) {
+            executor.submit([&] {
+                std::lock_guard lock(mutex);
+                threads.insert(std::this_thread::get_id());
+                ++ran;
+            });
+        }
+    }
+    assert(ran == 200);
+    assert(threads.size() <= 3);
+    assert(!threads.contains(std::this_thread::get_id()));
+}
+
+// The caller finishes the work itself if no submitted task runs.
+static void test_bulk_without_workers()
+{
+    QueueExecutor executor(4);
+    std::vector<int> calls(100);
+    executor.bulk(calls.size(), [&](size_t i) { ++calls[i]; });
+    assert(std::ranges::all_of(calls, [](int n) { return n == 1; }));
+    // The late tasks find nothing left to do.
+    assert(executor.run() == 3);
+    assert(std::ranges::all_of(calls, [](int n) { return n == 1; }));
+}
+
+// A body of several decryption chunks.
+static void test_load()
+{
+    auto path = fs::temp_directory_path() / ("test_executor." + std::to_string(::getpid()) + ".psafe3");
+    auto writer = psafe3::SafeWriter::create(path, pass("executor"), 4096);
+    assert(writer.has_value());
+    std::vector<std::byte> notes(1000);
+    for (uint32_t i = 0; i < 4000; ++i) {
+        std::ranges::fill(notes, static_cast<std::byte>('a' + i % 26));
+        assert(!writer->body().write_field(static_cast<uint8_t>(psafe3::RecordFieldType::NOTES), notes));
+        assert(!writer->body().end_entry());
+    }
+    assert(writer->commit().has_value());
+
+    QueueExecutor serial(1);
+    psafe3::LoadOptions options;
+    options.release_mapping = true;
+    options.executor = &serial;
+    auto expected = psafe3::Safe::load(path, pass("executor"), options);
+    assert(expected.has_value());
+    assert(serial.run() == 0);
+
+    CountingExecutor counting;
+    options.executor = &counting;
+    auto safe = psafe3::Safe::load(path, pass("executor"), options);
+    assert(safe.has_value());
+    assert(counting.submitted > 0);
+    assert(safe->database().size() == 4000);
+    for (size_t i = 0; i < 4000; ++i)
+        assert(std::ranges::equal(safe->database()[i].data, expected->database()[i].data));
+    fs::remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    test_bulk();
+    test_fixed_threads();
+    test_bulk_without_workers();
+    test_load();
+    return 0;
+}
@@ -0,0 +1,150 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expiry.h"
+#include "test_helpers.h"
+
+using psafe3::ExpiryScheduler;
+using psafe3::RecordFieldType;
+
+static std::string le32(uint32_t value)
+{
+    std::string s(4, '\0');
+    std::memcpy(s.data(), &value, 4);
+    return s;
+}
+
+static psafe3::Record record(uint32_t id, std::optional<uint32_t> expiry_time,
+    std::optional<uint32_t> modified = {}, uint32_t interval_days = 0)
+{
+    psafe3::Record r;
+    std::string uuid(16, '\0');
+    std::memcpy(uuid.data(), &id, sizeof(id));
+    r.fields.push_back(field(RecordFieldType::UUID, uuid));
+    if (expiry_time)
+        r.fields.push_back(field(RecordFieldType::PASSWORD_EXPIRY_TIME, le32(*expiry_time)));
+    if (modified) {
+        r.fields.push_back(field(RecordFieldType::PASSWORD_MODIFICATION_TIME, le32(*modified)));
+        r.fields.push_back(field(RecordFieldType::PASSWORD_EXPIRY_INTERVAL, le32(interval_days)));
+    }
+    return r;
+}
+
+static uint32_t id_of(const ExpiryScheduler::Expiry& expiry)
+{
+    uint32_t id;
+    std::memcpy(&id, expiry.uuid.data(), sizeof(id));
+    return id;
+}
+
+static void test_password_expiry()
+{
+    assert(!psafe3::password_expiry(record(0, {})));
+    assert(psafe3::password_expiry(record(0, 5000)) == 5000);
+    assert(psafe3::password_expiry(record(0, {}, 1000, 2)) == 1000 + 2 * 86400);
+    assert(psafe3::password_expiry(record(0, 5000, 1000, 2)) == 5000);
+    assert(!psafe3::password_expiry(record(0, 0, 1000, 0)));
+}
+
+static void test_schedule()
+{
+    ExpiryScheduler scheduler(1000);
+    std::vector<psafe3::Record> records = {
+        record(1, 1010),
+        record(2, {}, 0, 1),
+        record(3, 500),
+        record(4, {}),
+    };
+    assert(scheduler.update(7, records) == 3);
+    assert(scheduler.pending() == 3);
+
+    std::vector<uint32_t> fired;
+    auto collect = [&](const ExpiryScheduler::Expiry& e) {
+        assert(e.safe == 7);
+        fired.push_back(id_of(e));
+    };
+    scheduler.advance(1005, collect);
+    assert(fired == std::vector<uint32_t> { 3 });
+    scheduler.advance(1010, collect);
+    assert((fired == std::vector<uint32_t> { 3, 1 }));
+    assert(scheduler.pending() == 1);
+
+    // A reload with the same deadlines changes nothing and fires nothing
+    // again; a later deadline for a fired record schedules it anew.
+    assert(scheduler.update(7, records) == 0);
+    records[0] = record(1, 90000);
+    records[1] = record(2, {}, 0, 2);
+    assert(scheduler.update(7, records) == 2);
+    scheduler.advance(86400, collect);
+    assert(fired.size() == 2);
+    scheduler.advance(100000, collect);
+    assert((fired == std::vector<uint32_t> { 3, 1, 1 }));
+
+    records.pop_back();
+    records.erase(records.begin() + 1);
+    assert(scheduler.update(7, records) == 1);
+    scheduler.advance(1000000, collect);
+    assert(fired.size() == 3);
+    assert(scheduler.pending() == 0);
+
+    scheduler.update(8, std::vector { record(1, 2000000) });
+    scheduler.remove(8);
+    scheduler.advance(3000000, collect);
+    assert(fired.size() == 3);
+}
+
+static void test_many()
+{
+    // Deadlines spread over years, advanced in uneven steps: everything
+    // fires exactly once, in order, and not early.
+    const uint32_t start = 1'700'000'000;
+    ExpiryScheduler scheduler(start);
+    std::vector<psafe3::Record> records;
+    std::map<uint32_t, uint32_t> deadlines;
+    uint64_t x = 88172645463325252ull;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        auto deadline = start - 1000 + static_cast<uint32_t>(x % 100'000'000);
+        records.push_back(record(i, deadline));
+        deadlines[i] = deadline;
+    }
+    scheduler.update(0, records);
+
+    std::vector<bool> seen(records.size());
+    std::time_t last = 0;
+    std::time_t now = start;
+    size_t count = 0;
+    while (count < records.size()) {
+        now += static_cast<std::time_t>(1 + (x = x * 6364136223846793005ull + 1) % 5'000'000);
+        scheduler.advance(now, [&](const ExpiryScheduler::Expiry& e) {
+            auto id = id_of(e);
+            assert(!seen[id]);
+            seen[id] = true;
+            assert(e.deadline == static_cast<std::time_t>(deadlines[id]));
+            assert(e.deadline <= now && e.deadline >= last);
+            last = e.deadline;
+            ++count;
+        });
+        assert(scheduler.pending() == records.size() - count);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_password_expiry();
+    test_schedule();
+    test_many();
+
+    return 0;
+}
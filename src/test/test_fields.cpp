@@ -0,0 +1,158 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.h"
+#include "fields.h"
+
+using namespace psafe3;
+
+static std::span<const std::byte> bytes(std::string_view s)
+{
+    return { reinterpret_cast<const std::byte*>(s.data()), s.size() };
+}
+
+static void test_password_policy()
+{
+    auto policy = parse_password_policy(bytes("f400014001001001001"));
+    assert(policy.has_value());
+    assert(policy->flags == 0xf400);
+    assert(policy->length == 0x14);
+    assert(policy->min_lowercase == 1);
+    assert(policy->min_uppercase == 1);
+    assert(policy->min_digits == 1);
+    assert(policy->min_symbols == 1);
+
+    assert(!parse_password_policy(bytes("f40001400100100100")).has_value());
+    assert(!parse_password_policy(bytes("f40001400100100100x")).has_value());
+}
+
+static void test_password_history()
+{
+    auto history = PasswordHistory::parse(bytes("10a02"
+                                                "5f5e10000005abcde"
+                                                "5f5e10100003\xc3\xa9\x78y"));
+    assert(history.has_value());
+    assert(history->enabled());
+    assert(history->max_entries() == 10);
+    assert(history->size() == 2);
+
+    std::vector<HistoryEntry> entries;
+    for (const auto& entry : *history) {
+        assert(entry.has_value());
+        entries.push_back(*entry);
+    }
+    assert(entries.size() == 2);
+    assert(entries[0].time == 0x5f5e1000);
+    assert(entries[0].password == "abcde");
+    assert(entries[1].time == 0x5f5e1010);
+    assert(entries[1].password == "\xc3\xa9\x78y");
+
+    auto empty = PasswordHistory::parse(bytes("00000"));
+    assert(empty.has_value());
+    assert(!empty->enabled());
+    assert(empty->begin() == empty->end());
+}
+
+static void test_password_history_truncated()
+{
+    // Declares three entries but the second is cut short.
+    auto history = PasswordHistory::parse(bytes("10a03"
+                                                "5f5e100000031ab"
+                                                "5f5e10100008abc"));
+    assert(history.has_value());
+
+    size_t ok = 0;
+    size_t failed = 0;
+    for (const auto& entry : *history) {
+        if (entry)
+            ++ok;
+        else {
+            assert(entry.error() == Error::malformed_field);
+            ++failed;
+        }
+    }
+    assert(ok == 1);
+    assert(failed == 1);
+
+    assert(!PasswordHistory::parse(bytes("2")).has_value());
+}
+
+static void test_named_policies()
+{
+    auto policies = NamedPasswordPolicies::parse(bytes("02"
+                                                       "03web" "f000010001001001001" "00"
+                                                       "03pin" "2000006000000006000" "02!?"));
+    assert(policies.has_value());
+    assert(policies->size() == 2);
+
+    auto it = policies->begin();
+    assert((*it).has_value());
+    assert((*it)->name == "web");
+    assert((*it)->policy.flags == 0xf000);
+    assert((*it)->policy.length == 0x10);
+    assert((*it)->symbols.empty());
+    ++it;
+    assert((*it).has_value());
+    assert((*it)->name == "pin");
+    assert((*it)->policy.flags == PasswordPolicy::USE_DIGITS);
+    assert((*it)->policy.length == 6);
+    assert((*it)->symbols == "!?");
+    ++it;
+    assert(it == policies->end());
+}
+
+static void test_recently_used()
+{
+    auto recent = RecentlyUsedEntries::parse(bytes("01"
+                                                   "000102030405060708090a0b0c0d0e0f"));
+    assert(recent.has_value());
+    assert(recent->size() == 1);
+    for (const auto& uuid : *recent) {
+        assert(uuid.has_value());
+        for (size_t i = 0; i < uuid->size(); ++i)
+            assert((*uuid)[i] == std::byte(i));
+    }
+
+    auto bad = RecentlyUsedEntries::parse(bytes("01000102"));
+    assert(bad.has_value());
+    assert(!(*bad->begin()).has_value());
+}
+
+static void test_empty_groups()
+{
+    std::string a = "Infra.DB";
+    std::string b = "Personal";
+    std::vector<HeaderField> header = {
+        { .type = HeaderFieldType::EMPTY_GROUPS, .len = 8, .data = { reinterpret_cast<std::byte*>(a.data()), a.size() }, .extent = {} },
+        { .type = HeaderFieldType::DATABASE_NAME, .len = 8, .data = { reinterpret_cast<std::byte*>(b.data()), b.size() }, .extent = {} },
+        { .type = HeaderFieldType::EMPTY_GROUPS, .len = 8, .data = { reinterpret_cast<std::byte*>(b.data()), b.size() }, .extent = {} },
+    };
+
+    std::vector<std::string_view> groups;
+    for (auto name : empty_groups(header))
+        groups.push_back(name);
+    assert(groups.size() == 2);
+    assert(groups[0] == "Infra.DB");
+    assert(groups[1] == "Personal");
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_password_policy();
+    test_password_history();
+    test_password_history_truncated();
+    test_named_policies();
+    test_recently_used();
+    test_empty_groups();
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.h"
+#include "generator.h"
+#include "test_helpers.h"
+
+using psafe3::HeaderFieldType;
+using psafe3::PasswordGenerator;
+using psafe3::PasswordPolicy;
+using psafe3::RecordFieldType;
+
+static size_t count_of(std::string_view password, std::string_view chars)
+{
+    return static_cast<size_t>(std::ranges::count_if(password, [&](char c) { return chars.find(c) != chars.npos; }));
+}
+
+static void test_policy()
+{
+    PasswordPolicy policy {
+        .flags = PasswordPolicy::USE_LOWERCASE | PasswordPolicy::USE_UPPERCASE | PasswordPolicy::USE_DIGITS
+            | PasswordPolicy::USE_SYMBOLS,
+        .length = 12,
+        .min_lowercase = 1,
+        .min_uppercase = 2,
+        .min_digits = 3,
+        .min_symbols = 4,
+    };
+    auto generator = PasswordGenerator::compile(policy, "!?");
+    assert(generator.has_value());
+    auto passwords = generator->generate(2000);
+    assert(passwords.size() == 2000);
+
+    std::set<std::string_view> distinct;
+    std::set<char> seen;
+    for (size_t i = 0; i < passwords.size(); ++i) {
+        auto p = passwords[i];
+        assert(p.size() == 12);
+        assert(count_of(p, "abcdefghijklmnopqrstuvwxyz") >= 1);
+        assert(count_of(p, "ABCDEFGHIJKLMNOPQRSTUVWXYZ") >= 2);
+        assert(count_of(p, "0123456789") >= 3);
+        assert(count_of(p, "!?") >= 4);
+        assert(count_of(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!?") == 12);
+        distinct.insert(p);
+        seen.insert(p.begin(), p.end());
+    }
+    assert(distinct.size() == passwords.size());
+    assert(seen.size() == 26 + 26 + 10 + 2);
+}
+
+static void test_flags()
+{
+    PasswordPolicy hex { .flags = PasswordPolicy::USE_HEX_DIGITS | PasswordPolicy::USE_SYMBOLS, .length = 64,
+        .min_lowercase = 0, .min_uppercase = 0, .min_digits = 0, .min_symbols = 9 };
+    auto generator = PasswordGenerator::compile(hex);
+    assert(generator.has_value());
+    auto passwords = generator->generate(10);
+    for (size_t i = 0; i < passwords.size(); ++i)
+        assert(count_of(passwords[i], "0123456789abcdef") == 64);
+
+    PasswordPolicy easy { .flags = PasswordPolicy::USE_LOWERCASE | PasswordPolicy::USE_UPPERCASE
+            | PasswordPolicy::USE_DIGITS | PasswordPolicy::USE_EASY_VISION,
+        .length = 32, .min_lowercase = 0, .min_uppercase = 0, .min_digits = 0, .min_symbols = 0 };
+    generator = PasswordGenerator::compile(easy);
+    assert(generator.has_value());
+    passwords = generator->generate(100);
+    for (size_t i = 0; i < passwords.size(); ++i)
+        assert(count_of(passwords[i], "lIO01") == 0);
+
+    PasswordPolicy bad = easy;
+    bad.min_lowercase = 33;
+    assert(PasswordGenerator::compile(bad).error() == psafe3::Error::invalid_policy);
+    bad = easy;
+    bad.flags = 0;
+    assert(PasswordGenerator::compile(bad).error() == psafe3::Error::invalid_policy);
+    bad = easy;
+    bad.flags |= PasswordPolicy::MAKE_PRONOUNCEABLE;
+    assert(PasswordGenerator::compile(bad).error() == psafe3::Error::unsupported_policy);
+}
+
+static void test_for_record()
+{
+    std::vector<psafe3::HeaderField> header = {
+        field(HeaderFieldType::NAMED_PASSWORD_POLICIES, "01" "03pin" "2000006000000006000" "00"),
+    };
+    PasswordPolicy fallback { .flags = PasswordPolicy::USE_LOWERCASE, .length = 5,
+        .min_lowercase = 0, .min_uppercase = 0, .min_digits = 0, .min_symbols = 0 };
+
+    psafe3::Record named;
+    named.fields.push_back(field(RecordFieldType::PASSWORD_POLICY_NAME, "pin"));
+    auto generator = PasswordGenerator::for_record(named, header, fallback);
+    assert(generator.has_value());
+    auto pins = generator->generate(1);
+    assert(pins[0].size() == 6 && count_of(pins[0], "0123456789") == 6);
+
+    psafe3::Record own;
+    own.fields.push_back(field(RecordFieldType::PASSWORD_POLICY, "1000008000000000000"));
+    own.fields.push_back(field(RecordFieldType::OWN_SYMBOLS_FOR_PASSWORD, "#"));
+    generator = PasswordGenerator::for_record(own, header, fallback);
+    assert(generator.has_value());
+    auto hashes = generator->generate(1);
+    assert(hashes[0] == "########");
+
+    generator = PasswordGenerator::for_record(psafe3::Record {}, header, fallback);
+    assert(generator.has_value() && generator->length() == 5);
+
+    psafe3::Record unknown;
+    unknown.fields.push_back(field(RecordFieldType::PASSWORD_POLICY_NAME, "web"));
+    assert(PasswordGenerator::for_record(unknown, header, fallback).error() == psafe3::Error::invalid_policy);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_policy();
+    test_flags();
+    test_for_record();
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.h"
+#include "groups.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+using psafe3::GroupTree;
+using psafe3::HeaderFieldType;
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static psafe3::Record record(std::string_view group)
+{
+    psafe3::Record r;
+    r.fields.push_back(field(RecordFieldType::TITLE, "title"));
+    if (!group.empty())
+        r.fields.push_back(field(RecordFieldType::GROUP, group));
+    return r;
+}
+
+static void test_build()
+{
+    std::vector<psafe3::Record> records = {
+        record("Infra.DB.Prod"), // 0
+        record("Web"), // 1
+        record("Infra"), // 2
+        record(""), // 3
+        record("Infra.DB.Dev"), // 4
+        record("Infra.DB.Prod"), // 5
+        record("a\\.b.c"), // 6
+    };
+    std::vector<psafe3::HeaderField> header = {
+        field(HeaderFieldType::EMPTY_GROUPS, "Infra.DB.Staging"),
+        field(HeaderFieldType::EMPTY_GROUPS, "Archive.Old"),
+    };
+    auto tree = GroupTree::build(records, header);
+
+    // Each segment is stored once, plus the root's empty name.
+    assert(tree.segment_count() == 11);
+    assert(tree.records(GroupTree::ROOT).size() == records.size());
+    assert(tree.own_records(GroupTree::ROOT).size() == 1);
+    assert(tree.own_records(GroupTree::ROOT)[0] == 3);
+
+    std::vector<std::string_view> top;
+    for (auto id : tree.children(GroupTree::ROOT))
+        top.push_back(tree.name(id));
+    assert((top == std::vector<std::string_view> { "Archive", "Infra", "Web", "a\\.b" }));
+
+    auto infra = tree.find("Infra");
+    assert(infra);
+    assert(tree.records(*infra).size() == 4);
+    assert(tree.own_records(*infra).size() == 1 && tree.own_records(*infra)[0] == 2);
+
+    auto prod = tree.find("Infra.DB.Prod");
+    assert(prod);
+    assert(tree.path(*prod) == "Infra.DB.Prod");
+    assert(tree.node(*prod).parent == *tree.find("Infra.DB"));
+    auto prod_records = tree.records(*prod);
+    assert(prod_records.size() == 2 && prod_records[0] == 0 && prod_records[1] == 5);
+
+    auto staging = tree.find("Infra.DB.Staging");
+    assert(staging && tree.records(*staging).empty());
+    assert(tree.find("Archive.Old"));
+    assert(!tree.find("Archive.New"));
+    assert(!tree.find("Nowhere.At.All"));
+
+    auto escaped = tree.find("a\\.b.c");
+    assert(escaped && tree.records(*escaped).size() == 1);
+}
+
+static void test_load()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .group_tree = true });
+    assert(safe.has_value());
+    const auto* groups = safe->groups();
+    assert(groups);
+    auto group = groups->find("Group 1");
+    assert(group);
+    assert(groups->records(*group).size() == 1);
+    assert(groups->records(*group)[0] == 0);
+
+    auto plain = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(plain.has_value() && !plain->groups());
+
+    auto lazy = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .on_demand = true, .group_tree = true });
+    assert(!lazy.has_value());
+    assert(lazy.error() == psafe3::Error::unsupported_options);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_build();
+    test_load();
+
+    return 0;
+}
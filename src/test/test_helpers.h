@@ -0,0 +1,28 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "safe.h"
+
+// Helpers shared by the tests.
+
+inline std::vector<std::byte> pass(std::string_view s)
+{
+    const auto* p = reinterpret_cast<const std::byte*>(s.data());
+    return { p, p + s.size() };
+}
+
+// A field holding a copy of `text`, which lives until the test exits.
+template <typename E>
+psafe3::Field<E> field(E type, std::string_view text)
+{
+    static std::deque<std::string> storage;
+    auto& s = storage.emplace_back(text);
+    return { type, static_cast<uint32_t>(s.size()), { reinterpret_cast<std::byte*>(s.data()), s.size() }, {} };
+}
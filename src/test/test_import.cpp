@@ -0,0 +1,161 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "error.h"
+#include "fields.h"
+#include "import.h"
+#include "safe.h"
+#include "test_helpers.h"
+#include "writer.h"
+
+namespace fs = std::filesystem;
+using psafe3::RecordFieldType;
+
+static fs::path temp_path()
+{
+    return fs::temp_directory_path() / ("test_import." + std::to_string(::getpid()) + ".psafe3");
+}
+
+static std::string_view text(const psafe3::Record& record, RecordFieldType type)
+{
+    const auto* field = psafe3::find_field(record, type);
+    return field ? psafe3::as_string_view(field->data) : std::string_view();
+}
+
+// Write an empty safe protected by "import" to `path`.
+static bool import_to(const fs::path& path)
+{
+    auto writer = psafe3::SafeWriter::create(path, pass("import"), 4096);
+    return writer.has_value() && writer->commit().has_value();
+}
+
+static psafe3::Safe import(psafe3::ImportFormat format, std::string_view input, size_t expected)
+{
+    auto path = temp_path();
+    auto writer = psafe3::SafeWriter::create(path, pass("import"), 4096);
+    assert(writer.has_value());
+    std::istringstream in { std::string(input) };
+    psafe3::RecordImporter importer(format);
+    auto records = importer.run(in, writer->body());
+    assert(records.has_value() && *records == expected);
+    assert(writer->commit().has_value());
+
+    auto safe = psafe3::Safe::load(path, pass("import"));
+    assert(safe.has_value());
+    fs::remove(path);
+    return std::move(safe.value());
+}
+
+static void test_csv()
+{
+    auto safe = import(psafe3::ImportFormat::csv,
+        "Group,Title,Extra,Password,Notes\r\n"
+        "Web,Example,ignored,\"p,ass\"\"word\",\"two\r\nlines\"\r\n"
+        "\r\n"
+        ",Bank,,hunter2,\r\n",
+        2);
+    auto records = safe.database();
+    assert(records.size() == 2);
+    assert(text(records[0], RecordFieldType::GROUP) == "Web");
+    assert(text(records[0], RecordFieldType::TITLE) == "Example");
+    assert(text(records[0], RecordFieldType::PASSWORD) == "p,ass\"word");
+    assert(text(records[0], RecordFieldType::NOTES) == "two\nlines");
+    assert(!psafe3::find_field(records[1], RecordFieldType::GROUP));
+    assert(!psafe3::find_field(records[1], RecordFieldType::NOTES));
+    assert(text(records[1], RecordFieldType::TITLE) == "Bank");
+    assert(psafe3::find_field(records[1], RecordFieldType::CREATION_TIME));
+
+    auto a = psafe3::record_uuid(records[0]);
+    auto b = psafe3::record_uuid(records[1]);
+    assert(a && b && *a != *b);
+    assert(std::ranges::any_of(safe.header(), [](const psafe3::HeaderField& f) {
+        return f.type == psafe3::HeaderFieldType::UUID && f.data.size() == 16;
+    }));
+}
+
+static void test_ndjson()
+{
+    auto safe = import(psafe3::ImportFormat::ndjson,
+        "{\"title\": \"Caf\\u00e9 \\ud83d\\ude00\", \"username\": \"a\\\"b\", \"url\": null, \"pin\": 1234}\n"
+        "\n"
+        "{ \"TITLE\" : \"x\" , \"password\" : 42 }\n",
+        2);
+    auto records = safe.database();
+    assert(text(records[0], RecordFieldType::TITLE) == "Caf\xc3\xa9 \xf0\x9f\x98\x80");
+    assert(text(records[0], RecordFieldType::USERNAME) == "a\"b");
+    assert(!psafe3::find_field(records[0], RecordFieldType::URL));
+    assert(text(records[1], RecordFieldType::TITLE) == "x");
+    assert(text(records[1], RecordFieldType::PASSWORD) == "42");
+}
+
+static void test_malformed()
+{
+    auto path = temp_path();
+    {
+        auto writer = psafe3::SafeWriter::create(path, pass("import"), 4096);
+        assert(writer.has_value());
+        std::istringstream in("{\"title\": \"ok\"}\n{\"title\": [1]}\n");
+        psafe3::RecordImporter importer(psafe3::ImportFormat::ndjson);
+        auto records = importer.run(in, writer->body());
+        assert(!records.has_value());
+        assert(records.error() == psafe3::Error::malformed_input);
+        assert(importer.line() == 2);
+    }
+    // Never committed: neither the safe nor the temporary file is left.
+    assert(!fs::exists(path));
+    for (const auto& entry : fs::directory_iterator(fs::temp_directory_path()))
+        assert(!entry.path().filename().string().starts_with(path.filename().string()));
+
+    std::istringstream in("title\n\"unterminated\n");
+    auto writer = psafe3::SafeWriter::create(path, pass("import"), 4096);
+    assert(writer.has_value());
+    psafe3::RecordImporter importer(psafe3::ImportFormat::csv);
+    assert(!importer.run(in, writer->body()).has_value());
+
+    assert(psafe3::SafeWriter::create(path, pass("import"), 16).error() == psafe3::Error::invalid_iterations);
+}
+
+// An existing safe is only replaced on request.
+static void test_existing()
+{
+    auto path = temp_path();
+    assert(import_to(path));
+    assert(psafe3::SafeWriter::create(path, pass("other"), 4096).error() == std::errc::file_exists);
+
+    // A file that appears while the writer is open is not replaced either.
+    auto late = temp_path().string() + ".late";
+    auto writer = psafe3::SafeWriter::create(late, pass("other"), 4096);
+    assert(writer.has_value());
+    fs::copy_file(path, late);
+    assert(writer->commit().error() == std::errc::file_exists);
+    assert(psafe3::Safe::load(late, pass("import")).has_value());
+    fs::remove(late);
+
+    auto replacing = psafe3::SafeWriter::create(path, pass("other"), 4096, {}, true);
+    assert(replacing.has_value() && replacing->commit().has_value());
+    assert(psafe3::Safe::load(path, pass("other")).has_value());
+    fs::remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_csv();
+    test_ndjson();
+    test_malformed();
+    test_existing();
+
+    return 0;
+}
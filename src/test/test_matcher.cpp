@@ -0,0 +1,91 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "matcher.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+using psafe3::FuzzyMatcher;
+using psafe3::RecordFieldType;
+
+static psafe3::Record record(std::string_view title, std::string_view user)
+{
+    psafe3::Record r;
+    r.fields.push_back(field(RecordFieldType::TITLE, title));
+    r.fields.push_back(field(RecordFieldType::USERNAME, user));
+    r.fields.push_back(field(RecordFieldType::PASSWORD, "hunter2"));
+    return r;
+}
+
+static void test_query()
+{
+    std::vector<psafe3::Record> records = {
+        record("GitHub", "octocat"), // 0
+        record("GitLab", "tanuki"), // 1
+        record("Gmail", "someone@example.com"), // 2
+        record("Digital Ocean", "droplet"), // 3
+        record("Bank", "me"), // 4
+    };
+    auto matcher = FuzzyMatcher::build(records);
+
+    auto matches = matcher.query("g", 10);
+    assert(matcher.matched() == 4);
+    assert(matches.size() == 4);
+    // Word starts beat letters in the middle of a word.
+    assert(matches.back().record == 3);
+
+    matches = matcher.query("git", 10);
+    assert(matcher.matched() == 3);
+    assert(matches[0].record == 0 && matches[1].record == 1 && matches[2].record == 3);
+
+    matches = matcher.query("GitH", 10);
+    assert(matcher.matched() == 1);
+    assert(matches.size() == 1 && matches[0].record == 0);
+
+    // Not an extension of the last query: everything is scored again. The
+    // match may span fields ("gitlab tanuki"), but scores lower.
+    matches = matcher.query("bank", 10);
+    assert(matches.size() == 2 && matches[0].record == 4 && matches[1].record == 1);
+
+    // Only the chosen fields are searched; passwords are not.
+    matches = matcher.query("octo", 10);
+    assert(matches.size() == 1 && matches[0].record == 0);
+    assert(matcher.query("hunter2", 10).empty());
+    matches = matcher.query("", 2);
+    assert(matcher.matched() == records.size());
+    assert(matches.size() == 2);
+
+    matches = matcher.query("zzz", 10);
+    assert(matches.empty() && matcher.matched() == 0);
+}
+
+static void test_top_k()
+{
+    std::vector<psafe3::Record> records;
+    for (int i = 0; i < 100; ++i)
+        records.push_back(record("Server " + std::to_string(i), "root"));
+    auto matcher = FuzzyMatcher::build(records);
+
+    auto matches = matcher.query("server 4", 3);
+    assert(matcher.matched() == 100 - 81);
+    assert(matches.size() == 3);
+    // "Server 4" itself is the best match.
+    assert(matches[0].record == 4);
+    for (size_t i = 1; i < matches.size(); ++i)
+        assert(matches[i - 1].score >= matches[i].score);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_query();
+    test_top_k();
+
+    return 0;
+}
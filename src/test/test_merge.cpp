@@ -0,0 +1,140 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fields.h"
+#include "merge.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+using psafe3::Record;
+using psafe3::RecordChange;
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+// Set the field of `type` to `value`, adding it if missing. `value` must
+// outlive the record.
+static void set_field(Record& record, RecordFieldType type, std::string& value)
+{
+    std::span<std::byte> data { reinterpret_cast<std::byte*>(value.data()), value.size() };
+    for (auto& field : record.fields) {
+        if (field.type == type) {
+            field.data = data;
+            field.len = static_cast<uint32_t>(value.size());
+            return;
+        }
+    }
+    record.fields.push_back({ type, static_cast<uint32_t>(value.size()), data, {} });
+}
+
+static std::string_view field_text(const Record& record, RecordFieldType type)
+{
+    const auto* field = psafe3::find_field(record, type);
+    return field ? psafe3::as_string_view(field->data) : std::string_view {};
+}
+
+static void test_diff()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    assert(psafe3::diff(*safe, *safe).empty());
+
+    std::vector<Record> base(safe->database().begin(), safe->database().end());
+    auto after = base;
+    std::string title = "Arcade, retitled";
+    set_field(after[0], RecordFieldType::TITLE, title);
+    std::swap(after[0].fields.front(), after[0].fields.back());
+    after.pop_back();
+
+    auto changes = psafe3::diff(base, after);
+    assert(changes.size() == 2);
+    assert(changes[0].kind == RecordChange::Kind::modified);
+    assert(changes[0].fields.size() == 1);
+    assert(changes[0].fields[0].type == RecordFieldType::TITLE);
+    assert(psafe3::as_string_view(changes[0].fields[0].after->data) == title);
+    assert(changes[1].kind == RecordChange::Kind::removed);
+    assert(changes[1].before == &base[1]);
+
+    changes = psafe3::diff(after, base);
+    assert(changes.size() == 2);
+    assert(changes[1].kind == RecordChange::Kind::added);
+}
+
+static void test_reordered()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    std::vector<Record> base(safe->database().begin(), safe->database().end());
+
+    // Same fields in another order: unchanged.
+    auto after = base;
+    std::swap(after[0].fields.front(), after[0].fields.back());
+    assert(psafe3::diff(base, after).empty());
+
+    // Theirs gains a second title; ours is untouched, so theirs is kept
+    // whole.
+    std::string extra = "Extra title";
+    after[1].fields.push_back({ RecordFieldType::TITLE, static_cast<uint32_t>(extra.size()),
+        { reinterpret_cast<std::byte*>(extra.data()), extra.size() }, {} });
+    auto merged = psafe3::merge(base, base, after);
+    assert(merged.records.size() == 2);
+    assert(merged.records[1].fields.size() == base[1].fields.size() + 1);
+}
+
+static void test_merge()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    std::vector<Record> base(safe->database().begin(), safe->database().end());
+
+    // We retitle the first record; they add a note to it and delete the
+    // second.
+    auto ours = base;
+    auto theirs = base;
+    std::string title = "Arcade, retitled";
+    std::string notes = "High score: 12345";
+    set_field(ours[0], RecordFieldType::TITLE, title);
+    set_field(theirs[0], RecordFieldType::NOTES, notes);
+    theirs.pop_back();
+
+    auto merged = psafe3::merge(base, ours, theirs);
+    assert(merged.conflicts.empty());
+    assert(merged.records.size() == 1);
+    assert(field_text(merged.records[0], RecordFieldType::TITLE) == title);
+    assert(field_text(merged.records[0], RecordFieldType::NOTES) == notes);
+
+    // They retitle it too, differently: ours wins and the conflict is
+    // reported.
+    std::string their_title = "Games";
+    set_field(theirs[0], RecordFieldType::TITLE, their_title);
+    merged = psafe3::merge(base, ours, theirs);
+    assert(merged.conflicts.size() == 1);
+    assert(merged.conflicts[0].type == RecordFieldType::TITLE);
+    assert(field_text(merged.records[0], RecordFieldType::TITLE) == title);
+
+    // They modify the record we deleted.
+    ours.pop_back();
+    theirs = base;
+    set_field(theirs[1], RecordFieldType::NOTES, notes);
+    merged = psafe3::merge(base, ours, theirs);
+    assert(merged.records.size() == 2);
+    assert(merged.conflicts.size() == 1);
+    assert(merged.conflicts[0].type == RecordFieldType::END_OF_ENTRY);
+    assert(merged.conflicts[0].ours == nullptr);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_diff();
+    test_reordered();
+    test_merge();
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "error.h"
+#include "executor.h"
+#include "peek.h"
+#include "prologue.h"
+#include "safe.h"
+#include "test_helpers.h"
+#include "writer.h"
+
+namespace fs = std::filesystem;
+using psafe3::HeaderFieldType;
+
+static const fs::path TEST_SAFE = fs::path(TEST_DATA_DIR) / "test.psafe3";
+
+static bool same_fields(std::span<const psafe3::HeaderField> a, std::span<const psafe3::HeaderField> b)
+{
+    return std::ranges::equal(a, b, [](const psafe3::HeaderField& x, const psafe3::HeaderField& y) {
+        return x.type == y.type && std::ranges::equal(x.data, y.data);
+    });
+}
+
+static void test_peek()
+{
+    auto safe = psafe3::Safe::load(TEST_SAFE, pass("Open sesame!"));
+    assert(safe.has_value());
+    auto header = psafe3::peek_header(TEST_SAFE, pass("Open sesame!"));
+    assert(header.has_value());
+    assert(header->fields().size() == 10);
+    assert(same_fields(header->fields(), safe->header()));
+    assert(header->bytes_read() <= psafe3::PROLOGUE_SIZE + psafe3::PEEK_SIZE);
+
+    auto wrong = psafe3::peek_header(TEST_SAFE, pass("Open sesame"));
+    assert(!wrong && wrong.error() == psafe3::Error::invalid_pass_phrase);
+    auto missing = psafe3::peek_header(TEST_SAFE.string() + ".missing", pass("Open sesame!"));
+    assert(!missing && missing.error() == std::errc::no_such_file_or_directory);
+}
+
+// A header larger than one read, followed by records that are never read.
+static void test_large_header()
+{
+    auto path = fs::temp_directory_path() / ("test_peek." + std::to_string(::getpid()) + ".psafe3");
+    std::vector<std::byte> description(3 * psafe3::PEEK_SIZE, std::byte { 'd' });
+    std::vector<psafe3::HeaderField> extra {
+        { HeaderFieldType::DATABASE_DESCRIPTION, static_cast<uint32_t>(description.size()), description, {} },
+    };
+    auto writer = psafe3::SafeWriter::create(path, pass("peek"), 4096, extra);
+    assert(writer.has_value());
+    std::vector<std::byte> notes(64 * 1024, std::byte { 'n' });
+    for (int i = 0; i < 16; ++i) {
+        assert(!writer->body().write_field(static_cast<uint8_t>(psafe3::RecordFieldType::NOTES), notes));
+        assert(!writer->body().end_entry());
+    }
+    assert(writer->commit().has_value());
+
+    auto header = psafe3::peek_header(path, pass("peek"));
+    assert(header.has_value());
+    auto fields = header->fields();
+    auto it = std::ranges::find(fields, HeaderFieldType::DATABASE_DESCRIPTION, &psafe3::HeaderField::type);
+    assert(it != fields.end() && std::ranges::equal(it->data, description));
+    assert(header->bytes_read() < psafe3::PROLOGUE_SIZE + 8 * psafe3::PEEK_SIZE);
+    assert(header->bytes_read() < fs::file_size(path) / 64);
+    fs::remove(path);
+}
+
+static void test_batch()
+{
+    auto good = pass("Open sesame!");
+    auto bad = pass("wrong");
+    std::vector<psafe3::PeekRequest> requests;
+    for (int i = 0; i < 6; ++i)
+        requests.push_back({ TEST_SAFE, i == 3 ? std::span<const std::byte>(bad) : std::span<const std::byte>(good) });
+    requests.push_back({ TEST_SAFE.string() + ".missing", good });
+
+    psafe3::ThreadExecutor executor(3);
+    auto results = psafe3::peek_headers(requests, { .executor = &executor });
+    assert(results.size() == requests.size());
+    for (size_t i = 0; i < 6; ++i) {
+        if (i == 3) {
+            assert(!results[i] && results[i].error() == psafe3::Error::invalid_pass_phrase);
+            continue;
+        }
+        assert(results[i].has_value());
+        assert(same_fields(results[i]->fields(), results[0]->fields()));
+    }
+    assert(!results[6]);
+    assert(psafe3::peek_headers({}).empty());
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    test_peek();
+    test_large_header();
+    test_batch();
+    return 0;
+}
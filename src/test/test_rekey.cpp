@@ -0,0 +1,177 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "peek.h"
+#include "safe.h"
+#include "test_helpers.h"
+#include "verify.h"
+
+namespace fs = std::filesystem;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static fs::path scratch_copy()
+{
+    auto path = fs::temp_directory_path() / ("test_rekey." + std::to_string(::getpid()) + ".psafe3");
+    fs::copy_file(TEST_PSAFE3, path, fs::copy_options::overwrite_existing);
+    return path;
+}
+
+static std::vector<char> read_file(const fs::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+}
+
+static void test_rekey_roundtrip()
+{
+    auto path = scratch_copy();
+    auto before = read_file(path);
+
+    auto result = psafe3::rekey(path, pass("Open sesame!"), pass("Close sesame!"), 4096);
+    assert(result.has_value());
+    assert(!fs::exists(path.string() + ".rekey"));
+
+    auto after = read_file(path);
+    assert(after.size() == before.size());
+    // Only SALT..B4 change; the IV and body are untouched.
+    assert(std::memcmp(after.data(), before.data(), 4) == 0);
+    assert(std::memcmp(after.data() + 136, before.data() + 136, before.size() - 136) == 0);
+
+    auto old_load = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(!old_load.has_value());
+    assert(old_load.error() == psafe3::Error::invalid_pass_phrase);
+
+    auto new_load = psafe3::Safe::load(path, pass("Close sesame!"));
+    assert(new_load.has_value());
+    assert(new_load->database().size() == 2);
+
+    fs::remove(path);
+}
+
+static void test_rekey_wrong_pass()
+{
+    auto path = scratch_copy();
+    auto result = psafe3::rekey(path, pass("wrong"), pass("Close sesame!"), 4096);
+    assert(!result.has_value());
+    assert(result.error() == psafe3::Error::invalid_pass_phrase);
+
+    result = psafe3::rekey(path, pass("Open sesame!"), pass("Close sesame!"), 16);
+    assert(!result.has_value());
+    assert(result.error() == psafe3::Error::invalid_iterations);
+    fs::remove(path);
+}
+
+// Write the journal rekey() leaves behind if it is interrupted.
+static void write_journal(const fs::path& path, const std::vector<char>& original, const std::vector<char>& updated)
+{
+    std::vector<char> prologues(original.begin(), original.begin() + 152);
+    prologues.insert(prologues.end(), updated.begin(), updated.begin() + 152);
+    auto hash = psafe3::sha256(std::span(reinterpret_cast<const std::byte*>(prologues.data()), prologues.size()));
+    assert(hash.has_value());
+    std::ofstream journal(path.string() + ".rekey", std::ios::binary);
+    journal.write(prologues.data(), static_cast<std::streamsize>(prologues.size()));
+    journal.write(reinterpret_cast<const char*>(hash->data()), static_cast<std::streamsize>(hash->size()));
+}
+
+// A crash after the new prologue was synced but before the journal was
+// removed: the rekey stands.
+static void test_rekey_survives_journal()
+{
+    auto path = scratch_copy();
+    auto original = read_file(path);
+    assert(psafe3::rekey(path, pass("Open sesame!"), pass("Close sesame!"), 4096).has_value());
+    auto updated = read_file(path);
+    write_journal(path, original, updated);
+
+    assert(psafe3::Safe::load(path, pass("Close sesame!")).has_value());
+    assert(psafe3::rekey(path, pass("Close sesame!"), pass("Other"), 4096).has_value());
+    assert(!fs::exists(path.string() + ".rekey"));
+    assert(psafe3::Safe::load(path, pass("Other")).has_value());
+
+    fs::remove(path);
+}
+
+// A crash while the new prologue was being written: the original prologue
+// is restored.
+static void test_rekey_recovers_torn_prologue()
+{
+    auto path = scratch_copy();
+    auto original = read_file(path);
+    assert(psafe3::rekey(path, pass("Open sesame!"), pass("Close sesame!"), 4096).has_value());
+    auto updated = read_file(path);
+    write_journal(path, original, updated);
+
+    auto torn = original;
+    std::copy(updated.begin(), updated.begin() + 80, torn.begin());
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(torn.data(), static_cast<std::streamsize>(torn.size()));
+    }
+
+    auto result = psafe3::rekey(path, pass("Close sesame!"), pass("Other"), 4096);
+    assert(!result.has_value());
+    assert(result.error() == psafe3::Error::invalid_pass_phrase);
+    assert(!fs::exists(path.string() + ".rekey"));
+    assert(read_file(path) == original);
+    assert(psafe3::Safe::load(path, pass("Open sesame!")).has_value());
+
+    fs::remove(path);
+}
+
+// Readers recover a torn prologue too, without waiting for another rekey.
+static void test_readers_recover_torn_prologue()
+{
+    auto path = scratch_copy();
+    auto original = read_file(path);
+    assert(psafe3::rekey(path, pass("Open sesame!"), pass("Close sesame!"), 4096).has_value());
+    auto updated = read_file(path);
+    auto tear = [&] {
+        write_journal(path, original, updated);
+        auto torn = original;
+        std::copy(updated.begin(), updated.begin() + 80, torn.begin());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(torn.data(), static_cast<std::streamsize>(torn.size()));
+    };
+
+    tear();
+    assert(psafe3::Safe::load(path, pass("Open sesame!")).has_value());
+    assert(!fs::exists(path.string() + ".rekey"));
+    assert(read_file(path) == original);
+
+    tear();
+    assert(psafe3::verify(path, pass("Open sesame!"), psafe3::VerifyLevel::integrity).has_value());
+    assert(read_file(path) == original);
+
+    tear();
+    assert(psafe3::peek_header(path, pass("Open sesame!")).has_value());
+    assert(read_file(path) == original);
+    assert(!fs::exists(path.string() + ".rekey"));
+
+    fs::remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_rekey_roundtrip();
+    test_rekey_wrong_pass();
+    test_rekey_survives_journal();
+    test_rekey_recovers_torn_prologue();
+    test_readers_recover_torn_prologue();
+
+    return 0;
+}
@@ -0,0 +1,327 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "safe.h"
+#include "test_helpers.h"
+
+namespace fs = std::filesystem;
+
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static fs::path scratch_copy(std::string_view name)
+{
+    auto path = fs::temp_directory_path() / (std::string(name) + "." + std::to_string(::getpid()) + ".psafe3");
+    fs::copy_file(TEST_PSAFE3, path, fs::copy_options::overwrite_existing);
+    return path;
+}
+
+static std::string_view text(std::span<const std::byte> data)
+{
+    return { reinterpret_cast<const char*>(data.data()), data.size() };
+}
+
+static std::string_view field_text(const psafe3::Record& record, RecordFieldType type)
+{
+    for (const auto& field : record.fields) {
+        if (field.type == type)
+            return text(field.data);
+    }
+    return {};
+}
+
+static void test_load()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    assert(safe->header().size() == 10);
+    assert(safe->database().size() == 2);
+    assert(field_text(safe->database()[0], RecordFieldType::TITLE) == "Arcade");
+    assert(field_text(safe->database()[1], RecordFieldType::TITLE) == "Account #1");
+
+    auto wrong = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame?"));
+    assert(!wrong.has_value());
+    assert(wrong.error() == psafe3::Error::invalid_pass_phrase);
+}
+
+static void test_save_tail()
+{
+    auto path = scratch_copy("test_save_tail");
+    auto safe = psafe3::Safe::load(path, pass("Open sesame!"), { .checkpoint_interval = 1 });
+    assert(safe.has_value());
+
+    // Retitle the last record and append a copy of it.
+    std::string title = "Account #2, renamed to something longer than a block";
+    psafe3::Record changed = safe->database()[1];
+    for (auto& field : changed.fields) {
+        if (field.type == RecordFieldType::TITLE) {
+            field.data = { reinterpret_cast<std::byte*>(title.data()), title.size() };
+            field.len = static_cast<uint32_t>(title.size());
+        }
+    }
+    std::vector<psafe3::Record> tail = { changed, safe->database()[1] };
+    auto saved = safe->save_tail(path, 1, tail);
+    assert(saved.has_value());
+
+    // The safe must be reloaded before it can save again.
+    auto again = safe->save_tail(path, 1, tail);
+    assert(!again.has_value());
+    assert(again.error() == psafe3::Error::no_checkpoint);
+
+    auto reloaded = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(reloaded.has_value());
+    assert(reloaded->database().size() == 3);
+    assert(field_text(reloaded->database()[0], RecordFieldType::TITLE) == "Arcade");
+    assert(field_text(reloaded->database()[1], RecordFieldType::TITLE) == title);
+    assert(field_text(reloaded->database()[2], RecordFieldType::TITLE) == "Account #1");
+
+    fs::remove(path);
+}
+
+static std::vector<std::byte> read_file(const fs::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    auto* p = reinterpret_cast<const std::byte*>(bytes.data());
+    return { p, p + bytes.size() };
+}
+
+static void write_file(const fs::path& path, std::span<const std::byte> bytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+// The journal save_tail() leaves behind if it is interrupted, holding the
+// original bytes from `start` on.
+static std::vector<std::byte> tail_journal(std::span<const std::byte> original, size_t start)
+{
+    std::vector<std::byte> journal(16);
+    for (size_t i = 0; i < 8; ++i) {
+        journal[i] = static_cast<std::byte>(uint64_t { start } >> (8 * i));
+        journal[8 + i] = static_cast<std::byte>(uint64_t { original.size() } >> (8 * i));
+    }
+    journal.insert(journal.end(), original.begin() + static_cast<ptrdiff_t>(start), original.end());
+    auto hash = psafe3::sha256(journal);
+    assert(hash.has_value());
+    journal.insert(journal.end(), hash->begin(), hash->end());
+    return journal;
+}
+
+// A save interrupted part way through the new tail is undone by the next load.
+static void test_save_tail_interrupted()
+{
+    auto path = scratch_copy("test_save_tail_interrupted");
+    auto journal_path = path.string() + ".tail";
+    auto original = read_file(path);
+    auto safe = psafe3::Safe::load(path, pass("Open sesame!"), { .checkpoint_interval = 1 });
+    assert(safe.has_value());
+    std::vector<psafe3::Record> tail = { safe->database()[1], safe->database()[0], safe->database()[1] };
+    assert(safe->save_tail(path, 1, tail).has_value());
+    assert(!fs::exists(journal_path));
+    auto updated = read_file(path);
+    assert(updated.size() > original.size());
+
+    // Torn: the new tail was cut short before the HMAC was written.
+    auto journal = tail_journal(original, 152);
+    write_file(journal_path, journal);
+    write_file(path, std::span(updated).first(updated.size() - 48));
+    auto recovered = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(recovered.has_value());
+    assert(recovered->database().size() == 2);
+    assert(!fs::exists(journal_path));
+    assert(read_file(path) == original);
+
+    // A journal cut short was never followed by a write to the safe, and
+    // is discarded without touching it.
+    write_file(journal_path, std::span(journal).first(journal.size() - 1));
+    write_file(path, updated);
+    auto kept = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(kept.has_value() && kept->database().size() == 4);
+    assert(!fs::exists(journal_path));
+
+    fs::remove(path);
+}
+
+static void test_save_tail_requires_checkpoints()
+{
+    auto path = scratch_copy("test_save_tail_stale");
+    auto plain = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(plain.has_value());
+    auto result = plain->save_tail(path, 0, {});
+    assert(!result.has_value());
+    assert(result.error() == psafe3::Error::no_checkpoint);
+
+    auto safe = psafe3::Safe::load(path, pass("Open sesame!"), { .checkpoint_interval = 4096 });
+    assert(safe.has_value());
+    fs::resize_file(path, fs::file_size(path) + 16);
+    result = safe->save_tail(path, 0, {});
+    assert(!result.has_value());
+    assert(result.error() == psafe3::Error::stale_checkpoint);
+
+    fs::remove(path);
+}
+
+static void test_on_demand()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .on_demand = true, .cache_budget = 1 });
+    assert(safe.has_value());
+    assert(safe->header().size() == 10);
+    assert(safe->database().empty());
+    assert(safe->record_count() == 2);
+
+    auto first = safe->fetch(0);
+    assert(first.has_value());
+    auto second = safe->fetch(1);
+    assert(second.has_value());
+    // The first record has been evicted but is still held by `first`.
+    assert(field_text(**first, RecordFieldType::TITLE) == "Arcade");
+    assert(field_text(**second, RecordFieldType::TITLE) == "Account #1");
+    assert(!safe->fetch(2).has_value());
+
+    auto again = safe->fetch(1);
+    assert(again.has_value());
+    assert(again->get() == second->get());
+
+    auto both = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .checkpoint_interval = 1, .on_demand = true });
+    assert(!both.has_value());
+    assert(both.error() == psafe3::Error::unsupported_options);
+
+    // Checked before the file is even opened.
+    auto early = psafe3::Safe::load("/nonexistent.psafe3", pass("Open sesame!"), { .on_demand = true, .group_tree = true });
+    assert(!early.has_value());
+    assert(early.error() == psafe3::Error::unsupported_options);
+}
+
+static void test_release_mapping()
+{
+    auto path = scratch_copy("test_release_mapping");
+    auto safe = psafe3::Safe::load(path, pass("Open sesame!"), { .checkpoint_interval = 1, .release_mapping = true });
+    assert(safe.has_value());
+    assert(safe->header().size() == 10);
+    assert(safe->database().size() == 2);
+    assert(field_text(safe->database()[0], RecordFieldType::TITLE) == "Arcade");
+
+    std::vector<psafe3::Record> tail = { safe->database()[0] };
+    assert(safe->save_tail(path, 1, tail).has_value());
+    auto reloaded = psafe3::Safe::load(path, pass("Open sesame!"));
+    assert(reloaded.has_value());
+    assert(reloaded->database().size() == 2);
+    assert(field_text(reloaded->database()[1], RecordFieldType::TITLE) == "Arcade");
+
+    auto both = psafe3::Safe::load(path, pass("Open sesame!"), { .on_demand = true, .release_mapping = true });
+    assert(!both.has_value());
+    assert(both.error() == psafe3::Error::unsupported_options);
+
+    fs::remove(path);
+}
+
+static void test_stretch_limits()
+{
+    auto limited = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .stretch = { .max_iterations = 10 } });
+    assert(!limited.has_value());
+    assert(limited.error() == psafe3::Error::too_many_iterations);
+
+    std::stop_source stop;
+    stop.request_stop();
+    auto cancelled = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .stretch = { .stop_token = stop.get_token() } });
+    assert(!cancelled.has_value());
+    assert(cancelled.error() == psafe3::Error::cancelled);
+
+    auto late = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"),
+        { .stretch = { .deadline = std::chrono::steady_clock::now() } });
+    assert(!late.has_value());
+    assert(late.error() == psafe3::Error::deadline_exceeded);
+
+    uint32_t last_done = 0, last_total = 0;
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"),
+        { .stretch = {
+              .deadline = std::chrono::steady_clock::now() + std::chrono::minutes(1),
+              .progress = [&](uint32_t done, uint32_t total) {
+                  assert(done > last_done);
+                  last_done = done;
+                  last_total = total;
+              },
+          } });
+    assert(safe.has_value());
+    assert(last_total > 0 && last_done == last_total);
+}
+
+static bool all_zero(std::span<const std::byte> data)
+{
+    return std::ranges::all_of(data, [](std::byte b) { return b == std::byte { 0 }; });
+}
+
+static void test_projection()
+{
+    psafe3::LoadOptions options {
+        .header_fields = psafe3::field_mask({ psafe3::HeaderFieldType::VERSION }),
+        .record_fields = psafe3::field_mask({ RecordFieldType::UUID, RecordFieldType::TITLE }),
+    };
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(safe.has_value());
+    assert(safe->header().size() == 1);
+    assert(safe->header()[0].type == psafe3::HeaderFieldType::VERSION);
+    for (const auto& record : safe->database()) {
+        assert(record.fields.size() == 2);
+        assert(record.fields[0].type == RecordFieldType::UUID);
+    }
+    assert(field_text(safe->database()[0], RecordFieldType::TITLE) == "Arcade");
+    assert(field_text(safe->database()[0], RecordFieldType::GROUP).empty());
+    assert(text(safe->database()[0].data).find("Group 1") != std::string_view::npos);
+
+    // Left-out fields are gone from the plaintext; kept ones are intact.
+    options.wipe_unprojected = true;
+    auto wiped = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(wiped.has_value());
+    auto data = text(wiped->database()[0].data);
+    assert(data.find("Group 1") == std::string_view::npos);
+    assert(!all_zero(wiped->database()[0].fields[1].data));
+
+    options.on_demand = true;
+    auto lazy = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), options);
+    assert(lazy.has_value());
+    assert(lazy->header().size() == 1);
+    auto record = lazy->fetch(0);
+    assert(record.has_value());
+    assert((*record)->fields.size() == 2);
+    assert(text((*record)->data).find("Group 1") == std::string_view::npos);
+
+    auto checkpoints = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"),
+        { .checkpoint_interval = 1, .record_fields = psafe3::field_mask({ RecordFieldType::TITLE }) });
+    assert(!checkpoints.has_value());
+    assert(checkpoints.error() == psafe3::Error::unsupported_options);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_load();
+    test_save_tail();
+    test_save_tail_interrupted();
+    test_save_tail_requires_checkpoints();
+    test_on_demand();
+    test_release_mapping();
+    test_stretch_limits();
+    test_projection();
+
+    return 0;
+}
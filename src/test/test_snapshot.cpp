@@ -0,0 +1,101 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <string_view>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "snapshot.h"
+#include "test_helpers.h"
+
+using psafe3::RecordFieldType;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+static std::string_view text(std::span<const std::byte> data)
+{
+    return { reinterpret_cast<const char*>(data.data()), data.size() };
+}
+
+static bool view_matches(const psafe3::SafeView& view)
+{
+    return view.header().size() == 10
+        && view.record_count() == 2
+        && text(*view.find(0, RecordFieldType::TITLE)) == "Arcade"
+        && text(*view.find(0, RecordFieldType::GROUP)) == "Group 1"
+        && text(*view.find(1, RecordFieldType::TITLE)) == "Account #1"
+        && !view.find(1, RecordFieldType::GROUP);
+}
+
+static void test_share()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"));
+    assert(safe.has_value());
+    auto fd = psafe3::export_snapshot(*safe);
+    assert(fd.has_value());
+
+    // Sealed: nobody can change it any more.
+    std::byte b {};
+    assert(::pwrite(fd->get(), &b, 1, 0) < 0);
+
+    int sockets[2];
+    assert(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    pid_t child = ::fork();
+    assert(child >= 0);
+    if (child == 0) {
+        ::close(sockets[0]);
+        auto received = psafe3::receive_fd(sockets[1]);
+        if (!received)
+            ::_exit(1);
+        auto view = psafe3::SafeView::map(received->get());
+        ::_exit(view && view_matches(*view) ? 0 : 2);
+    }
+    ::close(sockets[1]);
+    assert(!psafe3::send_fd(sockets[0], fd->get()));
+    int status;
+    assert(::waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ::close(sockets[0]);
+
+    auto view = psafe3::SafeView::map(fd->get());
+    assert(view.has_value());
+    assert(view_matches(*view));
+}
+
+static void test_on_demand()
+{
+    auto safe = psafe3::Safe::load(TEST_PSAFE3, pass("Open sesame!"), { .on_demand = true });
+    assert(safe.has_value());
+    auto fd = psafe3::export_snapshot(*safe);
+    assert(fd.has_value());
+    auto view = psafe3::SafeView::map(fd->get());
+    assert(view.has_value());
+    assert(view_matches(*view));
+}
+
+static void test_unsealed()
+{
+    psafe3::FileDescriptor fd(::memfd_create("unsealed", MFD_CLOEXEC));
+    assert(fd);
+    assert(::ftruncate(fd.get(), 4096) == 0);
+    auto view = psafe3::SafeView::map(fd.get());
+    assert(!view.has_value());
+    assert(view.error() == psafe3::Error::invalid_snapshot);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_share();
+    test_on_demand();
+    test_unsealed();
+
+    return 0;
+}
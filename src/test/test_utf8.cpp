@@ -0,0 +1,112 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "safe.h"
+#include "test_helpers.h"
+#include "utf8.h"
+
+using namespace psafe3;
+
+static std::span<const std::byte> bytes(std::string_view s)
+{
+    return { reinterpret_cast<const std::byte*>(s.data()), s.size() };
+}
+
+static void test_validate()
+{
+    assert(valid_utf8(bytes("")));
+    assert(valid_utf8(bytes("plain ASCII")));
+    assert(valid_utf8(bytes("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x94\x91")));
+    assert(valid_utf8(bytes("\xed\x9f\xbf\xee\x80\x80\xf4\x8f\xbf\xbf")));
+
+    // Overlong, surrogate, past U+10FFFF, truncated, stray continuation.
+    assert(utf8_valid_prefix(bytes("ab\xc0\xaf")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xe0\x80\xaf")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xf0\x80\x80\xaf")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xed\xa0\x80")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xf4\x90\x80\x80")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xf5\x80\x80\x80")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\xe2\x82")) == 2);
+    assert(utf8_valid_prefix(bytes("ab\x80")) == 2);
+    assert(utf8_valid_prefix(bytes("\xc3\xa9\xc3")) == 2);
+}
+
+// Errors at every position of a long buffer, so that each lands in a
+// different part of the vector loops.
+static void test_positions()
+{
+    std::string text(200, 'x');
+    assert(valid_utf8(bytes(text)));
+    for (size_t i = 0; i < text.size(); ++i) {
+        auto bad = text;
+        bad[i] = '\xff';
+        assert(utf8_valid_prefix(bytes(bad)) == i);
+        if (i + 2 <= text.size()) {
+            auto good = text;
+            good[i] = '\xc3';
+            good[i + 1] = '\xa9';
+            assert(valid_utf8(bytes(good)));
+        }
+    }
+}
+
+static void test_lossy()
+{
+    assert(utf8_lossy(bytes("caf\xc3\xa9")) == "caf\xc3\xa9");
+    assert(utf8_lossy(bytes("a\xff" "b\xc3")) == "a\xef\xbf\xbd" "b\xef\xbf\xbd");
+    assert(valid_utf8(bytes(utf8_lossy(bytes("\xed\xa0\x80")))));
+}
+
+static void test_fields()
+{
+    std::string title = "caf\xc3\xa9";
+    RecordField field { RecordFieldType::TITLE, 5, { reinterpret_cast<std::byte*>(title.data()), title.size() }, {} };
+    assert(field.utf8 == Utf8::unchecked);
+    assert(as_u8string_view(field) == std::u8string_view(u8"café"));
+    assert(check_utf8(field) == Utf8::valid);
+
+    title[3] = '\x80';
+    field.utf8 = Utf8::unchecked;
+    assert(!as_u8string_view(field));
+    assert(check_utf8(field) == Utf8::invalid);
+
+    assert(is_text(RecordFieldType::NOTES));
+    assert(!is_text(RecordFieldType::UUID));
+    assert(is_text(HeaderFieldType::DATABASE_NAME));
+    assert(!is_text(HeaderFieldType::TIMESTAMP_OF_LAST_SAVE));
+}
+
+static void test_load()
+{
+    auto safe = Safe::load(TEST_DATA_DIR "/test.psafe3", pass("Open sesame!"));
+    assert(safe.has_value());
+    for (const auto& record : safe->database()) {
+        for (const auto& field : record.fields)
+            assert(field.utf8 == (is_text(field.type) ? Utf8::valid : Utf8::unchecked));
+    }
+
+    LoadOptions options;
+    options.validate_utf8 = false;
+    auto unchecked = Safe::load(TEST_DATA_DIR "/test.psafe3", pass("Open sesame!"), options);
+    assert(unchecked.has_value());
+    for (const auto& field : unchecked->database()[0].fields)
+        assert(field.utf8 == Utf8::unchecked);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    test_validate();
+    test_positions();
+    test_lossy();
+    test_fields();
+    test_load();
+    return 0;
+}
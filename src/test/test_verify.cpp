@@ -0,0 +1,108 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cassert>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "prologue.h"
+#include "test_helpers.h"
+#include "utility.h"
+#include "verify.h"
+
+namespace fs = std::filesystem;
+
+using psafe3::VerifyLevel;
+
+static const char TEST_PSAFE3[] = TEST_DATA_DIR "/test.psafe3";
+
+// Size of the end marker and HMAC that close the file.
+static constexpr size_t EPILOGUE_SIZE = psafe3::TWOFISH_SIZE + psafe3::SHA256_SIZE;
+
+// Copy of the test safe with the byte at `offset` flipped; negative
+// offsets count from the end.
+static fs::path corrupt_copy(std::ptrdiff_t offset)
+{
+    auto path = fs::temp_directory_path() / ("test_verify." + std::to_string(::getpid()) + ".psafe3");
+    fs::copy_file(TEST_PSAFE3, path, fs::copy_options::overwrite_existing);
+    auto size = static_cast<std::ptrdiff_t>(fs::file_size(path));
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekg(offset < 0 ? size + offset : offset);
+    char c = 0;
+    file.get(c);
+    file.seekp(offset < 0 ? size + offset : offset);
+    file.put(static_cast<char>(c ^ 0x5a));
+    assert(file.good());
+    return path;
+}
+
+static std::error_code verify(const fs::path& path, VerifyLevel level)
+{
+    auto result = psafe3::verify(path, pass("Open sesame!"), level);
+    return result ? std::error_code() : result.error();
+}
+
+static void test_intact()
+{
+    for (auto level : { VerifyLevel::passphrase, VerifyLevel::integrity, VerifyLevel::full })
+        assert(!verify(TEST_PSAFE3, level));
+    auto wrong = psafe3::verify(TEST_PSAFE3, pass("Open sesame?"), VerifyLevel::passphrase);
+    assert(!wrong && wrong.error() == psafe3::Error::invalid_pass_phrase);
+}
+
+static void test_corrupt_hmac()
+{
+    auto path = corrupt_copy(-1);
+    assert(!verify(path, VerifyLevel::passphrase));
+    assert(verify(path, VerifyLevel::integrity) == psafe3::Error::hmac_mismatch);
+    assert(verify(path, VerifyLevel::full) == psafe3::Error::hmac_mismatch);
+    fs::remove(path);
+}
+
+static void test_corrupt_ciphertext()
+{
+    // A block in the middle of a field that spans several: it decrypts to
+    // garbage that still parses, so only the HMAC catches it.
+    auto path = corrupt_copy(psafe3::PROLOGUE_SIZE + 13 * psafe3::TWOFISH_SIZE + 3);
+    assert(!verify(path, VerifyLevel::passphrase));
+    assert(verify(path, VerifyLevel::integrity) == psafe3::Error::hmac_mismatch);
+    assert(verify(path, VerifyLevel::full) == psafe3::Error::hmac_mismatch);
+    fs::remove(path);
+
+    // The first block, holding the length of the first field.
+    path = corrupt_copy(psafe3::PROLOGUE_SIZE);
+    assert(!verify(path, VerifyLevel::passphrase));
+    assert(verify(path, VerifyLevel::integrity) == psafe3::Error::corrupt_file);
+    assert(verify(path, VerifyLevel::full) == psafe3::Error::corrupt_file);
+    fs::remove(path);
+}
+
+static void test_corrupt_end_marker()
+{
+    auto path = corrupt_copy(-static_cast<std::ptrdiff_t>(EPILOGUE_SIZE));
+    assert(!verify(path, VerifyLevel::passphrase));
+    assert(verify(path, VerifyLevel::integrity) == psafe3::Error::corrupt_file);
+    assert(verify(path, VerifyLevel::full) == psafe3::Error::corrupt_file);
+    fs::remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_intact();
+    test_corrupt_hmac();
+    test_corrupt_ciphertext();
+    test_corrupt_end_marker();
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "executor.h"
+#include "fields.h"
+#include "test_helpers.h"
+#include "view.h"
+
+using psafe3::RecordFieldType;
+using psafe3::RecordView;
+using psafe3::SortKey;
+
+static psafe3::Record record(uint8_t id, std::string_view group, std::string_view title)
+{
+    psafe3::Record r;
+    std::string uuid(16, '\0');
+    uuid[0] = static_cast<char>(id);
+    r.fields.push_back(field(RecordFieldType::UUID, uuid));
+    if (!group.empty())
+        r.fields.push_back(field(RecordFieldType::GROUP, group));
+    r.fields.push_back(field(RecordFieldType::TITLE, title));
+    return r;
+}
+
+static const SortKey GROUP_TITLE[] = { { RecordFieldType::GROUP }, { RecordFieldType::TITLE } };
+
+static std::vector<uint32_t> order(const RecordView& view)
+{
+    return { view.order().begin(), view.order().end() };
+}
+
+static void test_sort()
+{
+    std::vector<psafe3::Record> records = {
+        record(0, "Web", "gitlab"), // 0
+        record(1, "", "zeta"), // 1
+        record(2, "Infra.DB", "prod"), // 2
+        record(3, "Infra", "Bastion"), // 3
+        record(4, "Infra DB", "other"), // 4
+        record(5, "web", "Amazon"), // 5
+        record(6, "Infra", "bastion"), // 6
+        record(7, "", "\xc3\x89t\xc3\xa9"), // 7 "Été"
+        record(8, "", "\xc3\xa9" "a"), // 8 "éa"
+    };
+    auto view = RecordView::build(records, GROUP_TITLE);
+    // Case-insensitive, ties in file order, "Infra.DB" under "Infra" and
+    // before "Infra DB".
+    assert(order(view) == (std::vector<uint32_t> { 1, 8, 7, 3, 6, 2, 4, 5, 0 }));
+
+    assert(view.page_count(4) == 3);
+    auto page = view.page(1, 4);
+    assert((std::vector<uint32_t>(page.begin(), page.end()) == std::vector<uint32_t> { 6, 2, 4, 5 }));
+    assert(view.page(2, 4).size() == 1);
+    assert(view.page(3, 4).empty());
+    assert(view.page(0, 0).empty());
+
+    const SortKey title_desc[] = { { RecordFieldType::TITLE, true } };
+    auto desc = RecordView::build(records, title_desc);
+    assert(desc.order().front() == 7 && desc.order().back() == 5);
+
+    // Missing fields sort as empty.
+    const SortKey by_url[] = { { RecordFieldType::URL } };
+    assert(order(RecordView::build(records, by_url)) == (std::vector<uint32_t> { 0, 1, 2, 3, 4, 5, 6, 7, 8 }));
+}
+
+static void test_refresh()
+{
+    std::vector<psafe3::Record> records = {
+        record(0, "A", "one"),
+        record(1, "A", "two"),
+        record(2, "B", "three"),
+        record(3, "B", "four"),
+    };
+    auto view = RecordView::build(records, GROUP_TITLE);
+    assert(order(view) == (std::vector<uint32_t> { 0, 1, 3, 2 }));
+
+    // Record 1 dropped, 3 retitled, 4 added, the rest moved around.
+    std::vector<psafe3::Record> reloaded = {
+        record(2, "B", "three"), // 0
+        record(3, "B", "alpha"), // 1
+        record(0, "A", "one"), // 2
+        record(4, "A", "zulu"), // 3
+    };
+    assert(view.refresh(reloaded) == 2);
+    assert(order(view) == (std::vector<uint32_t> { 2, 3, 1, 0 }));
+    assert(order(view) == order(RecordView::build(reloaded, GROUP_TITLE)));
+}
+
+static void test_large()
+{
+    // Enough records to be sorted on several threads.
+    std::vector<psafe3::Record> records;
+    uint32_t x = 12345;
+    for (uint32_t i = 0; i < 40000; ++i) {
+        x = x * 1103515245 + 12345;
+        records.push_back(record(static_cast<uint8_t>(i), "", std::to_string(x % 5000)));
+    }
+    auto view = RecordView::build(records, GROUP_TITLE);
+
+    std::vector<uint32_t> expected(records.size());
+    for (uint32_t i = 0; i < expected.size(); ++i)
+        expected[i] = i;
+    auto title = [&](uint32_t i) { return psafe3::as_string_view(psafe3::find_field(records[i], RecordFieldType::TITLE)->data); };
+    std::ranges::stable_sort(expected, {}, title);
+    assert(order(view) == expected);
+
+    // An odd number of parts leaves one unpaired in the first merge round.
+    psafe3::ThreadExecutor executor(5);
+    assert(order(RecordView::build(records, GROUP_TITLE, executor)) == expected);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_sort();
+    test_refresh();
+    test_large();
+
+    return 0;
+}
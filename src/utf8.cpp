@@ -0,0 +1,153 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "safe.h"
+#include "utf8.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Length of the sequence at the start of `s`, or zero if it is
+    // ill-formed. Table 3-7 of the Unicode Standard.
+    size_t sequence_length(const uint8_t* s, size_t n) noexcept
+    {
+        uint8_t c = s[0];
+        if (c < 0x80)
+            return 1;
+        size_t len;
+        uint8_t lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf) {
+            len = 2;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            len = 3;
+            if (c == 0xe0)
+                lo = 0xa0;
+            else if (c == 0xed)
+                hi = 0x9f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            len = 4;
+            if (c == 0xf0)
+                lo = 0x90;
+            else if (c == 0xf4)
+                hi = 0x8f;
+        } else {
+            return 0;
+        }
+        if (n < len || s[1] < lo || s[1] > hi)
+            return 0;
+        for (size_t i = 2; i < len; ++i) {
+            if ((s[i] & 0xc0) != 0x80)
+                return 0;
+        }
+        return len;
+    }
+
+} // namespace
+
+size_t utf8_valid_prefix(std::span<const std::byte> data) noexcept
+{
+    const auto* s = reinterpret_cast<const uint8_t*>(data.data());
+    size_t n = data.size();
+    size_t i = 0;
+    while (i < n) {
+#if defined(__SSE2__)
+        // Skip ASCII a block at a time; text fields are mostly ASCII.
+        while (n - i >= 64) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 16));
+            auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 32));
+            auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 48));
+            if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0)
+                break;
+            i += 64;
+        }
+        while (n - i >= 16) {
+            auto mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+            if (mask != 0) {
+                i += static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+                break;
+            }
+            i += 16;
+        }
+        if (i == n)
+            break;
+#endif
+        // Then decode until the next run of ASCII.
+        do {
+            auto len = sequence_length(s + i, n - i);
+            if (len == 0)
+                return i;
+            i += len;
+        } while (i < n && s[i] >= 0x80);
+    }
+    return i;
+}
+
+bool is_text(HeaderFieldType type) noexcept
+{
+    switch (type) {
+    case HeaderFieldType::NON_DEFAULT_PREFERENCES:
+    case HeaderFieldType::TREE_DISPLAY_STATUS:
+    case HeaderFieldType::WHO_PERFORMED_LAST_SAVE:
+    case HeaderFieldType::WHAT_PERFORMED_LAST_SAVE:
+    case HeaderFieldType::LAST_SAVED_BY_USER:
+    case HeaderFieldType::LAST_SAVED_ON_HOST:
+    case HeaderFieldType::DATABASE_NAME:
+    case HeaderFieldType::DATABASE_DESCRIPTION:
+    case HeaderFieldType::DATABASE_FILTERS:
+    case HeaderFieldType::RECENTLY_USED_ENTRIES:
+    case HeaderFieldType::NAMED_PASSWORD_POLICIES:
+    case HeaderFieldType::EMPTY_GROUPS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_text(RecordFieldType type) noexcept
+{
+    switch (type) {
+    case RecordFieldType::GROUP:
+    case RecordFieldType::TITLE:
+    case RecordFieldType::USERNAME:
+    case RecordFieldType::NOTES:
+    case RecordFieldType::PASSWORD:
+    case RecordFieldType::URL:
+    case RecordFieldType::AUTOTYPE:
+    case RecordFieldType::PASSWORD_HISTORY:
+    case RecordFieldType::PASSWORD_POLICY:
+    case RecordFieldType::RUN_COMMAND:
+    case RecordFieldType::EMAIL_ADDRESS:
+    case RecordFieldType::OWN_SYMBOLS_FOR_PASSWORD:
+    case RecordFieldType::PASSWORD_POLICY_NAME:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string utf8_lossy(std::span<const std::byte> data)
+{
+    std::string out;
+    out.reserve(data.size());
+    while (!data.empty()) {
+        auto valid = utf8_valid_prefix(data);
+        out.append(reinterpret_cast<const char*>(data.data()), valid);
+        if (valid == data.size())
+            break;
+        out.append("\xef\xbf\xbd");
+        data = data.subspan(valid + 1);
+    }
+    return out;
+}
+
+} // namespace psafe3
@@ -0,0 +1,53 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "safe.h"
+
+namespace psafe3 {
+
+// Length of the longest prefix of `data` that is well-formed UTF-8 (no
+// overlong forms, surrogates or code points past U+10FFFF). Runs of ASCII
+// are checked 16 bytes at a time with SSE2 where available.
+size_t utf8_valid_prefix(std::span<const std::byte> data) noexcept;
+
+inline bool valid_utf8(std::span<const std::byte> data) noexcept
+{
+    return utf8_valid_prefix(data) == data.size();
+}
+
+// Whether fields of `type` hold text, as opposed to times, UUIDs and other
+// binary values. Only text fields are checked by Safe::load().
+bool is_text(HeaderFieldType type) noexcept;
+bool is_text(RecordFieldType type) noexcept;
+
+// Check the data of `field` and record the result in Field::utf8, unless
+// that was already done.
+template <typename E>
+Utf8 check_utf8(Field<E>& field) noexcept
+{
+    if (field.utf8 == Utf8::unchecked)
+        field.utf8 = valid_utf8(field.data) ? Utf8::valid : Utf8::invalid;
+    return field.utf8;
+}
+
+// The data of `field` as text, or std::nullopt if it is not valid UTF-8.
+// Fields checked when they were loaded are not checked again.
+template <typename E>
+std::optional<std::u8string_view> as_u8string_view(const Field<E>& field) noexcept
+{
+    if (field.utf8 == Utf8::invalid || (field.utf8 == Utf8::unchecked && !valid_utf8(field.data)))
+        return std::nullopt;
+    return std::u8string_view(reinterpret_cast<const char8_t*>(field.data.data()), field.data.size());
+}
+
+// A copy of `data` with U+FFFD in place of each byte that does not belong
+// to a well-formed sequence.
+std::string utf8_lossy(std::span<const std::byte> data);
+
+} // namespace psafe3
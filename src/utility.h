@@ -44,6 +44,14 @@ uint_from_t<N> load(std::span<const std::byte, N> mem) noexcept
     return value;
 }
 
+template <std::endian E, std::unsigned_integral T>
+void store(std::span<std::byte, sizeof(T)> mem, T value) noexcept
+{
+    if constexpr (E != std::endian::native)
+        value = std::byteswap(value);
+    std::memcpy(mem.data(), &value, sizeof(T));
+}
+
 template <std::unsigned_integral T>
 constexpr T round_up_to(T n, T m) noexcept
 {
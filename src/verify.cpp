@@ -0,0 +1,68 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "error.h"
+#include "journal.h"
+#include "mapped.h"
+#include "prologue.h"
+#include "safe.h"
+#include "scan.h"
+#include "utility.h"
+#include "verify.h"
+
+namespace psafe3 {
+
+std::expected<void, std::error_code>
+verify(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, VerifyLevel level)
+{
+    if (level == VerifyLevel::full) {
+        auto safe = Safe::load(path, std::vector<std::byte>(pass_phrase.begin(), pass_phrase.end()));
+        if (!safe)
+            return std::unexpected(safe.error());
+        return {};
+    }
+
+    if (auto err = recover_journals(path); err)
+        return std::unexpected(err);
+    auto mapped_file = MappedFile::open(path, MemoryAccess::Read);
+    if (!mapped_file)
+        return std::unexpected(mapped_file.error());
+    auto& contents = mapped_file.value();
+    if (contents.size() < PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE)
+        return std::unexpected(Error::corrupt_file);
+
+    auto keys = unlock(contents.slice<PROLOGUE_SIZE>(0), pass_phrase);
+    if (!keys)
+        return std::unexpected(keys.error());
+    if (level == VerifyLevel::passphrase)
+        return {};
+
+    auto encrypted = contents.slice(PROLOGUE_SIZE, contents.size() - (PROLOGUE_SIZE + TWOFISH_SIZE + SHA256_SIZE));
+    size_t epilogue_offset = PROLOGUE_SIZE + encrypted.size();
+    if (contents.slice<TWOFISH_SIZE>(epilogue_offset) != DBEND)
+        return std::unexpected(Error::corrupt_file);
+
+    auto scanner = BodyScanner::create(encrypted, keys->k, contents.slice<IV_SIZE>(OFFSET_IV), keys->l);
+    if (!scanner)
+        return std::unexpected(scanner.error());
+    for (;;) {
+        auto field = scanner->next();
+        if (!field)
+            return std::unexpected(field.error());
+        if (!*field)
+            break;
+    }
+    auto computed_hmac = scanner->finish();
+    if (!computed_hmac)
+        return std::unexpected(computed_hmac.error());
+    if (*computed_hmac != contents.slice<SHA256_SIZE>(epilogue_offset + TWOFISH_SIZE))
+        return std::unexpected(Error::hmac_mismatch);
+    return {};
+}
+
+} // namespace psafe3
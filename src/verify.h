@@ -0,0 +1,26 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+namespace psafe3 {
+
+enum class VerifyLevel {
+    // Stretch the pass phrase and compare it with H(P').
+    passphrase,
+    // Also decrypt the body through a fixed-size secure buffer and check
+    // the HMAC, without building any records.
+    integrity,
+    // Everything Safe::load does.
+    full,
+};
+
+// Journals left by an interrupted rekey() or Safe::save_tail() are
+// recovered first, as by Safe::load().
+std::expected<void, std::error_code>
+verify(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, VerifyLevel level);
+
+} // namespace psafe3
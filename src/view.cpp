@@ -0,0 +1,223 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "executor.h"
+#include "fields.h"
+#include "view.h"
+
+namespace psafe3 {
+
+namespace {
+
+    // Key bytes: separates segments of a group path, ends a field, and is
+    // the least a folded character can be.
+    constexpr uint8_t SEGMENT = 0x01;
+    constexpr uint8_t END = 0x00;
+    constexpr uint8_t MIN_CHAR = 0x02;
+
+    // Below this many records a single thread sorts faster.
+    constexpr size_t PARALLEL_THRESHOLD = 32 * 1024;
+    constexpr unsigned MAX_PARTS = 8;
+
+    // Fold ASCII and the Latin-1 supplement (U+00C0 to U+00DE) to lower
+    // case. Other UTF-8 passes through unchanged.
+    uint8_t fold(uint8_t c, uint8_t prev)
+    {
+        if (c >= 'A' && c <= 'Z')
+            return static_cast<uint8_t>(c - 'A' + 'a');
+        if (prev == 0xc3 && c >= 0x80 && c <= 0x9e && c != 0x97)
+            return static_cast<uint8_t>(c + 0x20);
+        return std::max(c, MIN_CHAR);
+    }
+
+    // Append the key of one field to `out`, or only count its length when
+    // `out` is null.
+    size_t encode(std::span<const std::byte> data, bool group, bool descending, std::byte* out)
+    {
+        size_t n = 0;
+        auto emit = [&](uint8_t b) {
+            if (out)
+                out[n] = static_cast<std::byte>(descending ? static_cast<uint8_t>(~b) : b);
+            ++n;
+        };
+        uint8_t prev = 0;
+        for (size_t i = 0; i < data.size(); ++i) {
+            auto c = static_cast<uint8_t>(data[i]);
+            if (group && c == '\\' && i + 1 < data.size() && data[i + 1] == std::byte { '.' }) {
+                emit('.');
+                prev = '.';
+                ++i;
+            } else if (group && c == '.') {
+                emit(SEGMENT);
+                prev = c;
+            } else {
+                emit(fold(c, prev));
+                prev = c;
+            }
+        }
+        emit(END);
+        return n;
+    }
+
+    int compare(std::span<const std::byte> a, std::span<const std::byte> b) noexcept
+    {
+        if (int c = std::memcmp(a.data(), b.data(), std::min(a.size(), b.size())); c != 0)
+            return c;
+        return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+    }
+
+    // Sort chunks in parallel, then merge neighbours pairwise.
+    template <typename Less>
+    void parallel_sort(std::span<uint32_t> items, Less less, Executor& executor)
+    {
+        unsigned parts = std::min(executor.concurrency(), MAX_PARTS);
+        if (items.size() < PARALLEL_THRESHOLD || parts < 2) {
+            std::ranges::sort(items, less);
+            return;
+        }
+
+        std::vector<size_t> bounds;
+        for (unsigned t = 0; t <= parts; ++t)
+            bounds.push_back(items.size() * t / parts);
+        executor.bulk(parts, [&](size_t t) {
+            std::sort(items.begin() + bounds[t], items.begin() + bounds[t + 1], less);
+        });
+        while (bounds.size() > 2) {
+            executor.bulk((bounds.size() - 1) / 2, [&](size_t pair) {
+                auto first = items.begin() + bounds[2 * pair];
+                auto middle = items.begin() + bounds[2 * pair + 1];
+                auto last = items.begin() + bounds[2 * pair + 2];
+                std::inplace_merge(first, middle, last, less);
+            });
+            std::vector<size_t> merged;
+            for (size_t i = 0; i + 2 < bounds.size(); i += 2)
+                merged.push_back(bounds[i]);
+            if (bounds.size() % 2 == 0)
+                merged.push_back(bounds[bounds.size() - 2]);
+            merged.push_back(bounds.back());
+            bounds = std::move(merged);
+        }
+    }
+
+} // namespace
+
+RecordView::RecordView(std::span<const SortKey> spec, SecureBytes&& keys)
+    : spec_(spec.begin(), spec.end())
+    , keys_(std::move(keys))
+{
+}
+
+RecordView RecordView::build(std::span<const Record> records, std::span<const SortKey> spec, Executor& executor)
+{
+    RecordView view(spec, SecureBytes::mapped(1));
+    view.index(records);
+    view.order_.resize(records.size());
+    for (uint32_t i = 0; i < view.order_.size(); ++i)
+        view.order_[i] = i;
+    parallel_sort(std::span(view.order_), [&view](uint32_t a, uint32_t b) { return view.less(a, b); }, executor);
+    return view;
+}
+
+void RecordView::index(std::span<const Record> records)
+{
+    auto encode_record = [&](const Record& record, std::byte* out) {
+        size_t n = 0;
+        for (const auto& sort : spec_) {
+            const auto* field = find_field(record, sort.field);
+            auto data = field ? field->data : std::span<const std::byte>();
+            n += encode(data, sort.field == RecordFieldType::GROUP, sort.descending, out ? out + n : nullptr);
+        }
+        return n;
+    };
+
+    offsets_.clear();
+    offsets_.reserve(records.size() + 1);
+    size_t total = 0;
+    for (const auto& record : records) {
+        offsets_.push_back(static_cast<uint32_t>(total));
+        total += encode_record(record, nullptr);
+    }
+    offsets_.push_back(static_cast<uint32_t>(total));
+
+    keys_ = SecureBytes::mapped(std::max<size_t>(total, 1));
+    uuids_.clear();
+    uuids_.reserve(records.size());
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        encode_record(records[i], keys_.data(offsets_[i]));
+        uuids_.push_back(record_uuid(records[i]));
+    }
+}
+
+bool RecordView::less(uint32_t a, uint32_t b) const noexcept
+{
+    int c = compare(key(a), key(b));
+    return c != 0 ? c < 0 : a < b;
+}
+
+std::span<const uint32_t> RecordView::page(size_t number, size_t page_size) const noexcept
+{
+    if (page_size == 0 || number >= page_count(page_size))
+        return {};
+    auto first = number * page_size;
+    return std::span(order_).subspan(first, std::min(page_size, order_.size() - first));
+}
+
+size_t RecordView::refresh(std::span<const Record> records, Executor& executor)
+{
+    auto old_keys = std::move(keys_);
+    auto old_offsets = std::move(offsets_);
+    auto old_uuids = std::move(uuids_);
+    auto old_order = std::move(order_);
+    auto old_key = [&](uint32_t record) {
+        return old_keys.span(old_offsets[record], old_offsets[record + 1] - old_offsets[record]);
+    };
+    index(records);
+
+    std::unordered_map<Uuid, uint32_t, UuidHash> by_uuid;
+    by_uuid.reserve(records.size());
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        if (uuids_[i])
+            by_uuid.try_emplace(*uuids_[i], i);
+    }
+
+    // Unchanged records, in their old order, which is still sorted by key.
+    std::vector<uint32_t> kept;
+    std::vector<bool> placed(records.size());
+    kept.reserve(records.size());
+    for (auto old : old_order) {
+        if (!old_uuids[old])
+            continue;
+        auto it = by_uuid.find(*old_uuids[old]);
+        if (it == by_uuid.end() || placed[it->second] || compare(old_key(old), key(it->second)) != 0)
+            continue;
+        kept.push_back(it->second);
+        placed[it->second] = true;
+    }
+    // Records may have moved within the file, which breaks ties differently.
+    for (auto run = kept.begin(); run != kept.end();) {
+        auto end = std::find_if(run + 1, kept.end(), [&](uint32_t r) { return compare(key(r), key(*run)) != 0; });
+        if (end - run > 1)
+            std::sort(run, end);
+        run = end;
+    }
+
+    std::vector<uint32_t> changed;
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        if (!placed[i])
+            changed.push_back(i);
+    }
+    auto less = [this](uint32_t a, uint32_t b) { return this->less(a, b); };
+    parallel_sort(std::span(changed), less, executor);
+
+    order_.resize(records.size());
+    std::ranges::merge(kept, changed, order_.begin(), less);
+    return changed.size();
+}
+
+} // namespace psafe3
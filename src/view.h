@@ -0,0 +1,69 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "crypto.h"
+#include "executor.h"
+#include "fields.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+struct SortKey {
+    RecordFieldType field;
+    bool descending = false;
+};
+
+// Records in a fixed sort order, for listing them a page at a time.
+//
+// Every record gets a collation key when the view is built: the sort
+// fields are case-folded (ASCII and Latin-1) and encoded so that comparing
+// keys bytewise compares the records. Group paths sort segment by segment,
+// so "a.b" comes before "a b". Missing fields sort as empty. Ties keep file
+// order. The keys are kept in one secure buffer and the records are not
+// consulted after building; paging is a slice of the permutation.
+//
+// Large views are sorted in parallel on `executor`.
+class RecordView {
+public:
+    static RecordView build(std::span<const Record> records, std::span<const SortKey> spec,
+        Executor& executor = default_executor());
+
+    // Record indices in sort order.
+    std::span<const uint32_t> order() const noexcept { return order_; }
+    size_t size() const noexcept { return order_.size(); }
+
+    // Page `number` of `page_size` records, empty past the end.
+    std::span<const uint32_t> page(size_t number, size_t page_size) const noexcept;
+    size_t page_count(size_t page_size) const noexcept { return (order_.size() + page_size - 1) / page_size; }
+
+    // Resort for `records`, a reload of the records the view was built
+    // from. Records whose UUID was already present with the same sort
+    // fields keep their place relative to each other; only the others are
+    // sorted and merged in. Returns how many records were sorted.
+    size_t refresh(std::span<const Record> records, Executor& executor = default_executor());
+    size_t refresh(const Safe& safe, Executor& executor = default_executor()) { return refresh(safe.database(), executor); }
+
+private:
+    std::vector<SortKey> spec_;
+    SecureBytes keys_;
+    // Record i has key keys_[offsets_[i], offsets_[i + 1]).
+    std::vector<uint32_t> offsets_;
+    std::vector<std::optional<Uuid>> uuids_;
+    std::vector<uint32_t> order_;
+
+    RecordView(std::span<const SortKey> spec, SecureBytes&& keys);
+
+    void index(std::span<const Record> records);
+    std::span<const std::byte> key(uint32_t record) const noexcept
+    {
+        return keys_.span(offsets_[record], offsets_[record + 1] - offsets_[record]);
+    }
+    bool less(uint32_t a, uint32_t b) const noexcept;
+};
+
+} // namespace psafe3
@@ -0,0 +1,294 @@
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <ctime>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+#include <gcrypt.h>
+
+#include "crypto.h"
+#include "error.h"
+#include "fileio.h"
+#include "prologue.h"
+#include "utility.h"
+#include "writer.h"
+
+namespace psafe3 {
+
+namespace {
+    constexpr size_t LEN_SIZE = sizeof(uint32_t);
+}
+
+BodyWriter::BodyWriter(int fd, off_t offset, TwofishCBC&& cipher, SHA256HMA&& hmac)
+    : fd_(fd)
+    , offset_(offset)
+    , cipher_(std::move(cipher))
+    , hmac_(std::move(hmac))
+    , buffer_(BUFFER_SIZE)
+{
+}
+
+std::expected<BodyWriter, std::error_code>
+BodyWriter::create(int fd, off_t offset, TwofishCBC&& cipher, SHA256HMA&& hmac)
+{
+    return BodyWriter(fd, offset, std::move(cipher), std::move(hmac));
+}
+
+std::error_code BodyWriter::append(std::span<const std::byte> bytes)
+{
+    while (!bytes.empty()) {
+        auto n = std::min(bytes.size(), buffer_.size() - used_);
+        std::memcpy(buffer_.data(used_), bytes.data(), n);
+        used_ += n;
+        bytes = bytes.subspan(n);
+        if (used_ == buffer_.size()) {
+            if (auto err = flush(); err)
+                return err;
+        }
+    }
+    return {};
+}
+
+std::error_code BodyWriter::flush()
+{
+    assert(used_ % TWOFISH_SIZE == 0);
+    if (used_ == 0)
+        return {};
+    if (auto err = cipher_.encrypt(buffer_.span(0, used_)); err)
+        return err;
+    if (auto err = write_exact(fd_, buffer_.span(0, used_), offset_); err)
+        return err;
+    offset_ += static_cast<off_t>(used_);
+    used_ = 0;
+    return {};
+}
+
+std::error_code BodyWriter::write_field(uint8_t type, std::span<const std::byte> data)
+{
+    std::array<std::byte, LEN_SIZE + 1> prefix;
+    store<std::endian::little>(std::span(prefix).first<LEN_SIZE>(), static_cast<uint32_t>(data.size()));
+    prefix[LEN_SIZE] = static_cast<std::byte>(type);
+
+    if (auto err = append(prefix); err)
+        return err;
+    if (auto err = append(data); err)
+        return err;
+
+    // Pad the last block with random bytes as Password Safe does.
+    auto total = prefix.size() + data.size();
+    auto padding = round_up_to(total, TWOFISH_SIZE) - total;
+    if (padding > 0) {
+        // Nonces are drawn in batches; one call per field costs more than
+        // encrypting it.
+        if (padding_used_ + padding > padding_.size()) {
+            gcry_create_nonce(padding_.data(), padding_.size());
+            padding_used_ = 0;
+        }
+        if (auto err = append(std::span(padding_).subspan(padding_used_, padding)); err)
+            return err;
+        padding_used_ += padding;
+    }
+
+    if (type != static_cast<uint8_t>(RecordFieldType::END_OF_ENTRY))
+        hmac_.write(data);
+    return {};
+}
+
+std::error_code BodyWriter::end_entry()
+{
+    return write_field(static_cast<uint8_t>(RecordFieldType::END_OF_ENTRY), {});
+}
+
+std::error_code BodyWriter::write_record(const Record& record)
+{
+    for (const auto& field : record.fields) {
+        if (auto err = write_field(field); err)
+            return err;
+    }
+    return end_entry();
+}
+
+std::expected<off_t, std::error_code> BodyWriter::finish()
+{
+    if (auto err = flush(); err)
+        return std::unexpected(err);
+    if (auto err = write_exact(fd_, DBEND, offset_); err)
+        return std::unexpected(err);
+    offset_ += static_cast<off_t>(DBEND.size());
+
+    auto mac = hmac_.finish();
+    if (!mac)
+        return std::unexpected(mac.error());
+    if (auto err = write_exact(fd_, *mac, offset_); err)
+        return std::unexpected(err);
+    offset_ += static_cast<off_t>(mac->size());
+    return offset_;
+}
+
+// SafeWriter
+
+SafeWriter::SafeWriter(std::filesystem::path&& path, std::filesystem::path&& temp_path, FileDescriptor&& file,
+    BodyWriter&& body, bool replace) noexcept
+    : path_(std::move(path))
+    , temp_path_(std::move(temp_path))
+    , file_(std::move(file))
+    , body_(std::move(body))
+    , replace_(replace)
+{
+}
+
+SafeWriter::SafeWriter(SafeWriter&& other) noexcept
+    : path_(std::move(other.path_))
+    , temp_path_(std::exchange(other.temp_path_, {}))
+    , file_(std::move(other.file_))
+    , body_(std::move(other.body_))
+    , replace_(other.replace_)
+{
+}
+
+SafeWriter& SafeWriter::operator=(SafeWriter&& other) noexcept
+{
+    SafeWriter tmp(std::move(other));
+    std::swap(path_, tmp.path_);
+    std::swap(temp_path_, tmp.temp_path_);
+    std::swap(file_, tmp.file_);
+    std::swap(body_, tmp.body_);
+    std::swap(replace_, tmp.replace_);
+    return *this;
+}
+
+SafeWriter::~SafeWriter()
+{
+    if (!temp_path_.empty())
+        ::unlink(temp_path_.c_str());
+}
+
+std::expected<SafeWriter, std::error_code>
+SafeWriter::create(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, uint32_t iterations,
+    std::span<const HeaderField> header, bool replace)
+{
+    if (iterations < MIN_ITERATIONS)
+        return std::unexpected(Error::invalid_iterations);
+    // Checked again by commit(); failing here saves writing the body first.
+    struct stat st;
+    if (!replace && ::lstat(path.c_str(), &st) == 0)
+        return std::unexpected(std::make_error_code(std::errc::file_exists));
+
+    std::array<std::byte, PROLOGUE_SIZE> prologue;
+    std::memcpy(prologue.data(), MAGIC.data(), MAGIC_SIZE);
+    auto salt = std::span(prologue).subspan<SALT_OFFSET, SALT_SIZE>();
+    gcry_randomize(salt.data(), salt.size(), GCRY_STRONG_RANDOM);
+    store<std::endian::little>(std::span(prologue).subspan<ITER_OFFSET, ITER_SIZE>(), iterations);
+
+    auto stretched = stretch_key(pass_phrase, salt, iterations);
+    if (!stretched)
+        return std::unexpected(stretched.error());
+    auto key_hash = sha256(stretched->as_span());
+    if (!key_hash)
+        return std::unexpected(key_hash.error());
+    SecureBytes key_k(SHA256_SIZE);
+    SecureBytes key_l(SHA256_SIZE);
+    gcry_randomize(key_k.data(), key_k.size(), GCRY_STRONG_RANDOM);
+    gcry_randomize(key_l.data(), key_l.size(), GCRY_STRONG_RANDOM);
+    auto wrapped_k = wrap_random_key(*stretched, key_k);
+    if (!wrapped_k)
+        return std::unexpected(wrapped_k.error());
+    auto wrapped_l = wrap_random_key(*stretched, key_l);
+    if (!wrapped_l)
+        return std::unexpected(wrapped_l.error());
+    std::memcpy(prologue.data() + PASS_HASH_OFFSET, key_hash->data(), PASS_HASH_SIZE);
+    std::memcpy(prologue.data() + OFFSET_B1, wrapped_k->data(), 2 * B_SIZE);
+    std::memcpy(prologue.data() + OFFSET_B3, wrapped_l->data(), 2 * B_SIZE);
+    auto iv = std::span(prologue).subspan<OFFSET_IV, IV_SIZE>();
+    gcry_randomize(iv.data(), iv.size(), GCRY_STRONG_RANDOM);
+
+    auto cipher = TwofishCBC::create(key_k.as_span(), iv);
+    if (!cipher)
+        return std::unexpected(cipher.error());
+    auto hmac = SHA256HMA::create(key_l.as_span());
+    if (!hmac)
+        return std::unexpected(hmac.error());
+
+    std::string temp = path.string() + ".XXXXXX";
+    FileDescriptor file(::mkostemp(temp.data(), O_CLOEXEC));
+    if (!file)
+        return std::unexpected(last_system_error());
+    std::filesystem::path temp_path(temp);
+    auto body = BodyWriter::create(file.get(), PROLOGUE_SIZE, std::move(*cipher), std::move(*hmac));
+    if (!body) {
+        ::unlink(temp_path.c_str());
+        return std::unexpected(body.error());
+    }
+    auto fd = file.get();
+    std::filesystem::path target(path);
+    SafeWriter writer(std::move(target), std::move(temp_path), std::move(file), std::move(*body), replace);
+    if (auto err = write_exact(fd, prologue, 0); err)
+        return std::unexpected(err);
+
+    std::array<std::byte, 2> version;
+    store<std::endian::little>(std::span(version), FORMAT_VERSION);
+    uuid_t uuid;
+    ::uuid_generate_random(uuid);
+    std::span<const std::byte> uuid_data = std::as_bytes(std::span(uuid));
+    for (const auto& field : header) {
+        if (field.type == HeaderFieldType::UUID && field.data.size() == sizeof(uuid_t))
+            uuid_data = field.data;
+    }
+    std::array<std::byte, 4> now;
+    store<std::endian::little>(std::span(now), static_cast<uint32_t>(std::time(nullptr)));
+    auto& out = writer.body();
+    const std::pair<HeaderFieldType, std::span<const std::byte>> standard[] = {
+        { HeaderFieldType::VERSION, version },
+        { HeaderFieldType::UUID, uuid_data },
+        { HeaderFieldType::TIMESTAMP_OF_LAST_SAVE, now },
+    };
+    for (auto [type, data] : standard) {
+        if (auto err = out.write_field(static_cast<uint8_t>(type), data); err)
+            return std::unexpected(err);
+    }
+    for (const auto& field : header) {
+        if (std::ranges::any_of(standard, [&](const auto& s) { return s.first == field.type; }))
+            continue;
+        if (auto err = out.write_field(field); err)
+            return std::unexpected(err);
+    }
+    if (auto err = out.end_entry(); err)
+        return std::unexpected(err);
+    return writer;
+}
+
+std::expected<void, std::error_code> SafeWriter::commit()
+{
+    auto end = body_.finish();
+    if (!end)
+        return std::unexpected(end.error());
+    if (::fsync(file_.get()) != 0)
+        return std::unexpected(last_system_error());
+    if (replace_) {
+        if (::rename(temp_path_.c_str(), path_.c_str()) != 0)
+            return std::unexpected(last_system_error());
+    } else {
+        // Unlike rename(), link() fails rather than replace `path_`.
+        if (::link(temp_path_.c_str(), path_.c_str()) != 0)
+            return std::unexpected(last_system_error());
+        ::unlink(temp_path_.c_str());
+    }
+    temp_path_.clear();
+    if (auto err = sync_directory(path_); err)
+        return std::unexpected(err);
+    return {};
+}
+
+} // namespace psafe3
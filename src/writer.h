@@ -0,0 +1,108 @@
+#pragma once
+// https://github.com/marcbutler/libpsafe3/LICENSE
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+#include <sys/types.h>
+
+#include "crypto.h"
+#include "fileio.h"
+#include "safe.h"
+
+namespace psafe3 {
+
+// Encodes fields into the v3 body format, encrypts them and feeds the HMAC
+// as it goes. Plaintext is staged in a fixed-size secure buffer and written
+// to `fd` at increasing offsets, so memory use does not depend on how much is
+// written.
+class BodyWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 16 * 1024;
+
+    // `cipher` must be positioned at the chaining value for `offset` and
+    // `hmac` must hold the state after all earlier fields.
+    static std::expected<BodyWriter, std::error_code>
+    create(int fd, off_t offset, TwofishCBC&& cipher, SHA256HMA&& hmac);
+
+    std::error_code write_field(uint8_t type, std::span<const std::byte> data);
+    std::error_code end_entry();
+
+    template <typename E>
+    std::error_code write_field(const Field<E>& field)
+    {
+        return write_field(static_cast<uint8_t>(field.type), field.data);
+    }
+
+    // Fields followed by END_OF_ENTRY.
+    std::error_code write_record(const Record& record);
+
+    // Flush, then write the EOF marker and the HMAC. Returns the offset just
+    // past the end of the file.
+    std::expected<off_t, std::error_code> finish();
+
+private:
+    int fd_;
+    off_t offset_;
+    TwofishCBC cipher_;
+    SHA256HMA hmac_;
+    SecureBytes buffer_;
+    size_t used_ = 0;
+    std::array<std::byte, 64 * TWOFISH_SIZE> padding_;
+    size_t padding_used_ = 64 * TWOFISH_SIZE;
+
+    BodyWriter(int fd, off_t offset, TwofishCBC&& cipher, SHA256HMA&& hmac);
+
+    std::error_code append(std::span<const std::byte> bytes);
+    std::error_code flush();
+};
+
+// Writes a new safe from scratch, one record at a time, in constant memory.
+//
+// create() picks fresh random keys K and L, writes the prologue and a
+// header with VERSION, a new UUID and TIMESTAMP_OF_LAST_SAVE followed by
+// `header`, all into a temporary file next to `path`. A UUID in `header`
+// is kept instead of the new one; its VERSION and TIMESTAMP_OF_LAST_SAVE
+// are replaced. commit() finishes the body, syncs the file and moves it to
+// `path`; a SafeWriter that is destroyed uncommitted removes the temporary
+// file.
+//
+// Unless `replace` is set, an existing file at `path` is never touched:
+// create() fails with std::errc::file_exists if there is one, and commit()
+// links the temporary file into place so that it fails the same way if one
+// turned up since.
+class SafeWriter {
+public:
+    // The format version written, 3.13.
+    static constexpr uint16_t FORMAT_VERSION = 0x030d;
+
+    static std::expected<SafeWriter, std::error_code>
+    create(const std::filesystem::path& path, std::span<const std::byte> pass_phrase, uint32_t iterations,
+        std::span<const HeaderField> header = {}, bool replace = false);
+
+    ~SafeWriter();
+    SafeWriter(SafeWriter&&) noexcept;
+    SafeWriter& operator=(SafeWriter&&) noexcept;
+
+    BodyWriter& body() noexcept { return body_; }
+    std::error_code write_record(const Record& record) { return body_.write_record(record); }
+
+    std::expected<void, std::error_code> commit();
+
+private:
+    std::filesystem::path path_;
+    std::filesystem::path temp_path_;
+    FileDescriptor file_;
+    BodyWriter body_;
+    bool replace_;
+
+    SafeWriter(std::filesystem::path&& path, std::filesystem::path&& temp_path, FileDescriptor&& file,
+        BodyWriter&& body, bool replace) noexcept;
+};
+
+} // namespace psafe3